@@ -0,0 +1,42 @@
+#ifndef AI_BACKEND_H
+#define AI_BACKEND_H
+
+#include "server.h"
+#include "upstream.h"
+
+/**
+ * @brief Receives one streamed text fragment (null-terminated)
+ * @return 0 to continue, -1 to abort the stream
+ */
+typedef int (*ai_stream_callback_t)(const char * text, void * context);
+
+/**
+ * @brief Provider-specific half of an AI call
+ * ai_client.c does the rest (quota, circuit breaker, transfer, SSE framing,
+ * retries and hedging) the same way for every backend
+ */
+typedef struct
+{
+  const char * name;         // Selected with $AI_BACKEND
+  const char * default_base; // Endpoint unless $GEMINI_API_BASE_URL overrides it
+
+  // Build the request body (malloc'd, length set) and headers of a call
+  char * (*prepare)(int stream, const char * personality, const char * language,
+                    const char * conversation, size_t * length, struct curl_slist ** headers);
+  // Write the request URL for an endpoint and API key
+  void (*request_url)(char * url, size_t size, const char * api_base, int stream, const char * api_key);
+  // Start a prepared call: 0 if its completion callback will run, -1 on error
+  int (*perform)(upstream_call_t * call);
+  // Parser of complete answers, fed as the bytes arrive (parser_size bytes of state per transfer)
+  size_t parser_size;
+  // Start parsing an answer into a response (also before a retry)
+  void (*parse_begin)(void * parser, ai_response_t * response);
+  // Parse the next bytes of the answer
+  void (*parse_bytes)(void * parser, const char * data, size_t size);
+  // Finish the response once the transfer is over: 0 on success, -1 on error
+  int (*parse_end)(void * parser, CURLcode result, long http_code);
+  // Deliver the text fragments of one streamed event: -1 if on_fragment aborted
+  int (*parse_event)(const char * data, ai_stream_callback_t on_fragment, void * context);
+} ai_backend_t;
+
+#endif /* AI_BACKEND_H */
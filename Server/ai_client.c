@@ -0,0 +1,684 @@
+/*********************************************************************************
+ * ===== FILE: ai_client.h/ai_client.c =====
+ * Backend-independent half of the AI calls
+ * Circuit breaker, API key quota, response collection, server-sent events
+ * framing, retries and hedging are the same for every provider; the
+ * selected ai_backend_t builds the request, performs it and parses the
+ * answer (see gemini_ai.c)
+ *********************************************************************************/
+
+#include "ai_client.h"
+#include "api_keys.h"
+#include "circuit_breaker.h"
+#include "gemini_ai.h"
+#include "utils.h"
+
+// Backends that can be selected with $AI_BACKEND
+static const ai_backend_t *const g_backends[] = {&gemini_backend};
+static const ai_backend_t *g_backend = &gemini_backend;
+
+/**
+ * @brief Select the AI backend
+ * @param backend_name Name of the backend (NULL or empty keeps the default)
+ * @return 0 on success, -1 if no backend has that name
+ */
+int ai_client_init(const char *backend_name)
+{
+  if (!backend_name || backend_name[0] == '\0')
+  {
+    return (0);
+  }
+  for (size_t i = 0; i < sizeof(g_backends) / sizeof(g_backends[0]); ++i)
+  {
+    if (strcmp(g_backends[i]->name, backend_name) == 0)
+    {
+      g_backend = g_backends[i];
+      return (0);
+    }
+  }
+  return (-1);
+}
+
+/**
+ * @brief Get the selected AI backend
+ */
+const ai_backend_t *ai_client_backend(void)
+{
+  return (g_backend);
+}
+
+/**
+ * @brief cURL write callback for complete answers
+ * The bytes go straight to the backend's parser; nothing is buffered
+ * @return Number of bytes processed
+ */
+static size_t
+ai_write_callback(void *contents, size_t size, size_t nmemb, void *parser)
+{
+  size_t realsize = size * nmemb;
+
+  g_backend->parse_bytes(parser, contents, realsize);
+  return (realsize);
+}
+
+/**
+ * @brief API key quota of a call
+ * Every attempt (first, retries, hedged duplicate) reserves the call's
+ * tokens, on the key with the most headroom at the time
+ */
+typedef struct
+{
+  const char *api_base; // Model endpoint URL
+  int stream;           // 1 for the streaming endpoint
+  long tokens;          // Tokens reserved per attempt
+  int key;              // API key of the original transfer
+  int hedge_key;        // API key of the hedged transfer
+} ai_quota_t;
+
+/**
+ * @brief Reserve quota for another attempt of a call
+ * When another key has more headroom the transfer is pointed at it
+ * @param easy Transfer about to be started
+ * @param max_delay_ms Longest acceptable wait for quota
+ * @param delay_ms Set to the wait for quota
+ * @param key Key of the transfer, updated to the key reserved
+ * @return 0 on success, -1 if no key has quota soon enough (nothing reserved)
+ */
+static int
+reserve_attempt(const ai_quota_t *quota, CURL *easy, long max_delay_ms, long *delay_ms, int *key)
+{
+  int reserved = api_keys_reserve(quota->tokens, max_delay_ms, delay_ms);
+  if (reserved < 0)
+  {
+#if SHOW_DEBUG
+    printf("[DEBUG] No API key quota for another attempt\n");
+#endif
+    return (-1);
+  }
+  if (reserved != *key)
+  {
+    char url[1024];
+    g_backend->request_url(url, sizeof(url), quota->api_base, quota->stream, api_keys_get(reserved));
+    curl_easy_setopt(easy, CURLOPT_URL, url);
+    *key = reserved;
+  }
+  return (0);
+}
+
+/**
+ * @brief Give back the quota of an attempt the upstream engine dropped
+ * before sending it
+ * @param hedge 1 for the hedged transfer, 0 for the original one
+ */
+static void
+release_attempt(const ai_quota_t *quota, int hedge)
+{
+  api_keys_release(hedge ? quota->hedge_key : quota->key, quota->tokens);
+}
+
+/**
+ * @brief Prepare an upstream call through the selected backend
+ * The backend builds the request, then quota is reserved on the API key
+ * with the most headroom and the request URL is built. A call that must
+ * wait for quota starts after call->start_delay_ms
+ * @param api_base Model endpoint URL
+ * @param stream 1 for a streamed answer, 0 for a complete one
+ * @param personality User's personality profile
+ * @param language User's language preference
+ * @param conversation Complete conversation including history and current message
+ * @param on_complete Completion callback (runs on an upstream thread)
+ * @param context Passed to on_complete through call->context
+ * @param quota Set to the call's quota; quota->key is the API key used,
+ *        AI_CALL_REJECTED if no key has quota soon enough, -1 on other errors
+ * @return The call, or NULL on error
+ */
+static upstream_call_t *
+prepare_ai_call(
+    const char *api_base,
+    int stream,
+    const char *personality,
+    const char *language,
+    const char *conversation,
+    upstream_complete_t on_complete,
+    void *context,
+    ai_quota_t *quota)
+{
+#if SHOW_DEBUG
+  printf("[DEBUG] Preparing %s AI API call\n", g_backend->name);
+#endif
+  quota->api_base = api_base;
+  quota->stream = stream;
+  quota->key = -1;
+  quota->hedge_key = -1;
+
+  size_t request_length = 0;
+  struct curl_slist *headers = NULL;
+  char *json_request = g_backend->prepare(stream, personality, language, conversation,
+                                          &request_length, &headers);
+  if (!json_request)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Failed to generate %s request\n", g_backend->name);
+#endif
+    curl_slist_free_all(headers);
+    return (NULL);
+  }
+#if SHOW_DEBUG
+  printf("[DEBUG] %s request JSON: %s\n", g_backend->name, json_request);
+#endif
+  // About 4 bytes per token, plus room for the answer
+  long delay_ms = 0;
+  quota->tokens = (long)(request_length / 4) + API_KEY_OUTPUT_TOKENS;
+  quota->key = api_keys_reserve(quota->tokens, API_KEY_MAX_QUEUE_MS, &delay_ms);
+  if (quota->key < 0)
+  {
+#if SHOW_WARNING
+    printf("[WARNING] Every API key is out of quota, call refused\n");
+#endif
+    free(json_request);
+    curl_slist_free_all(headers);
+    quota->key = AI_CALL_REJECTED;
+    return (NULL);
+  }
+
+  // Build request URL with API key
+  char url[1024];
+  g_backend->request_url(url, sizeof(url), api_base, stream, api_keys_get(quota->key));
+
+  // The call owns the body and headers from here on
+  upstream_call_t *call = upstream_call_create(url, json_request, headers, on_complete, context);
+  if (!call)
+  {
+    api_keys_release(quota->key, quota->tokens);
+    return (NULL);
+  }
+  call->start_delay_ms = delay_ms;
+  return (call);
+}
+
+/**
+ * @brief Pending call for a complete answer
+ */
+typedef struct
+{
+  ai_response_t response;         // Parsed from the original request's answer
+  ai_response_t hedge_response;   // Parsed from the hedged request's answer
+  void *parser;                   // Backend parser state of the original request
+  void *hedge_parser;             // Backend parser state of the hedged request
+  ai_quota_t quota;               // API keys the transfers were sent with
+  ai_response_callback_t on_done; // Receives the parsed response
+  void *context;                  // Passed to on_done
+  max_align_t parsers[];          // Storage of both parsers
+} ai_call_t;
+
+/**
+ * @brief Report the outcome of a finished call to the circuit breaker and key pool
+ * Calls aborted on our side (shutdown, client gone) say nothing about
+ * the provider and only give their permission back; a 429 tells the key
+ * pool that the key is out of quota
+ * @param key API key the call was sent with
+ * @param easy Handle of the transfer that decided the call
+ * @param latency Timing that counts as the call's latency
+ */
+static void
+record_call_outcome(int key, CURL *easy, CURLINFO latency, CURLcode result, long http_code)
+{
+  if (result == CURLE_ABORTED_BY_CALLBACK || result == CURLE_WRITE_ERROR)
+  {
+    circuit_breaker_cancel();
+    return;
+  }
+  if (http_code == 429)
+  {
+    api_keys_report_limited(key);
+  }
+
+  curl_off_t latency_us = 0;
+  curl_easy_getinfo(easy, latency, &latency_us);
+  circuit_breaker_record(result != CURLE_OK || http_code != 200, (long)(latency_us / 1000));
+}
+
+/**
+ * @brief Upstream completion of a call for a complete answer
+ */
+static void
+ai_call_complete(upstream_call_t *call, CURLcode result, long http_code)
+{
+  ai_call_t *pending = (ai_call_t *)call->context;
+
+  record_call_outcome(call->winner ? pending->quota.hedge_key : pending->quota.key,
+                      call->winner ? call->hedge : call->easy, CURLINFO_TOTAL_TIME_T, result, http_code);
+
+  g_backend->parse_end(call->winner ? pending->hedge_parser : pending->parser, result, http_code);
+  pending->on_done(call->winner ? &pending->hedge_response : &pending->response, pending->context);
+
+  free(pending);
+}
+
+/**
+ * @brief Reserve quota and restart the parser before the upstream engine
+ * retries a failed attempt
+ */
+static int
+ai_call_retry(upstream_call_t *call, long max_delay_ms, long *delay_ms)
+{
+  ai_call_t *pending = (ai_call_t *)call->context;
+
+  if (reserve_attempt(&pending->quota, call->easy, max_delay_ms, delay_ms, &pending->quota.key) != 0)
+  {
+    return (-1);
+  }
+  g_backend->parse_begin(pending->parser, &pending->response);
+  return (0);
+}
+
+/**
+ * @brief Reserve quota for a hedged request and parse its answer apart
+ * from the original's
+ * A hedge is only worth sending at once: it is skipped if it would wait for quota
+ */
+static int
+ai_call_hedge(upstream_call_t *call, CURL *hedge)
+{
+  ai_call_t *pending = (ai_call_t *)call->context;
+  long delay_ms = 0;
+
+  pending->quota.hedge_key = pending->quota.key;
+  if (reserve_attempt(&pending->quota, hedge, 0, &delay_ms, &pending->quota.hedge_key) != 0)
+  {
+    return (-1);
+  }
+  g_backend->parse_begin(pending->hedge_parser, &pending->hedge_response);
+  curl_easy_setopt(hedge, CURLOPT_WRITEDATA, pending->hedge_parser);
+  return (0);
+}
+
+/**
+ * @brief Give back the quota of a transfer the upstream engine did not send
+ */
+static void
+ai_call_unsent(upstream_call_t *call, int hedge)
+{
+  release_attempt(&((ai_call_t *)call->context)->quota, hedge);
+}
+
+/**
+ * @brief Generate AI response based on personality, language, and conversation
+ * The call is prepared here and performed by the backend (the upstream
+ * engine), so the calling worker does not wait for the provider
+ * @param api_base Model endpoint URL
+ * @param personality User's personality profile
+ * @param language User's language preference
+ * @param conversation Complete conversation including history and current message
+ * @param on_done Receives the response (success flag set) on an upstream thread
+ * @param context Passed to on_done
+ * @return 0 if the call was started (on_done runs exactly once), -1 on error,
+ *         AI_CALL_REJECTED while the circuit breaker is open or no API key has
+ *         quota (on_done is not called in either case)
+ */
+int generate_ai_response(const char *api_base,
+                         const char *personality,
+                         const char *language,
+                         const char *conversation,
+                         ai_response_callback_t on_done,
+                         void *context)
+{
+  if (!circuit_breaker_allow())
+  {
+    return (AI_CALL_REJECTED);
+  }
+
+  // One allocation holds the call and its two parsers
+  size_t parser_slots = (g_backend->parser_size + sizeof(max_align_t) - 1) / sizeof(max_align_t);
+  ai_call_t *pending = malloc(sizeof(ai_call_t) + 2 * parser_slots * sizeof(max_align_t));
+  if (!pending)
+  {
+    circuit_breaker_cancel();
+    return (-1);
+  }
+  pending->parser = pending->parsers;
+  pending->hedge_parser = pending->parsers + parser_slots;
+  pending->on_done = on_done;
+  pending->context = context;
+
+  upstream_call_t *call = prepare_ai_call(api_base, 0, personality, language, conversation,
+                                          ai_call_complete, pending, &pending->quota);
+  if (!call)
+  {
+    int key = pending->quota.key;
+    free(pending);
+    circuit_breaker_cancel();
+    return (key == AI_CALL_REJECTED ? AI_CALL_REJECTED : -1);
+  }
+
+  g_backend->parse_begin(pending->parser, &pending->response);
+  curl_easy_setopt(call->easy, CURLOPT_WRITEFUNCTION, ai_write_callback);
+  curl_easy_setopt(call->easy, CURLOPT_WRITEDATA, pending->parser);
+  call->on_retry = ai_call_retry;
+  call->on_hedge = ai_call_hedge;
+  call->on_unsent = ai_call_unsent;
+
+  if (g_backend->perform(call) < 0)
+  {
+    release_attempt(&pending->quota, 0);
+    upstream_call_destroy(call);
+    free(pending);
+    circuit_breaker_cancel();
+    return (-1);
+  }
+  return (0);
+}
+
+/**
+ * @brief State of a server-sent events stream being parsed
+ * Bytes are accumulated until a complete line is available; "data:" lines
+ * are joined until the blank line that ends the event
+ */
+typedef struct
+{
+  char *buffer;                      // Received bytes not yet split into lines
+  size_t length;                     // Valid bytes in buffer
+  size_t capacity;                   // Allocated size of buffer
+  char *event;                       // Data of the event being assembled
+  size_t event_length;               // Valid bytes in event
+  size_t event_capacity;             // Allocated size of event
+  ai_stream_callback_t on_chunk;     // Receives each text fragment
+  ai_stream_ready_callback_t on_ready; // Pauses the transfer while the receiver is behind
+  ai_stream_done_callback_t on_done; // Receives the outcome
+  void *context;                     // Passed to the callbacks
+  upstream_call_t *call;             // Call carrying the stream
+  int chunks;                        // Number of fragments delivered
+  int aborted;                       // 1 when on_chunk asked to stop
+  ai_quota_t quota;                  // API key quota of the stream
+} sse_stream_t;
+
+/**
+ * @brief Append bytes to a growable buffer (always keeps a null terminator)
+ * @return 0 on success, -1 on allocation failure
+ */
+static int
+append_bytes(char **buffer, size_t *length, size_t *capacity, const char *data, size_t size)
+{
+  if (*length + size + 1 > *capacity)
+  {
+    size_t new_capacity = (*capacity > 0) ? *capacity : 1024;
+    while (*length + size + 1 > new_capacity)
+    {
+      new_capacity *= 2;
+    }
+    char *ptr = realloc(*buffer, new_capacity);
+    if (!ptr)
+    {
+      return (-1);
+    }
+    *buffer = ptr;
+    *capacity = new_capacity;
+  }
+  memcpy(*buffer + *length, data, size);
+  *length += size;
+  (*buffer)[*length] = '\0';
+  return (0);
+}
+
+/**
+ * @brief Pass one fragment of a streamed answer to the client callback
+ */
+static int
+deliver_fragment(const char *fragment, void *context)
+{
+  sse_stream_t *stream = (sse_stream_t *)context;
+
+  if (fragment[0] == '\0')
+  {
+    return (0);
+  }
+  if (stream->on_chunk(fragment, stream->context) < 0)
+  {
+    stream->aborted = 1;
+    return (-1);
+  }
+  ++stream->chunks;
+  return (0);
+}
+
+/**
+ * @brief Deliver the text of one complete server-sent event
+ */
+static void
+dispatch_sse_event(sse_stream_t *stream)
+{
+  stream->event_length = 0;
+  g_backend->parse_event(stream->event, deliver_fragment, stream);
+}
+
+/**
+ * @brief cURL write callback for server-sent events
+ * @return Number of bytes processed, 0 to abort the transfer
+ */
+static size_t
+sse_write_callback(void *contents, size_t size, size_t nmemb, sse_stream_t *stream)
+{
+  size_t realsize = size * nmemb;
+
+  // Receiver behind: curl keeps the bytes and hands them over again on resume
+  if (!stream->aborted && stream->on_ready && !stream->on_ready(stream->context))
+  {
+    upstream_call_pause(stream->call);
+    return (CURL_WRITEFUNC_PAUSE);
+  }
+
+  if (append_bytes(&stream->buffer, &stream->length, &stream->capacity,
+                   contents, realsize) < 0)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Not enough memory for stream data\n");
+#endif
+    return (0);
+  }
+
+  // Split complete lines
+  size_t start = 0;
+  char *newline;
+  while (!stream->aborted &&
+         (newline = memchr(stream->buffer + start, '\n', stream->length - start)) != NULL)
+  {
+    char *line = stream->buffer + start;
+    size_t line_length = (size_t)(newline - line);
+    start += line_length + 1;
+
+    if (line_length > 0 && line[line_length - 1] == '\r')
+    {
+      --line_length;
+    }
+
+    if (line_length == 0)
+    {
+      // Blank line: end of event
+      if (stream->event_length > 0)
+      {
+        dispatch_sse_event(stream);
+      }
+      continue;
+    }
+
+    if (line_length >= 5 && strncmp(line, "data:", 5) == 0)
+    {
+      const char *value = line + 5;
+      size_t value_length = line_length - 5;
+      if (value_length > 0 && *value == ' ')
+      {
+        ++value;
+        --value_length;
+      }
+      // Multi-line data is joined with newlines
+      if ((stream->event_length > 0 &&
+           append_bytes(&stream->event, &stream->event_length, &stream->event_capacity, "\n", 1) < 0) ||
+          append_bytes(&stream->event, &stream->event_length, &stream->event_capacity,
+                       value, value_length) < 0)
+      {
+        return (0);
+      }
+    }
+    // Other fields (event:, id:, retry:) and comments are ignored
+  }
+
+  stream->length -= start;
+  memmove(stream->buffer, stream->buffer + start, stream->length);
+
+  return stream->aborted ? (0) : (realsize);
+}
+
+/**
+ * @brief Upstream completion of a streamed call
+ */
+static void
+sse_stream_complete(upstream_call_t *call, CURLcode res, long http_code)
+{
+  sse_stream_t *stream = (sse_stream_t *)call->context;
+
+  // A stream is as slow as its first byte
+  record_call_outcome(stream->quota.key, call->easy, CURLINFO_STARTTRANSFER_TIME_T, res, http_code);
+
+  // A last event may not be followed by a blank line
+  if (res == CURLE_OK && !stream->aborted && stream->event_length > 0)
+  {
+    dispatch_sse_event(stream);
+  }
+
+  int result = 0;
+  if (res != CURLE_OK || http_code != 200 || stream->aborted)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] %s stream failed: %s (HTTP %ld, %d chunks)\n", g_backend->name,
+           stream->aborted ? "aborted" : curl_easy_strerror(res), http_code, stream->chunks);
+#endif
+    result = -1;
+  }
+#if SHOW_INFO
+  else
+  {
+    printf("[INFO] %s stream completed (%d chunks)\n", g_backend->name, stream->chunks);
+  }
+#endif
+
+  stream->on_done(result, stream->chunks, stream->context);
+
+  free(stream->buffer);
+  free(stream->event);
+  free(stream);
+}
+
+/**
+ * @brief Resume a paused stream once its receiver caught up
+ */
+static int
+sse_stream_ready(upstream_call_t *call)
+{
+  sse_stream_t *stream = (sse_stream_t *)call->context;
+
+  return (stream->on_ready(stream->context));
+}
+
+/**
+ * @brief Decide whether a failed stream may be retried, and reserve its quota
+ * Only before the first fragment: the client has already seen the others
+ */
+static int
+sse_stream_retry(upstream_call_t *call, long max_delay_ms, long *delay_ms)
+{
+  sse_stream_t *stream = (sse_stream_t *)call->context;
+
+  if (stream->chunks > 0 || stream->aborted ||
+      reserve_attempt(&stream->quota, call->easy, max_delay_ms, delay_ms, &stream->quota.key) != 0)
+  {
+    return (-1);
+  }
+  stream->length = 0;
+  stream->event_length = 0;
+  return (0);
+}
+
+/**
+ * @brief Give back the quota of a stream attempt the upstream engine did not send
+ */
+static void
+sse_stream_unsent(upstream_call_t *call, int hedge)
+{
+  release_attempt(&((sse_stream_t *)call->context)->quota, hedge);
+}
+
+/**
+ * @brief Stream an AI response, delivering text fragments as they arrive
+ * The backend's streaming endpoint answers with server-sent events, so the
+ * first sentence reaches the client while the rest is still generated.
+ * The transfer is driven by the upstream engine; callbacks run there
+ * @param api_base Model endpoint URL
+ * @param personality User's personality profile
+ * @param language User's language preference
+ * @param conversation Complete conversation including history and current message
+ * @param on_chunk Called with each non-empty text fragment, in order
+ * @param on_ready Called before more fragments are parsed: while it returns
+ *        0 the transfer is paused (NULL = never pause)
+ * @param on_done Called once at the end: 0 when the stream completed, -1 on
+ *        error or abort, and the number of fragments delivered
+ * @param context Passed to on_chunk, on_ready and on_done
+ * @return 0 if the stream was started, -1 on error, AI_CALL_REJECTED while
+ *         the circuit breaker is open or no API key has quota (no callback
+ *         is called)
+ */
+int stream_ai_response(const char *api_base,
+                       const char *personality,
+                       const char *language,
+                       const char *conversation,
+                       ai_stream_callback_t on_chunk,
+                       ai_stream_ready_callback_t on_ready,
+                       ai_stream_done_callback_t on_done,
+                       void *context)
+{
+  if (!circuit_breaker_allow())
+  {
+    return (AI_CALL_REJECTED);
+  }
+
+  sse_stream_t *stream = calloc(1, sizeof(sse_stream_t));
+  if (!stream)
+  {
+    circuit_breaker_cancel();
+    return (-1);
+  }
+  stream->on_chunk = on_chunk;
+  stream->on_ready = on_ready;
+  stream->on_done = on_done;
+  stream->context = context;
+
+  upstream_call_t *call = prepare_ai_call(api_base, 1, personality, language, conversation,
+                                          sse_stream_complete, stream, &stream->quota);
+  if (!call)
+  {
+    int key = stream->quota.key;
+    free(stream);
+    circuit_breaker_cancel();
+    return (key == AI_CALL_REJECTED ? AI_CALL_REJECTED : -1);
+  }
+
+  stream->call = call;
+  curl_easy_setopt(call->easy, CURLOPT_WRITEFUNCTION, sse_write_callback);
+  curl_easy_setopt(call->easy, CURLOPT_WRITEDATA, stream);
+  call->on_retry = sse_stream_retry;
+  call->on_unsent = sse_stream_unsent;
+  if (on_ready)
+  {
+    call->on_ready = sse_stream_ready;
+  }
+
+  if (g_backend->perform(call) < 0)
+  {
+    release_attempt(&stream->quota, 0);
+    upstream_call_destroy(call);
+    free(stream);
+    circuit_breaker_cancel();
+    return (-1);
+  }
+  return (0);
+}
+
@@ -0,0 +1,35 @@
+#ifndef AI_CLIENT_H
+#define AI_CLIENT_H
+
+#include "ai_backend.h"
+
+#define AI_CALL_REJECTED (-2) // Circuit breaker open or no key with quota: no call was made
+
+/**
+ * @brief Receives the response of an AI call (response->success tells the outcome)
+ */
+typedef void (*ai_response_callback_t)(const ai_response_t * response, void * context);
+
+/**
+ * @brief Receives the outcome of a stream (0 completed, -1 failed) and the
+ * number of fragments delivered
+ */
+typedef void (*ai_stream_done_callback_t)(int result, int chunks, void * context);
+
+/**
+ * @brief Tells whether the receiver of a stream can take more fragments
+ * @return 1 if it can, 0 to pause the transfer until it can
+ */
+typedef int (*ai_stream_ready_callback_t)(void * context);
+
+int ai_client_init(const char * backend_name);
+const ai_backend_t * ai_client_backend(void);
+int generate_ai_response(const char * api_base,
+                         const char * personality, const char * language_code, const char * conversation,
+                         ai_response_callback_t on_done, void * context);
+int stream_ai_response(const char * api_base,
+                       const char * personality, const char * language_code, const char * conversation,
+                       ai_stream_callback_t on_chunk, ai_stream_ready_callback_t on_ready,
+                       ai_stream_done_callback_t on_done, void * context);
+
+#endif /* AI_CLIENT_H */
@@ -0,0 +1,287 @@
+/*********************************************************************************
+ * ===== FILE: api_keys.h/api_keys.c =====
+ * Gemini API keys and their local quotas
+ * $GEMINI_API_KEY may list several keys. Each key has two token buckets,
+ * requests per minute and tokens per minute, refilled continuously. A call
+ * reserves one request and its estimated tokens from the key with the
+ * most headroom. When no key can afford it now, the reservation is taken
+ * anyway and the caller is told how long to wait (the buckets go into
+ * debt, so waiting calls queue in order); past API_KEY_MAX_QUEUE_MS the
+ * call is refused instead of being sent to a certain 429. Retries and
+ * hedged duplicates reserve quota like a new call; quota of a call that
+ * is not sent after all is given back
+ *********************************************************************************/
+
+#include "api_keys.h"
+#include "utils.h"
+
+/**
+ * @brief One API key with its quota buckets
+ */
+typedef struct
+{
+  char value[API_KEY_MAX_LENGTH];
+  double requests;       // Requests available (negative = owed by queued calls)
+  double tokens;         // Tokens available
+  long refilled_ms;      // Time of the last refill
+  long limited;          // 429 answers received
+  long used;             // Calls sent with the key
+} api_key_t;
+
+static pthread_mutex_t g_key_lock = PTHREAD_MUTEX_INITIALIZER;
+static api_key_t g_keys[API_KEY_MAX_COUNT];
+static int g_key_count = 0;
+static long g_requests_per_min = 0; // 0 = unlimited
+static long g_tokens_per_min = 0;   // 0 = unlimited
+
+// Statistics
+static atomic_long g_queued;
+static atomic_long g_refused;
+
+/**
+ * @brief Current monotonic time in milliseconds
+ */
+static long
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000L + ts.tv_nsec / 1000000L);
+}
+
+/**
+ * @brief Refill a key's buckets up to one minute of quota (caller holds the lock)
+ */
+static void
+refill(api_key_t *key, long now)
+{
+  double minutes = (now - key->refilled_ms) / 60000.0;
+  key->refilled_ms = now;
+
+  key->requests += minutes * g_requests_per_min;
+  if (key->requests > g_requests_per_min)
+  {
+    key->requests = g_requests_per_min;
+  }
+  key->tokens += minutes * g_tokens_per_min;
+  if (key->tokens > g_tokens_per_min)
+  {
+    key->tokens = g_tokens_per_min;
+  }
+}
+
+/**
+ * @brief Milliseconds until a bucket holds the amount needed
+ * @param available Current content of the bucket
+ * @param needed Amount the call takes
+ * @param per_min Refill rate (0 = unlimited)
+ */
+static long
+wait_for(double available, double needed, long per_min)
+{
+  if (per_min == 0 || available >= needed)
+  {
+    return (0);
+  }
+  return ((long)((needed - available) * 60000.0 / per_min) + 1);
+}
+
+/**
+ * @brief Fraction of a key's quota still available (1 = untouched or unlimited)
+ */
+static double
+headroom(const api_key_t *key)
+{
+  double requests = g_requests_per_min ? key->requests / g_requests_per_min : 1.0;
+  double tokens = g_tokens_per_min ? key->tokens / g_tokens_per_min : 1.0;
+  return (requests < tokens ? requests : tokens);
+}
+
+/**
+ * @brief Load the API keys
+ * @param keys Comma separated list of keys
+ * @param requests_per_min Requests allowed per key and minute (0 = unlimited)
+ * @param tokens_per_min Tokens allowed per key and minute (0 = unlimited)
+ * @return Number of keys loaded, -1 if none is valid
+ */
+int api_keys_init(const char *keys, long requests_per_min, long tokens_per_min)
+{
+  char list[API_KEY_MAX_COUNT * API_KEY_MAX_LENGTH];
+  char *saveptr = NULL;
+  long now = now_ms();
+
+  safe_strncpy(list, keys, sizeof(list));
+  g_requests_per_min = requests_per_min;
+  g_tokens_per_min = tokens_per_min;
+  g_key_count = 0;
+
+  for (char *token = strtok_r(list, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr))
+  {
+    char *value = trim_whitespace(token);
+    if (value[0] == '\0' || strlen(value) >= API_KEY_MAX_LENGTH)
+    {
+      continue;
+    }
+    if (g_key_count == API_KEY_MAX_COUNT)
+    {
+#if SHOW_WARNING
+      printf("[WARNING] Only the first %d API keys are used\n", API_KEY_MAX_COUNT);
+#endif
+      break;
+    }
+
+    api_key_t *key = &g_keys[g_key_count++];
+    memset(key, 0, sizeof(api_key_t));
+    safe_strncpy(key->value, value, sizeof(key->value));
+    key->requests = requests_per_min;
+    key->tokens = tokens_per_min;
+    key->refilled_ms = now;
+  }
+  return (g_key_count > 0 ? g_key_count : -1);
+}
+
+/**
+ * @brief Reserve quota for one call on the key with the most headroom
+ * @param tokens Estimated tokens of the call (request and answer)
+ * @param max_delay_ms Longest acceptable wait (never more than API_KEY_MAX_QUEUE_MS)
+ * @param delay_ms Set to how long the call must wait before it is sent
+ * @return The key to use, or -1 if every key is exhausted for longer
+ *         than max_delay_ms (nothing is reserved)
+ */
+int api_keys_reserve(long tokens, long max_delay_ms, long *delay_ms)
+{
+  long now = now_ms();
+  int best = -1;
+  long best_wait = 0;
+  double best_headroom = 0.0;
+
+  pthread_mutex_lock(&g_key_lock);
+  for (int i = 0; i < g_key_count; ++i)
+  {
+    api_key_t *key = &g_keys[i];
+    refill(key, now);
+
+    // A call larger than a whole minute of tokens waits for a full bucket
+    double needed = (g_tokens_per_min && tokens > g_tokens_per_min) ? g_tokens_per_min : tokens;
+    long wait = wait_for(key->requests, 1.0, g_requests_per_min);
+    long token_wait = wait_for(key->tokens, needed, g_tokens_per_min);
+    if (token_wait > wait)
+    {
+      wait = token_wait;
+    }
+
+    double room = headroom(key);
+    if (best < 0 || wait < best_wait || (wait == best_wait && room > best_headroom))
+    {
+      best = i;
+      best_wait = wait;
+      best_headroom = room;
+    }
+  }
+
+  if (best < 0 || best_wait > API_KEY_MAX_QUEUE_MS || best_wait > max_delay_ms)
+  {
+    pthread_mutex_unlock(&g_key_lock);
+    atomic_fetch_add(&g_refused, 1);
+    return (-1);
+  }
+
+  api_key_t *key = &g_keys[best];
+  if (g_requests_per_min)
+  {
+    key->requests -= 1.0;
+  }
+  if (g_tokens_per_min)
+  {
+    key->tokens -= tokens;
+  }
+  key->used++;
+  pthread_mutex_unlock(&g_key_lock);
+
+  if (best_wait > 0)
+  {
+    atomic_fetch_add(&g_queued, 1);
+  }
+  *delay_ms = best_wait;
+  return (best);
+}
+
+/**
+ * @brief Give back the quota of a call that was not sent after all
+ * @param key Key returned by api_keys_reserve()
+ * @param tokens Tokens reserved with it
+ */
+void api_keys_release(int key, long tokens)
+{
+  pthread_mutex_lock(&g_key_lock);
+  api_key_t *api_key = &g_keys[key];
+  if (g_requests_per_min)
+  {
+    api_key->requests += 1.0;
+  }
+  if (g_tokens_per_min)
+  {
+    api_key->tokens += tokens;
+  }
+  refill(api_key, now_ms()); // Caps the buckets at a full minute
+  api_key->used--;
+  pthread_mutex_unlock(&g_key_lock);
+}
+
+/**
+ * @brief Get the value of a key returned by api_keys_reserve()
+ */
+const char *api_keys_get(int key)
+{
+  return (g_keys[key].value);
+}
+
+/**
+ * @brief Note that the provider answered 429 for a key
+ * The provider's view wins: the key's buckets are emptied so the next
+ * calls prefer other keys, or wait, instead of failing too
+ */
+void api_keys_report_limited(int key)
+{
+  pthread_mutex_lock(&g_key_lock);
+  api_key_t *api_key = &g_keys[key];
+  refill(api_key, now_ms());
+  if (api_key->requests > 0)
+  {
+    api_key->requests = 0;
+  }
+  if (api_key->tokens > 0)
+  {
+    api_key->tokens = 0;
+  }
+  api_key->limited++;
+  pthread_mutex_unlock(&g_key_lock);
+}
+
+/**
+ * @brief Print per-key usage and quota statistics
+ */
+void api_keys_print_stats(void)
+{
+  long now = now_ms();
+
+  printf("\n=== API KEY STATISTICS ===\n");
+  if (g_requests_per_min || g_tokens_per_min)
+  {
+    printf("Quota per key: %ld requests/min, %ld tokens/min (0 = unlimited)\n",
+           g_requests_per_min, g_tokens_per_min);
+  }
+  pthread_mutex_lock(&g_key_lock);
+  for (int i = 0; i < g_key_count; ++i)
+  {
+    api_key_t *key = &g_keys[i];
+    size_t length = strlen(key->value);
+    refill(key, now);
+    printf("Key ...%s: %ld calls, %ld rate limited, %.0f%% headroom\n",
+           key->value + (length > 4 ? length - 4 : 0), key->used, key->limited,
+           100.0 * (headroom(key) > 0 ? headroom(key) : 0));
+  }
+  pthread_mutex_unlock(&g_key_lock);
+  printf("Calls queued for quota: %ld, refused: %ld\n", atomic_load(&g_queued), atomic_load(&g_refused));
+  printf("==========================\n\n");
+}
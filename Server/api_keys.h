@@ -0,0 +1,13 @@
+#ifndef API_KEYS_H
+#define API_KEYS_H
+
+#include "server.h"
+
+int api_keys_init(const char * keys, long requests_per_min, long tokens_per_min);
+int api_keys_reserve(long tokens, long max_delay_ms, long * delay_ms);
+void api_keys_release(int key, long tokens);
+const char * api_keys_get(int key);
+void api_keys_report_limited(int key);
+void api_keys_print_stats(void);
+
+#endif /* API_KEYS_H */
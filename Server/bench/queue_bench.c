@@ -0,0 +1,263 @@
+/*********************************************************************************
+ * ===== FILE: bench/queue_bench.c =====
+ * Microbenchmark of the thread pool task queue
+ * Half of the threads push tasks, the other half pop them, blocking when
+ * the queue is empty as pool workers do. The lock-free ring of
+ * task_queue.c is measured against the previous design of the pool: an
+ * intrusive linked list behind one mutex and condition variable, which is
+ * unbounded: producers of the ring retry when it is full, so a ring smaller
+ * than the backlog the producers build up also measures that backpressure
+ * Build and run: make bench && ./bench/queue_bench [tasks_per_producer [ring_capacity]]
+ *********************************************************************************/
+
+#include "../task_queue.h"
+
+#define BENCH_DEFAULT_TASKS 500000 // Tasks pushed by each producer
+
+static const int BENCH_THREADS[] = {4, 8, 16, 32};
+
+/**
+ * @brief A task of the mutex queue (the old task_t)
+ */
+typedef struct bench_task
+{
+  struct bench_task *next;
+  long value;
+} bench_task_t;
+
+/**
+ * @brief Mutex + condition variable + linked list queue
+ */
+typedef struct
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bench_task_t *head;
+  bench_task_t *tail;
+} mutex_queue_t;
+
+typedef struct
+{
+  int lock_free;          // 1: task_queue_t, 0: mutex_queue_t
+  task_queue_t ring;
+  mutex_queue_t locked;
+  bench_task_t *tasks;    // Preallocated, so malloc is not measured
+  long tasks_per_producer;
+  atomic_long full;       // Pushes retried because the ring was full
+  atomic_long consumed;
+  atomic_long checksum;
+} bench_t;
+
+typedef struct
+{
+  bench_t *bench;
+  int index;
+} bench_thread_t;
+
+static bench_task_t g_stop; // Sentinel: one per consumer ends the run
+
+static void
+mutex_push(mutex_queue_t *queue, bench_task_t *task)
+{
+  task->next = NULL;
+  pthread_mutex_lock(&queue->mutex);
+  if (queue->tail)
+  {
+    queue->tail->next = task;
+  }
+  else
+  {
+    queue->head = task;
+  }
+  queue->tail = task;
+  pthread_cond_signal(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+static bench_task_t *
+mutex_pop(mutex_queue_t *queue)
+{
+  pthread_mutex_lock(&queue->mutex);
+  while (!queue->head)
+  {
+    pthread_cond_wait(&queue->cond, &queue->mutex);
+  }
+  bench_task_t *task = queue->head;
+  queue->head = task->next;
+  if (!queue->head)
+  {
+    queue->tail = NULL;
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return (task);
+}
+
+static void
+bench_push(bench_t *bench, bench_task_t *task)
+{
+  if (!bench->lock_free)
+  {
+    mutex_push(&bench->locked, task);
+    return;
+  }
+  // A full ring refuses the task: retry, as a producer under backpressure would
+  while (task_queue_push(&bench->ring, task) != 0)
+  {
+    atomic_fetch_add_explicit(&bench->full, 1, memory_order_relaxed);
+    sched_yield();
+  }
+}
+
+static bench_task_t *
+bench_pop(bench_t *bench)
+{
+  if (!bench->lock_free)
+  {
+    return (mutex_pop(&bench->locked));
+  }
+  bench_task_t *task;
+  while ((task = task_queue_wait(&bench->ring, NULL, NULL, NULL)) == NULL)
+  {
+  }
+  return (task);
+}
+
+static void *
+producer(void *arg)
+{
+  bench_thread_t *thread = (bench_thread_t *)arg;
+  bench_t *bench = thread->bench;
+  bench_task_t *tasks = bench->tasks + thread->index * bench->tasks_per_producer;
+
+  for (long i = 0; i < bench->tasks_per_producer; ++i)
+  {
+    bench_push(bench, &tasks[i]);
+  }
+  return (NULL);
+}
+
+static void *
+consumer(void *arg)
+{
+  bench_t *bench = ((bench_thread_t *)arg)->bench;
+  long consumed = 0;
+  long checksum = 0;
+
+  for (;;)
+  {
+    bench_task_t *task = bench_pop(bench);
+    if (task == &g_stop)
+    {
+      break;
+    }
+    consumed++;
+    checksum += task->value;
+  }
+  atomic_fetch_add(&bench->consumed, consumed);
+  atomic_fetch_add(&bench->checksum, checksum);
+  return (NULL);
+}
+
+/**
+ * @brief Run one configuration
+ * @return Millions of tasks moved per second, or -1 if tasks were lost
+ */
+static double
+run(bench_t *bench, int threads)
+{
+  int producers = threads / 2;
+  int consumers = threads - producers;
+  long total = producers * bench->tasks_per_producer;
+  pthread_t ids[64];
+  bench_thread_t args[64];
+  struct timespec start, end;
+
+  atomic_store(&bench->full, 0);
+  atomic_store(&bench->consumed, 0);
+  atomic_store(&bench->checksum, 0);
+  for (long i = 0; i < total; ++i)
+  {
+    bench->tasks[i].value = i;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < threads; ++i)
+  {
+    args[i].bench = bench;
+    args[i].index = i < producers ? i : i - producers;
+    pthread_create(&ids[i], NULL, i < producers ? producer : consumer, &args[i]);
+  }
+  for (int i = 0; i < producers; ++i)
+  {
+    pthread_join(ids[i], NULL);
+  }
+  for (int i = 0; i < consumers; ++i)
+  {
+    bench_push(bench, &g_stop);
+  }
+  for (int i = producers; i < threads; ++i)
+  {
+    pthread_join(ids[i], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (atomic_load(&bench->consumed) != total ||
+      atomic_load(&bench->checksum) != total * (total - 1) / 2)
+  {
+    return (-1.0);
+  }
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  return (total / seconds / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+  bench_t bench;
+  int largest = BENCH_THREADS[sizeof(BENCH_THREADS) / sizeof(BENCH_THREADS[0]) - 1];
+  long capacity = argc > 2 ? atol(argv[2]) : THREAD_POOL_QUEUE_CAPACITY;
+
+  memset(&bench, 0, sizeof(bench));
+  bench.tasks_per_producer = argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_TASKS;
+  if (bench.tasks_per_producer <= 0 || capacity <= 0)
+  {
+    fprintf(stderr, "Usage: %s [tasks_per_producer [ring_capacity]]\n", argv[0]);
+    return (EXIT_FAILURE);
+  }
+  if (task_queue_init(&bench.ring, (size_t)capacity) != 0)
+  {
+    fprintf(stderr, "Ring capacity must be a power of 2\n");
+    return (EXIT_FAILURE);
+  }
+  bench.tasks = malloc(sizeof(bench_task_t) * bench.tasks_per_producer * (largest / 2));
+  if (!bench.tasks)
+  {
+    fprintf(stderr, "Out of memory\n");
+    return (EXIT_FAILURE);
+  }
+  pthread_mutex_init(&bench.locked.mutex, NULL);
+  pthread_cond_init(&bench.locked.cond, NULL);
+
+  printf("%ld tasks per producer, ring of %ld slots, producers = consumers = threads / 2\n",
+         bench.tasks_per_producer, capacity);
+  printf("%8s %14s %14s %8s %12s\n", "threads", "mutex Mops/s", "ring Mops/s", "speedup", "ring full");
+  for (size_t i = 0; i < sizeof(BENCH_THREADS) / sizeof(BENCH_THREADS[0]); ++i)
+  {
+    bench.lock_free = 0;
+    double locked = run(&bench, BENCH_THREADS[i]);
+    bench.lock_free = 1;
+    double ring = run(&bench, BENCH_THREADS[i]);
+    if (locked < 0 || ring < 0)
+    {
+      fprintf(stderr, "Tasks lost with %d threads\n", BENCH_THREADS[i]);
+      return (EXIT_FAILURE);
+    }
+    printf("%8d %14.2f %14.2f %7.2fx %12ld\n", BENCH_THREADS[i], locked, ring, ring / locked,
+           atomic_load(&bench.full));
+  }
+
+  task_queue_destroy(&bench.ring);
+  pthread_mutex_destroy(&bench.locked.mutex);
+  pthread_cond_destroy(&bench.locked.cond);
+  free(bench.tasks);
+  return (EXIT_SUCCESS);
+}
@@ -0,0 +1,245 @@
+/*********************************************************************************
+ * ===== FILE: circuit_breaker.h/circuit_breaker.c =====
+ * Circuit breaker on the Gemini path
+ * Closed: calls go out and their outcome and latency are counted over a
+ * rolling window of CIRCUIT_WINDOW_SEC one-second buckets. Too many failed
+ * or slow calls open the breaker: calls are refused at once (the client
+ * gets a localized fallback) for CIRCUIT_OPEN_SEC. Then it is half-open:
+ * a few trial calls go out; if they all succeed the breaker closes, one
+ * failure opens it again
+ *********************************************************************************/
+
+#include "circuit_breaker.h"
+
+typedef enum
+{
+  CIRCUIT_CLOSED,
+  CIRCUIT_OPEN,
+  CIRCUIT_HALF_OPEN
+} circuit_state_t;
+
+/**
+ * @brief Outcomes of the calls completed in one second
+ */
+typedef struct
+{
+  long second; // Monotonic second the counters belong to
+  int calls;
+  int failures;
+  int slow;
+} circuit_bucket_t;
+
+static pthread_mutex_t g_circuit_lock = PTHREAD_MUTEX_INITIALIZER;
+static circuit_state_t g_state = CIRCUIT_CLOSED;
+static long g_state_since_ms = 0;  // When the current state was entered
+static circuit_bucket_t g_buckets[CIRCUIT_WINDOW_SEC];
+static int g_probes_started = 0;   // Trial calls let through while half-open
+static int g_probes_succeeded = 0;
+
+// Statistics
+static atomic_long g_rejected;
+static atomic_long g_opened;
+
+/**
+ * @brief Current monotonic time in milliseconds
+ */
+static long
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000L + ts.tv_nsec / 1000000L);
+}
+
+/**
+ * @brief Human readable name of a state
+ */
+static const char *
+state_name(circuit_state_t state)
+{
+  switch (state)
+  {
+  case CIRCUIT_OPEN:
+    return ("open");
+  case CIRCUIT_HALF_OPEN:
+    return ("half-open");
+  default:
+    return ("closed");
+  }
+}
+
+/**
+ * @brief Enter a state (caller holds the lock)
+ */
+static void
+set_state(circuit_state_t state, long now)
+{
+#if SHOW_WARNING
+  if (state != g_state)
+  {
+    printf("[WARNING] AI circuit breaker %s -> %s\n", state_name(g_state), state_name(state));
+  }
+#endif
+  if (state == CIRCUIT_OPEN && g_state != CIRCUIT_OPEN)
+  {
+    atomic_fetch_add(&g_opened, 1);
+  }
+  if (state == CIRCUIT_CLOSED)
+  {
+    // Outcomes from before the outage must not reopen it
+    memset(g_buckets, 0, sizeof(g_buckets));
+  }
+  g_state = state;
+  g_state_since_ms = now;
+  g_probes_started = 0;
+  g_probes_succeeded = 0;
+}
+
+/**
+ * @brief Sum the buckets of the last CIRCUIT_WINDOW_SEC seconds (caller holds the lock)
+ */
+static void
+window_totals(long second, int *calls, int *failures, int *slow)
+{
+  *calls = 0;
+  *failures = 0;
+  *slow = 0;
+  for (int i = 0; i < CIRCUIT_WINDOW_SEC; ++i)
+  {
+    if (second - g_buckets[i].second < CIRCUIT_WINDOW_SEC)
+    {
+      *calls += g_buckets[i].calls;
+      *failures += g_buckets[i].failures;
+      *slow += g_buckets[i].slow;
+    }
+  }
+}
+
+/**
+ * @brief Ask whether an AI call may be made now
+ * While half-open only CIRCUIT_HALF_OPEN_PROBES calls are let through;
+ * if their outcome never arrives they are given up after CIRCUIT_OPEN_SEC
+ * @return 1 if the call may go out (its outcome must be recorded, or the
+ *         permission given back with circuit_breaker_cancel()),
+ *         0 if it must be answered with a fallback
+ */
+int circuit_breaker_allow(void)
+{
+  long now = now_ms();
+  int allowed = 1;
+
+  pthread_mutex_lock(&g_circuit_lock);
+  if (g_state != CIRCUIT_CLOSED && now - g_state_since_ms >= CIRCUIT_OPEN_SEC * 1000L)
+  {
+    set_state(CIRCUIT_HALF_OPEN, now);
+  }
+  if (g_state == CIRCUIT_OPEN)
+  {
+    allowed = 0;
+  }
+  else if (g_state == CIRCUIT_HALF_OPEN)
+  {
+    if (g_probes_started < CIRCUIT_HALF_OPEN_PROBES)
+    {
+      g_probes_started++;
+    }
+    else
+    {
+      allowed = 0;
+    }
+  }
+  pthread_mutex_unlock(&g_circuit_lock);
+
+  if (!allowed)
+  {
+    atomic_fetch_add(&g_rejected, 1);
+  }
+  return (allowed);
+}
+
+/**
+ * @brief Record the outcome of an AI call that was allowed
+ * @param failed 1 if the call failed (error or non-200 status)
+ * @param latency_ms Duration of the call
+ */
+void circuit_breaker_record(int failed, long latency_ms)
+{
+  long now = now_ms();
+  long second = now / 1000;
+  int slow = latency_ms >= CIRCUIT_SLOW_CALL_MS;
+
+  pthread_mutex_lock(&g_circuit_lock);
+  if (g_state == CIRCUIT_HALF_OPEN)
+  {
+    if (failed || slow)
+    {
+      set_state(CIRCUIT_OPEN, now);
+    }
+    else if (++g_probes_succeeded >= CIRCUIT_HALF_OPEN_PROBES)
+    {
+      set_state(CIRCUIT_CLOSED, now);
+    }
+  }
+  else if (g_state == CIRCUIT_CLOSED)
+  {
+    circuit_bucket_t *bucket = &g_buckets[second % CIRCUIT_WINDOW_SEC];
+    if (bucket->second != second)
+    {
+      memset(bucket, 0, sizeof(circuit_bucket_t));
+      bucket->second = second;
+    }
+    bucket->calls++;
+    bucket->failures += failed;
+    bucket->slow += slow;
+
+    int calls;
+    int failures;
+    int slow_calls;
+    window_totals(second, &calls, &failures, &slow_calls);
+    if (calls >= CIRCUIT_MIN_CALLS &&
+        (failures * 100 >= calls * CIRCUIT_FAILURE_PERCENT || slow_calls * 100 >= calls * CIRCUIT_SLOW_PERCENT))
+    {
+      set_state(CIRCUIT_OPEN, now);
+    }
+  }
+  // Open: late outcomes of calls started before it opened are ignored
+  pthread_mutex_unlock(&g_circuit_lock);
+}
+
+/**
+ * @brief Give back the permission of an allowed call that ended without an
+ * outcome (not sent, or aborted on our side)
+ * While half-open this frees its trial call slot for another call. A call
+ * allowed before the state last changed may free a slot of the current
+ * trial period instead, which only lets one more trial call through
+ */
+void circuit_breaker_cancel(void)
+{
+  pthread_mutex_lock(&g_circuit_lock);
+  if (g_state == CIRCUIT_HALF_OPEN && g_probes_started > g_probes_succeeded)
+  {
+    g_probes_started--;
+  }
+  pthread_mutex_unlock(&g_circuit_lock);
+}
+
+/**
+ * @brief Print circuit breaker statistics
+ */
+void circuit_breaker_print_stats(void)
+{
+  int calls;
+  int failures;
+  int slow;
+
+  pthread_mutex_lock(&g_circuit_lock);
+  circuit_state_t state = g_state;
+  window_totals(now_ms() / 1000, &calls, &failures, &slow);
+  pthread_mutex_unlock(&g_circuit_lock);
+
+  printf("\n=== CIRCUIT BREAKER STATISTICS ===\n");
+  printf("State: %s (opened %ld times)\n", state_name(state), atomic_load(&g_opened));
+  printf("Last %ds: %d calls, %d failed, %d slow\n", CIRCUIT_WINDOW_SEC, calls, failures, slow);
+  printf("Calls answered with a fallback: %ld\n", atomic_load(&g_rejected));
+  printf("==================================\n\n");
+}
@@ -0,0 +1,11 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include "server.h"
+
+int circuit_breaker_allow(void);
+void circuit_breaker_record(int failed, long latency_ms);
+void circuit_breaker_cancel(void);
+void circuit_breaker_print_stats(void);
+
+#endif /* CIRCUIT_BREAKER_H */
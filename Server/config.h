@@ -14,21 +14,80 @@
 #define DEFAULT_PORT 8080            // Default server port
 #define BACKLOG 128                  // Listen queue size
 #define CLIENT_SOCKET_TIMEOUT_SEC 30 // Max timeout
+#define CLIENT_KEEP_ALIVE 0          // 1 = keep client connections open across requests
+#define CLIENT_IDLE_TIMEOUT_SEC 60   // Idle keep-alive connections are evicted after this
+#define IDLE_SWEEP_INTERVAL_SEC 1    // Seconds between idle connection sweeps
+#define REACTOR_COUNT 1              // Event loop threads (SO_REUSEPORT listener each)
+#define MAX_REACTORS 16              // Upper bound for -r
+
+// ========== IO_URING BACKEND (make IO_BACKEND=uring) ==========
+#define URING_QUEUE_DEPTH 256  // Submission queue entries per reactor
+#define URING_BUFFER_COUNT 256 // Provided receive buffers per reactor (power of 2)
+#define URING_BUFFER_SIZE 4096 // Size of each provided receive buffer
 
 // ========== AI CONFIGURATION ==========
 #define MAX_AI_RESPONSE_SIZE 2048 // Maximum AI response length
 #define AI_TIMEOUT_SECONDS 15     // Timeout for AI requests
-#define GEMINI_API_URL "https://generativelanguage.googleapis.com/v1beta/models/gemini-1.5-flash:generateContent"
+#define GEMINI_API_BASE_URL "https://generativelanguage.googleapis.com/v1beta/models/gemini-1.5-flash" // $GEMINI_API_BASE_URL overrides
+#define GEMINI_GENERATE_METHOD ":generateContent"             // Complete response
+#define GEMINI_STREAM_METHOD ":streamGenerateContent?alt=sse" // Server-sent events
+#define API_KEY_MAX_COUNT 16              // Keys in $GEMINI_API_KEY (comma separated)
+#define API_KEY_MAX_LENGTH 128            // Longest accepted key
+#define API_KEY_REQUESTS_PER_MIN 0        // Per-key request quota (0 = unlimited), -q overrides
+#define API_KEY_TOKENS_PER_MIN 0          // Per-key token quota (0 = unlimited), -q overrides
+#define API_KEY_OUTPUT_TOKENS 800         // Tokens reserved for an answer (maxOutputTokens)
+#define API_KEY_MAX_QUEUE_MS 5000         // Longest wait for quota before a call is refused
+#define AI_STREAM_BUFFER_MAX 65536        // Unsent stream text per request before its transfer is paused
+#define UPSTREAM_ENGINE_COUNT 1 // Threads driving async AI calls (curl multi)
+#define UPSTREAM_MAX_ENGINES 8  // Upper bound for -u
+#define UPSTREAM_HANDLE_POOL_SIZE 64      // Idle CURL easy handles kept for reuse
+#define UPSTREAM_MAX_IDLE_CONNECTIONS 16  // Warm connections cached per engine
+#define UPSTREAM_DNS_CACHE_TIMEOUT_SEC 300 // Lifetime of shared DNS entries
+#define UPSTREAM_HTTP2_STREAMS 0          // Streams per HTTP/2 connection (0 = HTTP/1.1)
+#define UPSTREAM_MAX_HTTP2_STREAMS 1000   // Upper bound for -m
+#define UPSTREAM_PAUSE_POLL_MS 10         // How often paused transfers check whether they may resume
+#define UPSTREAM_MAX_RETRIES 2            // Retries after a retryable failure (429, 5xx, timeouts)
+#define UPSTREAM_RETRY_BASE_MS 200        // First backoff, doubled per retry (full jitter)
+#define UPSTREAM_RETRY_MAX_DELAY_MS 4000  // Longest backoff; longer Retry-After values are not waited for
+#define UPSTREAM_RETRY_DEADLINE_MS 20000  // No retry starts this long after the first attempt
+#define UPSTREAM_RETRY_BUDGET_RATIO 0.2   // Retry tokens earned per first attempt
+#define UPSTREAM_RETRY_BUDGET_MAX 20      // Retry tokens that can be saved up
+#define UPSTREAM_HEDGE_PERCENTILE 0       // Hedge calls slower than this latency percentile (0 = off)
+#define UPSTREAM_HEDGE_MIN_DELAY_MS 20    // Never hedge sooner than this
+#define UPSTREAM_HEDGE_WINDOW 512         // Recent latencies the hedge delay is derived from
+#define UPSTREAM_HEDGE_MIN_SAMPLES 32     // No hedging until this many latencies are known
+#define UPSTREAM_HEDGE_BUDGET_RATIO 0.05  // Hedge tokens earned per call (caps the hedge rate)
+#define UPSTREAM_HEDGE_BUDGET_MAX 10      // Hedge tokens that can be saved up
+#define RESPONSE_CACHE_SHARDS 16          // Independently locked parts of the cache
+#define RESPONSE_CACHE_CAPACITY 4096      // Cached responses (all shards)
+#define RESPONSE_CACHE_TTL_SEC 300        // Lifetime of a cached response
+#define SINGLE_FLIGHT_BUCKETS 256         // Hash buckets of the in-flight table
+#define PROMPT_TEMPLATE_SLOTS 256         // Compiled request prefixes kept
+#define PROMPT_PERSONALITY_STEP 0.5       // Trait values rounded to this step (multiple of 0.1, 0 = exact)
+#define PROMPT_MAX_PERSONALITY 1024       // Longer personality profiles are truncated
+#define CONVERSATION_MAX_TOKENS 2000      // Token estimate of the history sent upstream (0 = unlimited), -c overrides
+#define CONVERSATION_MAX_TURNS 64         // Newest turns considered under a token budget (-c 0 sends all)
+#define JSON_STREAM_MAX_DEPTH 32          // Deeper AI answers are rejected as malformed
+#define JSON_STREAM_MAX_KEY 64            // Longer member names never match a path
+#define JSON_STREAM_MAX_TARGETS 4         // Strings extracted from one answer
+#define CIRCUIT_WINDOW_SEC 10             // Rolling window of AI call outcomes
+#define CIRCUIT_MIN_CALLS 20              // Calls in the window before the breaker may open
+#define CIRCUIT_FAILURE_PERCENT 50        // Failed calls that open the breaker
+#define CIRCUIT_SLOW_CALL_MS 8000         // Calls slower than this count as slow
+#define CIRCUIT_SLOW_PERCENT 80           // Slow calls that open the breaker
+#define CIRCUIT_OPEN_SEC 15               // Time open before trial calls are let through
+#define CIRCUIT_HALF_OPEN_PROBES 3        // Successful trial calls that close the breaker
 
 // ========== THREAD POOL CONFIGURATION ==========
 #define THREAD_POOL_MIN_SIZE 4               // Minimum threads
 #define THREAD_POOL_MAX_SIZE 32              // Maximum threads
 #define THREAD_POOL_INITIAL_SIZE 8           // Starting threads
-#define THREAD_POOL_SCALE_INTERVAL 2         // Seconds between scaling checks
-#define THREAD_POOL_SCALE_UP_THRESHOLD 0.6   // Load ratio to scale up
-#define THREAD_POOL_SCALE_DOWN_THRESHOLD 0.3 // Load ratio to scale down
-#define THREAD_POOL_QUEUE_HIGH_WATER 10      // Queue size to trigger scale up
-#define THREAD_POOL_QUEUE_LOW_WATER 2        // Queue size to trigger scale down
+#define THREAD_POOL_CONTROL_INTERVAL_MS 100  // Period of the autoscaling controller
+#define THREAD_POOL_POLICY "balanced"        // Default autoscaling policy: latency, balanced or throughput
+#define THREAD_POOL_QUEUE_CAPACITY 4096      // Tasks that can wait (power of 2); more are refused
+#define THREAD_POOL_QUEUE_SPINS 4            // Yields an idle worker tries before parking
+#define THREAD_POOL_SCHEDULER "fifo"         // Default task scheduler: fifo or steal
+#define THREAD_POOL_WORKER_QUEUE_SIZE 256    // Deque and inbox slots of each worker (power of 2)
 
 // ========== MESSAGE PROTOCOL ==========
 #define MSG_AI_DIALOG_REQUEST 1
@@ -36,12 +95,28 @@
 #define MSG_AI_DIALOG_RESPONSE 3
 #define MSG_TEST_DIALOG_RESPONSE 4
 #define MSG_ERROR 5
+#define MSG_AI_STREAM_REQUEST 6 // Same payload as MSG_AI_DIALOG_REQUEST
+#define MSG_AI_STREAM_CHUNK 7   // Partial response text, in order
+#define MSG_AI_STREAM_END 8     // Response complete (empty payload)
 
 // ========== MESSAGE PROTOCOL CONFIGURATION ==========
-#define MAX_MESSAGE_SIZE 3000 // Maximum message content size
-#define MAX_PERSONALITY_SIZE 512
-#define MAX_LANGUAGE_SIZE 16
-#define MAX_CONVERSATION_SIZE 2048
+#define MAX_LANGUAGE_SIZE 16 // Longer language codes are truncated
+
+// ========== BINARY PROTOCOL V2 ==========
+// Header (network byte order): magic u8, version u8, type u16, flags u16,
+// reserved u16, request_id u32, payload length u32. Request payloads are
+// typed fields: tag u16, length u32, value bytes
+#define PROTOCOL_V1 1                              // TYPE|payload\n text frames
+#define PROTOCOL_V2 2                              // Length-prefixed binary frames
+#define PROTOCOL_V2_MAGIC 0xB2                     // First byte of every v2 frame
+#define PROTOCOL_V2_HEADER_SIZE 16                 // Fixed header size
+#define PROTOCOL_V2_FIELD_HEADER_SIZE 6            // Field tag + length
+#define PROTOCOL_V2_MAX_PAYLOAD (16 * 1024 * 1024) // Guard against bogus lengths
+#define PROTOCOL_V2_MAX_IN_FLIGHT 16               // Concurrent requests per v2 keep-alive connection
+#define PROTOCOL_V2_FLAG_NO_CACHE 0x0001           // Request flag: skip the response cache
+#define FIELD_PERSONALITY 1
+#define FIELD_LANGUAGE 2
+#define FIELD_CONVERSATION 3
 
 // ========== COMPILATION FLAGS ==========
 #define SHOW_DEBUG 0
@@ -0,0 +1,179 @@
+/*********************************************************************************
+ * ===== FILE: conversation.h/conversation.c =====
+ * Token budget of the conversation history
+ * The client sends its recent dialog as comma separated turn objects
+ * ({"role": ..., "parts": [...]},{...}). The premise is added later by the
+ * prompt template; the turns are trimmed here so that the newest ones
+ * that fit in the budget are sent, oldest first dropped. Keeping a suffix
+ * of turns means the trimmed conversation is a view into the request, and
+ * it is checked to be valid JSON before it is spliced into a request
+ *********************************************************************************/
+
+#include "conversation.h"
+#include "json_stream.h"
+
+// Statistics
+static atomic_long g_trimmed;       // Conversations that lost turns
+static atomic_long g_turns_dropped; // Turns not sent upstream
+static atomic_long g_bytes_dropped; // Bytes not sent upstream
+static atomic_long g_invalid;       // Conversations refused as malformed
+
+/**
+ * @brief Find the end of the turn object starting at text
+ * Strings are skipped so that brackets inside them do not count
+ * @return Pointer just past the closing '}', or NULL if it is not closed
+ */
+static const char *
+turn_end(const char *text)
+{
+  int depth = 0;
+
+  for (const char *p = text; *p; ++p)
+  {
+    if (*p == '"')
+    {
+      // Skip the string, escapes included
+      for (++p; *p && *p != '"'; ++p)
+      {
+        if (*p == '\\' && p[1])
+        {
+          ++p;
+        }
+      }
+      if (!*p)
+      {
+        return (NULL);
+      }
+    }
+    else if (*p == '{' || *p == '[')
+    {
+      ++depth;
+    }
+    else if ((*p == '}' || *p == ']') && --depth == 0)
+    {
+      return (p + 1);
+    }
+  }
+  return (NULL);
+}
+
+/**
+ * @brief Skip JSON whitespace
+ */
+static const char *
+skip_space(const char *p)
+{
+  while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+  {
+    ++p;
+  }
+  return (p);
+}
+
+/**
+ * @brief Keep the newest turns of a conversation that fit in a token budget
+ * Tokens are estimated at about 4 bytes each. The newest turn is always
+ * kept, even alone over the budget: it is the message being answered
+ * @param conversation Comma separated turn objects
+ * @param max_tokens Budget for the turns (0 = unlimited: every turn is
+ *        kept, only checked; otherwise at most CONVERSATION_MAX_TURNS)
+ * @param trimmed Set to the first kept turn (a suffix of conversation)
+ * @return Number of turns dropped, -1 if the conversation is not a
+ *         sequence of valid JSON objects
+ */
+int conversation_trim(const char *conversation, long max_tokens, const char **trimmed)
+{
+  // Start and end of the newest turns, in a ring
+  const char *starts[CONVERSATION_MAX_TURNS];
+  const char *ends[CONVERSATION_MAX_TURNS];
+  int turns = 0;
+
+  const char *p = skip_space(conversation);
+  while (*p)
+  {
+    const char *end = (*p == '{') ? turn_end(p) : NULL;
+    if (!end)
+    {
+      atomic_fetch_add(&g_invalid, 1);
+      return (-1);
+    }
+    starts[turns % CONVERSATION_MAX_TURNS] = p;
+    ends[turns % CONVERSATION_MAX_TURNS] = end;
+    ++turns;
+
+    p = skip_space(end);
+    if (*p == ',')
+    {
+      p = skip_space(p + 1);
+      if (!*p)
+      {
+        atomic_fetch_add(&g_invalid, 1);
+        return (-1); // Trailing comma
+      }
+    }
+    else if (*p)
+    {
+      atomic_fetch_add(&g_invalid, 1);
+      return (-1);
+    }
+  }
+  if (turns == 0)
+  {
+    atomic_fetch_add(&g_invalid, 1);
+    return (-1);
+  }
+
+  // Walk back from the newest turn while the budget allows
+  int newest = turns - 1;
+  int first = newest;
+  long tokens = 0;
+  for (int turn = newest; max_tokens > 0 && turn >= 0 && turn > newest - CONVERSATION_MAX_TURNS; --turn)
+  {
+    int slot = turn % CONVERSATION_MAX_TURNS;
+    long turn_tokens = (long)(ends[slot] - starts[slot] + 3) / 4;
+    if (turn != newest && tokens + turn_tokens > max_tokens)
+    {
+      break;
+    }
+    tokens += turn_tokens;
+    first = turn;
+  }
+  if (max_tokens <= 0)
+  {
+    first = 0; // Unlimited: every turn is sent, however many there are
+  }
+  const char *kept = (first == 0) ? skip_space(conversation) : starts[first % CONVERSATION_MAX_TURNS];
+
+  // Only the kept turns are sent: they must parse as a JSON array body
+  json_stream_t json;
+  json_stream_init(&json);
+  json_stream_feed(&json, "[", 1);
+  json_stream_feed(&json, kept, strlen(kept));
+  json_stream_feed(&json, "]", 1);
+  if (json_stream_finish(&json) < 0)
+  {
+    atomic_fetch_add(&g_invalid, 1);
+    return (-1);
+  }
+
+  if (first > 0)
+  {
+    atomic_fetch_add(&g_trimmed, 1);
+    atomic_fetch_add(&g_turns_dropped, first);
+    atomic_fetch_add(&g_bytes_dropped, (long)(kept - conversation));
+  }
+  *trimmed = kept;
+  return (first);
+}
+
+/**
+ * @brief Print conversation trimming statistics
+ */
+void conversation_print_stats(void)
+{
+  printf("\n=== CONVERSATION STATISTICS ===\n");
+  printf("Conversations trimmed: %ld (%ld turns, %ld bytes not sent)\n", atomic_load(&g_trimmed),
+         atomic_load(&g_turns_dropped), atomic_load(&g_bytes_dropped));
+  printf("Malformed conversations refused: %ld\n", atomic_load(&g_invalid));
+  printf("===============================\n\n");
+}
@@ -0,0 +1,9 @@
+#ifndef CONVERSATION_H
+#define CONVERSATION_H
+
+#include "server.h"
+
+int conversation_trim(const char * conversation, long max_tokens, const char ** trimmed);
+void conversation_print_stats(void);
+
+#endif /* CONVERSATION_H */
@@ -1,254 +1,142 @@
 /*********************************************************************************
  * ===== FILE: gemini_ai.h/gemini_ai.c =====
  * Google Gemini AI integration for generating responses
+ * The Gemini backend of ai_client.c: request body and URL, answer parsing
  *********************************************************************************/
 
 #include "gemini_ai.h"
+#include "json_stream.h"
+#include "prompt_template.h"
 #include "utils.h"
 
 /**
- * @brief Structure for collecting HTTP response data
+ * @brief Build a Gemini endpoint URL
+ * @param url Output buffer
+ * @param url_size Size of output buffer
+ * @param api_base Model endpoint (GEMINI_API_BASE_URL or override)
+ * @param stream 1 for streamGenerateContent, 0 for generateContent
+ * @param api_key Google Gemini API key
  */
-typedef struct
+static void
+gemini_request_url(char *url, size_t url_size, const char *api_base,
+                   int stream, const char *api_key)
 {
-  char *memory; // Response data buffer
-  size_t size;  // Current size of data
-} curl_response_t;
+  const char *method = stream ? GEMINI_STREAM_METHOD : GEMINI_GENERATE_METHOD;
+  snprintf(url, url_size, "%s%s%ckey=%s", api_base, method,
+           strchr(method, '?') ? '&' : '?', api_key);
+}
 
 /**
- * @brief Callback function for cURL to write response data
- * This function is called by cURL when data is received from HTTP request
- * @param contents Pointer to received data
- * @param size Size of each data element
- * @param nmemb Number of data elements
- * @param response Pointer to our response structure
- * @return Number of bytes processed
+ * @brief Build the body and headers of a Gemini request
+ * The conversation is spliced into the precompiled prompt template
+ * @param stream 1 for a streamed answer
+ * @param personality User's personality profile
+ * @param language User's language preference
+ * @param conversation Complete conversation including history and current message
+ * @param length Set to the body length
+ * @param headers Set to the HTTP headers
+ * @return The request JSON (malloc'd), or NULL on error
  */
-static size_t
-my_curl_write_callback(
-    void *contents,
-    size_t size,
-    size_t nmemb,
-    curl_response_t *response)
+static char *
+gemini_prepare(int stream, const char *personality, const char *language,
+               const char *conversation, size_t *length, struct curl_slist **headers)
 {
-  size_t realsize = size * nmemb;
+  char *json_request = prompt_build_request(personality, language, conversation, length);
+  if (!json_request)
+  {
+    return (NULL);
+  }
 
-  // Reallocate buffer to fit new data
-  char *ptr = realloc(response->memory, response->size + realsize + 1);
-  if (!ptr)
+  *headers = curl_slist_append(NULL, "Content-Type: application/json");
+  if (stream)
   {
-#if SHOW_ERROR
-    printf("[ERROR] Not enough memory for HTTP response (realloc returned NULL)\n");
-#endif
-    return (0); // Tell cURL we couldn't handle the data
+    *headers = curl_slist_append(*headers, "Accept: text/event-stream");
   }
+  return (json_request);
+}
 
-  // Copy new data to buffer
-  response->memory = ptr;
-  memcpy(&(response->memory[response->size]), contents, realsize);
-  response->size += realsize;
-  response->memory[response->size] = 0; // Null terminate
+// candidates[0].content.parts[0].text of a generateContent answer
+static const json_step_t GEMINI_TEXT_PATH[] = {
+    {"candidates", 0}, {NULL, 0}, {"content", 0}, {"parts", 0}, {NULL, 0}, {"text", 0}};
 
-  return (realsize);
-}
+// error.message of an error answer
+static const json_step_t GEMINI_ERROR_PATH[] = {{"error", 0}, {"message", 0}};
+
+// Targets in the order gemini_parse_begin() adds them
+enum
+{
+  GEMINI_TARGET_TEXT,
+  GEMINI_TARGET_ERROR
+};
 
 /**
- * @brief Generate complete Gemini API JSON request with personality and conversation history
- * Creates the full JSON structure needed for Gemini API calls
- * @param personality User's personality profile
- * @param language_code User's preferred language
- * @param conversation Already formatted JSON string for conversation history
- * @param json_output Output buffer for complete JSON request
- * @param output_size Size of output buffer
- * @return 0 on success, -1 on error
+ * @brief State of a generateContent answer being parsed
+ * The answer text is unescaped straight into the response as the bytes
+ * arrive; no body is buffered and no JSON tree is built
  */
-static int
-generate_gemini_request_json(
-    const char *personality,
-    const char *language,
-    const char *conversation,
-    char *json_output,
-    size_t output_size)
+typedef struct
 {
-  // Create the premise with language and personality vector
-  char premise[1024];
-  snprintf(premise, sizeof(premise),
-           "You are a robot assistant (Furhat robot) designed to adapt to human personality. "
-           "Respond in %s language. Here is your personality profile: %s\\n\\n"
+  json_stream_t json;
+  ai_response_t *response;      // Receives the answer text
+  char error_message[256];      // error.message of an error answer
+} gemini_parser_t;
 
-           "Keep responses concise (1-3 sentences) and naturally conversational.",
-           language, personality);
-
-  // Escape quotes in the premise for JSON
-  char escaped_premise[4096];
-  const char *src = premise;
-  char *dst = escaped_premise;
-  while (*src && (unsigned long)(dst - escaped_premise) < sizeof(escaped_premise) - 2)
-  {
-    if (*src == '"')
-    {
-      *dst++ = '\\';
-      *dst++ = '"';
-    }
-    else if (*src == '\\')
-    {
-      *dst++ = '\\';
-      *dst++ = '\\';
-    }
-    else if (*src == '\n')
-    {
-      *dst++ = '\\';
-      *dst++ = 'n';
-    }
-    else if (*src == '\r')
-    {
-      *dst++ = '\\';
-      *dst++ = 'r';
-    }
-    else
-    {
-      *dst++ = *src;
-    }
-    src++;
-  }
-  *dst = '\0';
-
-  // Check if we had to truncate
-  if (*src != '\0')
-  {
-#if SHOW_WARNING
-    printf("[WARNING] Premise was truncated during JSON escaping\n");
-#endif
-  }
-
-  // Build the complete JSON request and keeping the length
-  int json_len = snprintf(json_output, output_size,
-                          "{"
-                          "  \"generationConfig\": {"
-                          "    \"temperature\": 0.9,"
-                          "    \"maxOutputTokens\": 800,"
-                          "    \"topP\": 1,"
-                          "    \"topK\": 1"
-                          "  },"
-                          "  \"safetySettings\": ["
-                          "    {"
-                          "      \"category\": \"HARM_CATEGORY_HARASSMENT\","
-                          "      \"threshold\": \"BLOCK_MEDIUM_AND_ABOVE\""
-                          "    },"
-                          "    {"
-                          "      \"category\": \"HARM_CATEGORY_HATE_SPEECH\","
-                          "      \"threshold\": \"BLOCK_MEDIUM_AND_ABOVE\""
-                          "    },"
-                          "    {"
-                          "      \"category\": \"HARM_CATEGORY_SEXUALLY_EXPLICIT\","
-                          "      \"threshold\": \"BLOCK_MEDIUM_AND_ABOVE\""
-                          "    },"
-                          "    {"
-                          "      \"category\": \"HARM_CATEGORY_DANGEROUS_CONTENT\","
-                          "      \"threshold\": \"BLOCK_MEDIUM_AND_ABOVE\""
-                          "    }"
-                          "  ],"
-                          "  \"contents\": ["
-                          "    {"
-                          "      \"role\": \"user\","
-                          "      \"parts\": ["
-                          "        {"
-                          "          \"text\": \"%s\""
-                          "        }"
-                          "      ]"
-                          "    },"
-                          "    %s"
-                          "  ]"
-                          "}",
-                          escaped_premise, conversation);
+/**
+ * @brief Start parsing a generateContent answer into a response
+ */
+static void
+gemini_parse_begin(void *parser, ai_response_t *response)
+{
+  gemini_parser_t *gemini = (gemini_parser_t *)parser;
 
-  // Check if JSON was truncated
-  if (json_len >= (int)output_size)
-  {
-#if SHOW_ERROR
-    printf("[ERROR] JSON output truncated (%d bytes needed, %zu available)\n",
-           json_len, output_size);
-#endif
-    return (-1);
-  }
+  json_stream_init(&gemini->json);
+  gemini->response = response;
+  response->success = 0;
+  json_stream_add_target(&gemini->json, GEMINI_TEXT_PATH,
+                         (int)(sizeof(GEMINI_TEXT_PATH) / sizeof(GEMINI_TEXT_PATH[0])),
+                         response->response, sizeof(response->response));
+  json_stream_add_target(&gemini->json, GEMINI_ERROR_PATH,
+                         (int)(sizeof(GEMINI_ERROR_PATH) / sizeof(GEMINI_ERROR_PATH[0])),
+                         gemini->error_message, sizeof(gemini->error_message));
+}
 
-#if SHOW_DEBUG
-  printf("[DEBUG] Generated JSON request size: %zu bytes\n", strlen(json_output));
-#endif
-  return (0);
+/**
+ * @brief Parse the next bytes of a generateContent answer
+ */
+static void
+gemini_parse_bytes(void *parser, const char *data, size_t size)
+{
+  json_stream_feed(&((gemini_parser_t *)parser)->json, data, size);
 }
 
 /**
- * @brief Call Google Gemini AI API to generate response
- * Makes HTTP request to Gemini and parses the response
- * @param api_key Google Gemini API key
- * @param personality User's personality profile
- * @param language User's language preference
- * @param conversation Complete conversation including history and current message
- * @param response Output structure for AI response
+ * @brief Turn a finished generateContent call into an AI response
+ * @param parser Parser the answer was fed to
+ * @param res cURL result of the transfer
+ * @param http_code HTTP status code
  * @return 0 on success, -1 on error
  */
 static int
-call_gemini_api(
-    const char *api_key,
-    const char *personality,
-    const char *language,
-    const char *conversation,
-    ai_response_t *response)
+gemini_parse_end(void *parser, CURLcode res, long http_code)
 {
-  CURL *curl;
-  CURLcode res;
-  curl_response_t api_response = {0};
-  long http_code = 0; // Add HTTP status code checking
-
-#if SHOW_DEBUG
-  printf("[DEBUG] Calling Gemini AI API\n");
-#endif
-  // Initialize cURL
-  curl = curl_easy_init();
-  if (!curl)
-  {
-#if SHOW_ERROR
-    printf("[ERROR] Failed to initialize cURL\n");
-#endif
-    return (-1);
-  }
+  gemini_parser_t *gemini = (gemini_parser_t *)parser;
+  ai_response_t *response = gemini->response;
+  int complete = json_stream_finish(&gemini->json) == 0;
+  int has_text = gemini->json.targets[GEMINI_TARGET_TEXT].found;
+  int has_error = gemini->json.targets[GEMINI_TARGET_ERROR].found;
 
-  // Generate the complete JSON request
-  char json_request[MAX_MESSAGE_SIZE * 4];
-  if (generate_gemini_request_json(personality, language, conversation,
-                                   json_request, sizeof(json_request)) < 0)
+  if (res == CURLE_OK && http_code == 200 && complete && has_text)
   {
-#if SHOW_ERROR
-    printf("[ERROR] Failed to generate Gemini request JSON\n");
+    response->success = 1;
+#if SHOW_INFO
+    printf("[INFO] Gemini response processed successfully\n");
+    printf("[INFO] Response: '%s'\n", response->response);
 #endif
-    curl_easy_cleanup(curl);
-    return (-1);
+    return (0);
   }
-#if SHOW_DEBUG
-  printf("[DEBUG] Gemini request JSON: %s\n", json_request);
-#endif
-  // Build request URL with API key
-  char url[512];
-  snprintf(url, sizeof(url), "%s?key=%s", GEMINI_API_URL, api_key);
 
-  // Set HTTP headers
-  struct curl_slist *headers = NULL;
-  headers = curl_slist_append(headers, "Content-Type: application/json");
-
-  // Configure cURL request
-  curl_easy_setopt(curl, CURLOPT_URL, url);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_request);
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, my_curl_write_callback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &api_response);
-  curl_easy_setopt(curl, CURLOPT_TIMEOUT, AI_TIMEOUT_SECONDS);
-
-  // Make the HTTP request
-  res = curl_easy_perform(curl);
-
-  // Get HTTP status code
-  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+  // Text of a failed or cut short answer is not kept
+  response->response[0] = '\0';
 
   // Check for network/cURL errors first
   if (res != CURLE_OK)
@@ -256,10 +144,6 @@ call_gemini_api(
 #if SHOW_ERROR
     printf("[ERROR] Gemini API request failed: %s\n", curl_easy_strerror(res));
 #endif
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    if (api_response.memory)
-      free(api_response.memory);
     return (-1);
   }
 
@@ -269,191 +153,123 @@ call_gemini_api(
 #if SHOW_ERROR
     printf("[ERROR] Gemini API returned HTTP %ld\n", http_code);
 #endif
-    if (api_response.memory)
+    if (has_error)
     {
-#if SHOW_DEBUG
-      printf("[DEBUG] Error response: %s\n", api_response.memory);
-#endif
-      // Try to parse error details from response
-      json_object *error_root = json_tokener_parse(api_response.memory);
-      if (error_root)
-      {
-        json_object *error_obj;
-        if (json_object_object_get_ex(error_root, "error", &error_obj))
-        {
-          json_object *message_obj;
-          if (json_object_object_get_ex(error_obj, "message", &message_obj))
-          {
-            const char *error_msg = json_object_get_string(message_obj);
 #if SHOW_ERROR
-            printf("[ERROR] API Error: %s\n", error_msg);
+      printf("[ERROR] API Error: %s\n", gemini->error_message);
 #endif
-
-            // Provide specific error message to user
-            if (http_code == 403)
-            {
-              safe_strncpy(response->response,
-                           "API quota exceeded. Please check your billing settings.",
-                           sizeof(response->response));
-            }
-            else if (http_code == 429)
-            {
-              safe_strncpy(response->response,
-                           "API rate limit exceeded. Please try again later.",
-                           sizeof(response->response));
-            }
-            else if (http_code == 401)
-            {
-              safe_strncpy(response->response,
-                           "Invalid API key. Please check your configuration.",
-                           sizeof(response->response));
-            }
-            else
-            {
-              snprintf(response->response, sizeof(response->response),
-                       "API Error: %s", error_msg);
-            }
-          }
-        }
-        json_object_put(error_root);
+      // Provide specific error message to user
+      if (http_code == 403)
+      {
+        safe_strncpy(response->response,
+                     "API quota exceeded. Please check your billing settings.",
+                     sizeof(response->response));
       }
-    }
-
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    if (api_response.memory)
-    {
-      free(api_response.memory);
-    }
-
-    return (-1);
-  }
-
-  // HTTP 200 - Parse successful response
-  if (api_response.memory)
-  {
-#if SHOW_DEBUG
-    printf("[DEBUG] Gemini response received: %s\n", api_response.memory);
-#endif
-    // Parse JSON response
-    json_object *resp_root = json_tokener_parse(api_response.memory);
-    if (resp_root)
-    {
-      json_object *candidates;
-      if (json_object_object_get_ex(resp_root, "candidates", &candidates))
+      else if (http_code == 429)
       {
-        json_object *first_candidate = json_object_array_get_idx(candidates, 0);
-        if (first_candidate)
-        {
-          json_object *content;
-          if (json_object_object_get_ex(first_candidate, "content", &content))
-          {
-            json_object *parts;
-            if (json_object_object_get_ex(content, "parts", &parts))
-            {
-              json_object *first_part = json_object_array_get_idx(parts, 0);
-              if (first_part)
-              {
-                json_object *text;
-                if (json_object_object_get_ex(first_part, "text", &text))
-                {
-                  const char *ai_text = json_object_get_string(text);
-                  safe_strncpy(response->response, ai_text, sizeof(response->response));
-                  response->success = 1;
-#if SHOW_INFO
-                  printf("[INFO] Gemini response processed successfully\n");
-                  printf("[INFO] Response: '%s'\n", response->response);
-#endif
-                }
-                else
-                {
-#if SHOW_ERROR
-                  printf("[ERROR] No 'text' field in response\n");
-#endif
-                }
-              }
-              else
-              {
-#if SHOW_ERROR
-                printf("[ERROR] No parts in response\n");
-#endif
-              }
-            }
-            else
-            {
-#if SHOW_ERROR
-              printf("[ERROR] No 'parts' field in response\n");
-#endif
-            }
-          }
-          else
-          {
-#if SHOW_ERROR
-            printf("[ERROR] No 'content' field in response\n");
-#endif
-          }
-        }
-        else
-        {
-#if SHOW_ERROR
-          printf("[ERROR] No candidates in response\n");
-#endif
-        }
+        safe_strncpy(response->response,
+                     "API rate limit exceeded. Please try again later.",
+                     sizeof(response->response));
+      }
+      else if (http_code == 401)
+      {
+        safe_strncpy(response->response,
+                     "Invalid API key. Please check your configuration.",
+                     sizeof(response->response));
       }
       else
       {
-#if SHOW_ERROR
-        printf("[ERROR] No 'candidates' field in response\n");
-#endif
-        // Could be an error response even with HTTP 200
-        json_object *error_obj;
-        if (json_object_object_get_ex(resp_root, "error", &error_obj))
-        {
-#if SHOW_ERROR
-          printf("[ERROR] Response contains error field despite HTTP 200\n");
-#endif
-        }
+        snprintf(response->response, sizeof(response->response),
+                 "API Error: %s", gemini->error_message);
       }
-      json_object_put(resp_root);
-    }
-    else
-    {
-#if SHOW_ERROR
-      printf("[ERROR] Failed to parse Gemini response JSON\n");
-#endif
     }
+    return (-1);
   }
 
-  // Cleanup
-  curl_slist_free_all(headers);
-  curl_easy_cleanup(curl);
-  if (api_response.memory)
+  // HTTP 200 without a usable answer
+#if SHOW_ERROR
+  if (!complete)
   {
-    free(api_response.memory);
+    printf("[ERROR] Failed to parse Gemini response JSON\n");
   }
-
-  return response->success ? (0) : (-1);
+  else if (has_error)
+  {
+    printf("[ERROR] Response contains error field despite HTTP 200\n");
+  }
+  else
+  {
+    printf("[ERROR] No candidates[0].content.parts[0].text in response\n");
+  }
+#else
+  (void)has_error;
+#endif
+  return (-1);
 }
 
 /**
- * @brief Generate AI response based on personality, language, and conversation
- * Main function to get AI response with proper personality adaptation
- * @param api_key Gemini API key
- * @param personality User's personality profile
- * @param language User's language preference
- * @param conversation Complete conversation including history and current message
- * @param response Output structure for AI response
- * @return 0 on success, -1 on error
+ * @brief Deliver the text of one streamed generateContent event
+ * Each event carries a complete JSON response with the next fragment in
+ * candidates[0].content.parts[].text
+ * @return 0 on success, -1 if on_fragment aborted the stream
  */
-int generate_ai_response(const char *api_key,
-                         const char *personality,
-                         const char *language,
-                         const char *conversation,
-                         ai_response_t *response)
+static int
+gemini_parse_event(const char *data, ai_stream_callback_t on_fragment, void *context)
 {
-  // Initialize response structure
-  memset(response, 0, sizeof(ai_response_t));
+  json_object *root = json_tokener_parse(data);
+  if (!root)
+  {
+#if SHOW_WARNING
+    printf("[WARNING] Ignoring malformed stream event\n");
+#endif
+    return (0);
+  }
 
-  // Call Gemini API using our generate_gemini_request_json function
-  return call_gemini_api(api_key, personality, language, conversation, response);
+  int result = 0;
+  json_object *candidates, *content, *parts;
+  json_object *first_candidate = NULL;
+  if (json_object_object_get_ex(root, "candidates", &candidates))
+  {
+    first_candidate = json_object_array_get_idx(candidates, 0);
+  }
+
+  if (first_candidate &&
+      json_object_object_get_ex(first_candidate, "content", &content) &&
+      json_object_object_get_ex(content, "parts", &parts))
+  {
+    for (size_t i = 0; result == 0; ++i)
+    {
+      json_object *part = json_object_array_get_idx(parts, i);
+      json_object *text;
+      if (!part)
+      {
+        break;
+      }
+      if (!json_object_object_get_ex(part, "text", &text))
+      {
+        continue;
+      }
+
+      const char *fragment = json_object_get_string(text);
+      if (fragment)
+      {
+        result = on_fragment(fragment, context);
+      }
+    }
+  }
+
+  json_object_put(root);
+  return (result);
 }
+
+const ai_backend_t gemini_backend = {
+    .name = "gemini",
+    .default_base = GEMINI_API_BASE_URL,
+    .prepare = gemini_prepare,
+    .request_url = gemini_request_url,
+    .perform = upstream_submit,
+    .parser_size = sizeof(gemini_parser_t),
+    .parse_begin = gemini_parse_begin,
+    .parse_bytes = gemini_parse_bytes,
+    .parse_end = gemini_parse_end,
+    .parse_event = gemini_parse_event,
+};
@@ -1,10 +1,8 @@
 #ifndef GEMINI_AI_H
 #define GEMINI_AI_H
 
-#include "server.h"
+#include "ai_backend.h"
 
-int generate_ai_response(const char * api_key,
-                         const char * personality, const char * language_code, const char * conversation,
-                         ai_response_t * response);
+extern const ai_backend_t gemini_backend;
 
 #endif /* GEMINI_H */
@@ -0,0 +1,609 @@
+/*********************************************************************************
+ * ===== FILE: json_stream.h/json_stream.c =====
+ * Incremental extraction of string values from a JSON document
+ * The document is scanned as its bytes arrive, in chunks of any size,
+ * without building a tree: only a stack of open containers and the paths
+ * that still match are kept. The string values found at the target paths
+ * are unescaped straight into the caller's buffers
+ *********************************************************************************/
+
+#include "json_stream.h"
+
+enum
+{
+  JSON_EXPECT_VALUE,
+  JSON_EXPECT_ELEMENT_OR_END, // After '['
+  JSON_EXPECT_KEY_OR_END,     // After '{'
+  JSON_EXPECT_KEY,            // After ',' in an object
+  JSON_EXPECT_COLON,
+  JSON_IN_STRING,
+  JSON_IN_LITERAL,            // Number, true, false or null
+  JSON_AFTER_VALUE,
+  JSON_DONE
+};
+
+/**
+ * @brief Whether a byte is JSON whitespace
+ */
+static int
+is_space(char c)
+{
+  return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+}
+
+/**
+ * @brief Whether a byte can be part of a number
+ */
+static int
+is_number(char c)
+{
+  return (isdigit((unsigned char)c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E');
+}
+
+/**
+ * @brief Scan one byte of a number or of true/false/null
+ * @return 1 if the byte belongs to the literal, 0 if it ends it
+ */
+static int
+scan_literal(json_stream_t *stream, char c)
+{
+  if (!stream->word)
+  {
+    return (is_number(c));
+  }
+  if (stream->word[stream->word_length] == '\0')
+  {
+    return (0);
+  }
+  if (c != stream->word[stream->word_length])
+  {
+    stream->error = 1;
+    return (0);
+  }
+  stream->word_length++;
+  return (1);
+}
+
+/**
+ * @brief Check that the literal just ended is complete
+ */
+static void
+end_literal(json_stream_t *stream)
+{
+  if (stream->word && stream->word[stream->word_length] != '\0')
+  {
+    stream->error = 1;
+  }
+}
+
+/**
+ * @brief Reset a stream for a new document (targets are removed)
+ */
+void json_stream_init(json_stream_t *stream)
+{
+  memset(stream, 0, sizeof(json_stream_t));
+  stream->state = JSON_EXPECT_VALUE;
+}
+
+/**
+ * @brief Ask for the string at a path to be extracted
+ * Only the first value found at the path is copied; a value longer than
+ * the buffer is cut at a UTF-8 character boundary
+ * @param path Steps from the root (must outlive the stream)
+ * @param steps Number of steps
+ * @param out Output buffer, set to "" until the value is found
+ * @param size Size of out
+ * @return Index of the target, or -1 if the stream has no room for it
+ */
+int json_stream_add_target(json_stream_t *stream, const json_step_t *path, int steps, char *out, size_t size)
+{
+  if (stream->target_count == JSON_STREAM_MAX_TARGETS || size == 0 || steps > JSON_STREAM_MAX_DEPTH)
+  {
+    return (-1);
+  }
+
+  json_target_t *target = &stream->targets[stream->target_count];
+  target->path = path;
+  target->steps = steps;
+  target->out = out;
+  target->size = size;
+  target->length = 0;
+  target->found = 0;
+  out[0] = '\0';
+  return (stream->target_count++);
+}
+
+/**
+ * @brief Targets whose path leads to the value starting now
+ * The value is the root, or the member named stream->key, or the current
+ * element of the innermost array
+ */
+static unsigned
+value_mask(const json_stream_t *stream)
+{
+  if (stream->depth == 0)
+  {
+    return ((1u << stream->target_count) - 1);
+  }
+
+  int level = stream->depth - 1; // Also the path step that leads here
+  unsigned parent = stream->levels[level].mask;
+  unsigned mask = 0;
+  for (int i = 0; i < stream->target_count; ++i)
+  {
+    const json_target_t *target = &stream->targets[i];
+    if (!(parent & (1u << i)) || target->steps <= level)
+    {
+      continue;
+    }
+
+    const json_step_t *step = &target->path[level];
+    int matches = (stream->levels[level].kind == '{')
+                      ? (step->key && stream->key_length < sizeof(stream->key) && strcmp(step->key, stream->key) == 0)
+                      : (!step->key && step->index == stream->levels[level].index);
+    if (matches)
+    {
+      mask |= 1u << i;
+    }
+  }
+  return (mask);
+}
+
+/**
+ * @brief Stop a capture that ran out of room, dropping a cut UTF-8 character
+ */
+static void
+truncate_capture(json_stream_t *stream)
+{
+  json_target_t *target = stream->capture;
+  size_t end = target->length;
+
+  // Back up over continuation bytes to the last lead byte
+  size_t lead = end;
+  while (lead > 0 && ((unsigned char)target->out[lead - 1] & 0xC0) == 0x80)
+  {
+    --lead;
+  }
+  if (lead > 0)
+  {
+    unsigned char first = (unsigned char)target->out[lead - 1];
+    size_t needed = (first >= 0xF0) ? 4 : (first >= 0xE0) ? 3 : (first >= 0xC0) ? 2 : 1;
+    if (end - (lead - 1) < needed)
+    {
+      target->length = lead - 1;
+      target->out[target->length] = '\0';
+    }
+  }
+  stream->capture = NULL;
+}
+
+/**
+ * @brief Append decoded string bytes to the member name or the capture
+ */
+static void
+append_string(json_stream_t *stream, const char *bytes, size_t count)
+{
+  if (count == 0)
+  {
+    return;
+  }
+
+  if (stream->in_key)
+  {
+    // Names are only needed where some path still matches
+    if (stream->levels[stream->depth - 1].mask == 0 || stream->key_length >= sizeof(stream->key))
+    {
+      return;
+    }
+    if (stream->key_length + count < sizeof(stream->key))
+    {
+      memcpy(stream->key + stream->key_length, bytes, count);
+      stream->key_length += count;
+    }
+    else
+    {
+      stream->key_length = sizeof(stream->key); // Too long to match any path
+    }
+    return;
+  }
+
+  json_target_t *target = stream->capture;
+  if (!target)
+  {
+    return;
+  }
+  size_t room = target->size - 1 - target->length;
+  size_t copied = count < room ? count : room;
+  memcpy(target->out + target->length, bytes, copied);
+  target->length += copied;
+  target->out[target->length] = '\0';
+  if (copied < count)
+  {
+    truncate_capture(stream);
+  }
+}
+
+/**
+ * @brief Append a code point encoded as UTF-8
+ */
+static void
+append_codepoint(json_stream_t *stream, unsigned codepoint)
+{
+  char utf8[4];
+  size_t length;
+
+  if (codepoint < 0x80)
+  {
+    utf8[0] = (char)codepoint;
+    length = 1;
+  }
+  else if (codepoint < 0x800)
+  {
+    utf8[0] = (char)(0xC0 | (codepoint >> 6));
+    utf8[1] = (char)(0x80 | (codepoint & 0x3F));
+    length = 2;
+  }
+  else if (codepoint < 0x10000)
+  {
+    utf8[0] = (char)(0xE0 | (codepoint >> 12));
+    utf8[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+    utf8[2] = (char)(0x80 | (codepoint & 0x3F));
+    length = 3;
+  }
+  else
+  {
+    utf8[0] = (char)(0xF0 | (codepoint >> 18));
+    utf8[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+    utf8[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+    utf8[3] = (char)(0x80 | (codepoint & 0x3F));
+    length = 4;
+  }
+  append_string(stream, utf8, length);
+}
+
+/**
+ * @brief Replace a high surrogate that did not get its pair
+ */
+static void
+flush_surrogate(json_stream_t *stream)
+{
+  if (stream->surrogate)
+  {
+    stream->surrogate = 0;
+    append_codepoint(stream, 0xFFFD);
+  }
+}
+
+/**
+ * @brief Append a decoded \uXXXX escape, joining surrogate pairs
+ */
+static void
+append_escaped_unit(json_stream_t *stream, unsigned unit)
+{
+  if (unit >= 0xD800 && unit <= 0xDBFF)
+  {
+    flush_surrogate(stream);
+    stream->surrogate = unit;
+    return;
+  }
+  if (unit >= 0xDC00 && unit <= 0xDFFF)
+  {
+    if (!stream->surrogate)
+    {
+      append_codepoint(stream, 0xFFFD);
+      return;
+    }
+    unsigned codepoint = 0x10000 + ((stream->surrogate - 0xD800) << 10) + (unit - 0xDC00);
+    stream->surrogate = 0;
+    append_codepoint(stream, codepoint);
+    return;
+  }
+  flush_surrogate(stream);
+  append_codepoint(stream, unit);
+}
+
+/**
+ * @brief Enter the state that follows a complete value
+ */
+static void
+end_value(json_stream_t *stream)
+{
+  stream->state = stream->depth > 0 ? JSON_AFTER_VALUE : JSON_DONE;
+}
+
+/**
+ * @brief Handle the first byte of a value
+ */
+static void
+begin_value(json_stream_t *stream, char c)
+{
+  unsigned mask = value_mask(stream);
+
+  if (c == '{' || c == '[')
+  {
+    if (stream->depth == JSON_STREAM_MAX_DEPTH)
+    {
+      stream->error = 1;
+      return;
+    }
+    stream->levels[stream->depth].kind = c;
+    stream->levels[stream->depth].index = 0;
+    stream->levels[stream->depth].mask = mask;
+    stream->depth++;
+    stream->state = (c == '{') ? JSON_EXPECT_KEY_OR_END : JSON_EXPECT_ELEMENT_OR_END;
+  }
+  else if (c == '"')
+  {
+    stream->in_key = 0;
+    stream->capture = NULL;
+    for (int i = 0; i < stream->target_count; ++i)
+    {
+      json_target_t *target = &stream->targets[i];
+      if ((mask & (1u << i)) && target->steps == stream->depth && !target->found)
+      {
+        target->found = 1;
+        stream->capture = target;
+        break;
+      }
+    }
+    stream->state = JSON_IN_STRING;
+  }
+  else if (c == 't' || c == 'f' || c == 'n' || c == '-' || isdigit((unsigned char)c))
+  {
+    stream->word = (c == 't') ? "true" : (c == 'f') ? "false" : (c == 'n') ? "null" : NULL;
+    stream->word_length = 1;
+    stream->state = JSON_IN_LITERAL;
+  }
+  else
+  {
+    stream->error = 1;
+  }
+}
+
+/**
+ * @brief Handle the closing quote of a string
+ */
+static void
+end_string(json_stream_t *stream)
+{
+  flush_surrogate(stream);
+  if (stream->in_key)
+  {
+    if (stream->key_length < sizeof(stream->key))
+    {
+      stream->key[stream->key_length] = '\0';
+    }
+    stream->in_key = 0;
+    stream->state = JSON_EXPECT_COLON;
+    return;
+  }
+  stream->capture = NULL;
+  end_value(stream);
+}
+
+/**
+ * @brief Handle one byte of a \ escape
+ */
+static void
+scan_escape(json_stream_t *stream, char c)
+{
+  if (stream->escape == 2)
+  {
+    int digit = isdigit((unsigned char)c) ? c - '0'
+                : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+                : -1;
+    if (digit < 0)
+    {
+      stream->error = 1;
+      return;
+    }
+    stream->codepoint = stream->codepoint * 16 + (unsigned)digit;
+    if (++stream->hex_digits == 4)
+    {
+      stream->escape = 0;
+      append_escaped_unit(stream, stream->codepoint);
+    }
+    return;
+  }
+
+  char decoded;
+  switch (c)
+  {
+  case '"':
+  case '\\':
+  case '/':
+    decoded = c;
+    break;
+  case 'b':
+    decoded = '\b';
+    break;
+  case 'f':
+    decoded = '\f';
+    break;
+  case 'n':
+    decoded = '\n';
+    break;
+  case 'r':
+    decoded = '\r';
+    break;
+  case 't':
+    decoded = '\t';
+    break;
+  case 'u':
+    stream->escape = 2;
+    stream->codepoint = 0;
+    stream->hex_digits = 0;
+    return;
+  default:
+    stream->error = 1;
+    return;
+  }
+  stream->escape = 0;
+  flush_surrogate(stream);
+  append_string(stream, &decoded, 1);
+}
+
+/**
+ * @brief Scan string bytes up to the closing quote or the end of the chunk
+ * @return First byte not consumed
+ */
+static const char *
+scan_string(json_stream_t *stream, const char *p, const char *end)
+{
+  while (p < end && !stream->error)
+  {
+    if (stream->escape)
+    {
+      scan_escape(stream, *p++);
+      continue;
+    }
+
+    // Copy the plain run up to the next quote or backslash at once
+    const char *run = p;
+    while (p < end && *p != '"' && *p != '\\')
+    {
+      ++p;
+    }
+    if (p > run)
+    {
+      flush_surrogate(stream);
+      append_string(stream, run, (size_t)(p - run));
+    }
+    if (p == end)
+    {
+      break;
+    }
+    if (*p++ == '"')
+    {
+      end_string(stream);
+      break;
+    }
+    stream->escape = 1;
+  }
+  return (p);
+}
+
+/**
+ * @brief Scan the next bytes of the document
+ * Malformed input sets the error flag; the rest of it is then ignored
+ */
+void json_stream_feed(json_stream_t *stream, const char *data, size_t size)
+{
+  const char *p = data;
+  const char *end = data + size;
+
+  while (p < end && !stream->error)
+  {
+    if (stream->state == JSON_IN_STRING)
+    {
+      p = scan_string(stream, p, end);
+      continue;
+    }
+    if (stream->state == JSON_IN_LITERAL)
+    {
+      if (scan_literal(stream, *p))
+      {
+        ++p;
+        continue;
+      }
+      end_literal(stream);
+      end_value(stream); // The delimiter is scanned below
+      if (stream->error)
+      {
+        break;
+      }
+    }
+
+    char c = *p++;
+    if (is_space(c))
+    {
+      continue;
+    }
+
+    switch (stream->state)
+    {
+    case JSON_EXPECT_ELEMENT_OR_END:
+      if (c == ']')
+      {
+        stream->depth--;
+        end_value(stream);
+        break;
+      }
+      // fall through
+    case JSON_EXPECT_VALUE:
+      begin_value(stream, c);
+      break;
+    case JSON_EXPECT_KEY_OR_END:
+      if (c == '}')
+      {
+        stream->depth--;
+        end_value(stream);
+        break;
+      }
+      // fall through
+    case JSON_EXPECT_KEY:
+      if (c != '"')
+      {
+        stream->error = 1;
+        break;
+      }
+      stream->in_key = 1;
+      stream->key_length = 0;
+      stream->state = JSON_IN_STRING;
+      break;
+    case JSON_EXPECT_COLON:
+      if (c != ':')
+      {
+        stream->error = 1;
+        break;
+      }
+      stream->state = JSON_EXPECT_VALUE;
+      break;
+    case JSON_AFTER_VALUE:
+    {
+      char kind = stream->levels[stream->depth - 1].kind;
+      if (c == ',')
+      {
+        if (kind == '[')
+        {
+          stream->levels[stream->depth - 1].index++;
+          stream->state = JSON_EXPECT_VALUE;
+        }
+        else
+        {
+          stream->state = JSON_EXPECT_KEY;
+        }
+      }
+      else if ((c == '}' && kind == '{') || (c == ']' && kind == '['))
+      {
+        stream->depth--;
+        end_value(stream);
+      }
+      else
+      {
+        stream->error = 1;
+      }
+      break;
+    }
+    default:
+      // Only whitespace may follow the document
+      stream->error = 1;
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Check that a complete, well-formed document was scanned
+ * @return 0 if it was, -1 if it was malformed or cut short
+ */
+int json_stream_finish(json_stream_t *stream)
+{
+  if (stream->state == JSON_IN_LITERAL && stream->depth == 0)
+  {
+    end_literal(stream);
+    stream->state = JSON_DONE;
+  }
+  return (!stream->error && stream->state == JSON_DONE) ? (0) : (-1);
+}
@@ -0,0 +1,61 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include "server.h"
+
+/**
+ * @brief One step of a path from the document root
+ */
+typedef struct
+{
+  const char * key; // Object member name, NULL for an array element
+  long index;       // Array index (when key is NULL)
+} json_step_t;
+
+/**
+ * @brief A string value to extract and where to copy it
+ */
+typedef struct
+{
+  const json_step_t * path; // Steps from the root to the value
+  int steps;                // Number of steps
+  char * out;               // Receives the unescaped string (always terminated)
+  size_t size;              // Size of out
+  size_t length;            // Bytes copied so far
+  int found;                // 1 once the value was seen
+} json_target_t;
+
+/**
+ * @brief Incremental JSON scanner state (no allocation, fixed size)
+ */
+typedef struct
+{
+  json_target_t targets[JSON_STREAM_MAX_TARGETS];
+  int target_count;
+  int state;                       // What the scanner expects next
+  int error;                       // 1 once the input is known not to be JSON
+  int depth;                       // Open containers
+  struct
+  {
+    char kind;                     // '{' or '['
+    long index;                    // Current element of an array
+    unsigned mask;                 // Targets whose path leads into the container
+  } levels[JSON_STREAM_MAX_DEPTH];
+  char key[JSON_STREAM_MAX_KEY];   // Member name being read
+  size_t key_length;               // Bytes of the name, sizeof(key) if too long
+  int in_key;                      // The string being read is a member name
+  json_target_t *capture;          // Target receiving the string being read
+  int escape;                      // 1 after '\', 2 inside \uXXXX
+  unsigned codepoint;              // \uXXXX being decoded
+  int hex_digits;                  // Digits of codepoint read so far
+  unsigned surrogate;              // High surrogate waiting for its pair
+  const char *word;                // true, false or null being read (NULL for a number)
+  size_t word_length;              // Bytes of word read so far
+} json_stream_t;
+
+void json_stream_init(json_stream_t * stream);
+int json_stream_add_target(json_stream_t * stream, const json_step_t * path, int steps, char * out, size_t size);
+void json_stream_feed(json_stream_t * stream, const char * data, size_t size);
+int json_stream_finish(json_stream_t * stream);
+
+#endif /* JSON_STREAM_H */
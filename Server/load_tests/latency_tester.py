@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""
+Latency Tester per Robot Dialog Server
+Misura la distribuzione delle latenze delle richieste AI (p50/p90/p99),
+ad esempio contro mock_gemini.py con una coda lenta, per confrontare il
+server con e senza richieste hedged (-H)
+
+Uso:
+    python3 mock_gemini.py --port 8090 --delay 0.1 --slow-rate 0.05 --slow-delay 2
+    ./robot_dialog_server -p 8081 -H 95
+    python3 latency_tester.py --port 8081 --requests 2000 --concurrency 20
+"""
+
+import argparse
+import json
+import socket
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+
+class LatencyTester:
+    def __init__(self, host='localhost', port=8081):
+        self.host = host
+        self.port = port
+        self.latencies = []
+        self.fallbacks = 0
+        self.errors = 0
+        self.lock = threading.Lock()
+
+    def single_request(self, request_id):
+        """Invia una richiesta AI unica (niente cache ne' coalescing) e ne misura la latenza"""
+        conversation = json.dumps({"role": "user", "parts": [{"text": f"Hello number {request_id}"}]})
+        request = f"1|extraversion:5.0|en|{conversation}\n"
+
+        start_time = time.time()
+        try:
+            with socket.create_connection((self.host, self.port), timeout=30) as sock:
+                sock.sendall(request.encode())
+                response = sock.makefile('rb').readline().decode()
+        except OSError:
+            with self.lock:
+                self.errors += 1
+            return
+        latency = (time.time() - start_time) * 1000
+
+        with self.lock:
+            if response.startswith('3|'):
+                self.latencies.append(latency)
+            elif response.startswith('4|'):
+                self.fallbacks += 1
+            else:
+                self.errors += 1
+
+    def run(self, requests, concurrency):
+        """Esegue le richieste con il livello di concorrenza dato"""
+        print(f"Sending {requests} AI requests, {concurrency} at a time")
+        start_time = time.time()
+        with ThreadPoolExecutor(max_workers=concurrency) as executor:
+            list(executor.map(self.single_request, range(requests)))
+        self.print_statistics(time.time() - start_time)
+
+    def percentile(self, ordered, p):
+        """Percentile (nearest rank) di una lista ordinata"""
+        index = min(len(ordered) - 1, max(0, int(round(p / 100.0 * len(ordered) + 0.5)) - 1))
+        return ordered[index]
+
+    def print_statistics(self, total_time):
+        """Stampa la distribuzione delle latenze"""
+        print("\n" + "=" * 60)
+        print("LATENCY TEST RESULTS")
+        print("=" * 60)
+        print(f"AI responses: {len(self.latencies)}, fallbacks: {self.fallbacks}, errors: {self.errors}")
+        print(f"Total time: {total_time:.2f}s")
+        if not self.latencies:
+            return
+
+        ordered = sorted(self.latencies)
+        for p in (50, 90, 99, 99.9):
+            print(f"  p{p}: {self.percentile(ordered, p):.0f}ms")
+        print(f"  Max: {ordered[-1]:.0f}ms")
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Latency percentiles of AI requests')
+    parser.add_argument('--host', default='localhost', help='Server host')
+    parser.add_argument('--port', type=int, default=8081, help='Server port')
+    parser.add_argument('--requests', type=int, default=1000, help='Number of AI requests')
+    parser.add_argument('--concurrency', type=int, default=10, help='Requests in flight at a time')
+    args = parser.parse_args()
+
+    LatencyTester(args.host, args.port).run(args.requests, args.concurrency)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+"""
+Mock Gemini per Robot Dialog Server
+Sostituto locale dell'API Gemini per testare il server offline:
+risponde a :generateContent (JSON completo) e a
+:streamGenerateContent?alt=sse (server-sent events, un frammento per evento).
+Con --error-rate una parte delle richieste riceve 503 (o 429), per
+provare i retry del server, e con --drop-rate la connessione viene chiusa
+senza risposta; con --delay, --slow-rate e --slow-delay le risposte
+arrivano in ritardo (coda lenta), per misurare p99 e hedging.
+--latency sceglie la distribuzione della latenza, --reply-words la
+dimensione delle risposte e --seed rende i benchmark riproducibili
+
+Uso:
+    python3 mock_gemini.py --port 8090
+    python3 mock_gemini.py --port 8090 --error-rate 0.3 --error-status 429 --retry-after 1
+    python3 mock_gemini.py --port 8090 --delay 0.1 --slow-rate 0.05 --slow-delay 2
+    python3 mock_gemini.py --port 8090 --latency lognormal:0.2:0.5 --reply-words 50:300 --seed 1
+    GEMINI_API_KEY=test GEMINI_API_BASE_URL=http://127.0.0.1:8090/v1beta/models/mock ./robot_dialog_server -k
+"""
+
+import argparse
+import json
+import math
+import random
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+REPLY = ("Hello! I am a mock robot. I answer offline, one piece at a time, "
+         "so you can hear the first words before the rest is ready.")
+
+
+class MockGeminiServer(ThreadingHTTPServer):
+    """Server HTTP con backlog ampio per molte chiamate concorrenti"""
+    request_queue_size = 256
+    daemon_threads = True
+
+
+class MockGeminiHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    chunk_delay = 0.05
+    chunk_words = 4
+    error_rate = 0.0
+    error_status = 503
+    retry_after = None
+    delay = 0.0
+    slow_rate = 0.0
+    slow_delay = 0.0
+    latency = None
+    drop_rate = 0.0
+    reply_words = None
+
+    def log_message(self, format, *args):
+        """Silenzia il log di ogni richiesta"""
+        pass
+
+    def candidate(self, text):
+        """Costruisce una risposta generateContent con il testo dato"""
+        return {
+            "candidates": [{
+                "content": {"parts": [{"text": text}], "role": "model"},
+                "index": 0
+            }]
+        }
+
+    def sample_latency(self):
+        """Secondi di attesa prima della risposta secondo la distribuzione scelta"""
+        if random.random() < self.slow_rate:
+            return self.slow_delay
+        if self.latency is None:
+            return self.delay
+        kind, params = self.latency
+        if kind == 'uniform':
+            return random.uniform(params[0], params[1])
+        if kind == 'exp':
+            return random.expovariate(1.0 / params[0]) if params[0] > 0 else 0.0
+        if kind == 'lognormal':
+            return random.lognormvariate(math.log(params[0]), params[1])
+        return params[0]
+
+    def reply_text(self):
+        """Testo della risposta, ripetuto fino al numero di parole richiesto"""
+        if self.reply_words is None:
+            return REPLY
+        count = random.randint(self.reply_words[0], self.reply_words[1])
+        words = REPLY.split(' ')
+        return ' '.join(words[i % len(words)] for i in range(max(1, count)))
+
+    def do_POST(self):
+        length = int(self.headers.get('Content-Length', 0))
+        body = self.rfile.read(length)
+        try:
+            json.loads(body)
+        except ValueError:
+            self.send_json(400, {"error": {"code": 400, "message": "Invalid JSON payload"}})
+            return
+
+        # Latenza iniettata: base per tutti, molto piu' alta per pochi
+        time.sleep(self.sample_latency())
+
+        if random.random() < self.drop_rate:
+            self.close_connection = True
+            return
+
+        if random.random() < self.error_rate:
+            self.send_json(self.error_status,
+                           {"error": {"code": self.error_status, "message": "Mock overload"}},
+                           self.retry_after)
+            return
+
+        if ':streamGenerateContent' in self.path:
+            self.stream_reply()
+        elif ':generateContent' in self.path:
+            self.send_json(200, self.candidate(self.reply_text()))
+        else:
+            self.send_json(404, {"error": {"code": 404, "message": "Unknown method"}})
+
+    def send_json(self, status, payload, retry_after=None):
+        """Invia una risposta JSON completa"""
+        data = json.dumps(payload).encode()
+        self.send_response(status)
+        self.send_header('Content-Type', 'application/json')
+        if retry_after is not None:
+            self.send_header('Retry-After', str(retry_after))
+        self.send_header('Content-Length', str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def stream_reply(self):
+        """Invia la risposta come eventi SSE, qualche parola per evento"""
+        self.send_response(200)
+        self.send_header('Content-Type', 'text/event-stream')
+        self.send_header('Transfer-Encoding', 'chunked')
+        self.end_headers()
+
+        words = self.reply_text().split(' ')
+        for i in range(0, len(words), self.chunk_words):
+            text = ' '.join(words[i:i + self.chunk_words])
+            if i + self.chunk_words < len(words):
+                text += ' '
+            event = f"data: {json.dumps(self.candidate(text))}\r\n\r\n".encode()
+            self.wfile.write(f"{len(event):x}\r\n".encode() + event + b"\r\n")
+            self.wfile.flush()
+            time.sleep(self.chunk_delay)
+        self.wfile.write(b"0\r\n\r\n")
+        self.wfile.flush()
+
+
+def parse_latency(spec):
+    """Interpreta --latency: fixed:S, uniform:MIN:MAX, exp:MEAN o lognormal:MEDIAN:SIGMA"""
+    kind, _, rest = spec.partition(':')
+    counts = {'fixed': 1, 'uniform': 2, 'exp': 1, 'lognormal': 2}
+    try:
+        params = [float(value) for value in rest.split(':')] if rest else []
+    except ValueError:
+        params = []
+    if kind not in counts or len(params) != counts[kind] or min(params) < 0 or \
+            (kind == 'lognormal' and params[0] <= 0):
+        raise argparse.ArgumentTypeError(f"invalid latency distribution: {spec}")
+    return kind, params
+
+
+def parse_words(spec):
+    """Interpreta --reply-words: N oppure MIN:MAX"""
+    try:
+        bounds = [int(value) for value in spec.split(':')]
+    except ValueError:
+        bounds = []
+    if len(bounds) == 1:
+        bounds *= 2
+    if len(bounds) != 2 or bounds[0] < 1 or bounds[1] < bounds[0]:
+        raise argparse.ArgumentTypeError(f"invalid word count: {spec}")
+    return bounds
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Local Gemini stand-in for offline testing')
+    parser.add_argument('--host', default='127.0.0.1', help='Listen address')
+    parser.add_argument('--port', type=int, default=8090, help='Listen port')
+    parser.add_argument('--chunk-delay', type=float, default=0.05, help='Seconds between stream events')
+    parser.add_argument('--chunk-words', type=int, default=4, help='Words per stream event')
+    parser.add_argument('--error-rate', type=float, default=0.0, help='Fraction of requests that fail')
+    parser.add_argument('--error-status', type=int, default=503, help='HTTP status of failed requests')
+    parser.add_argument('--retry-after', type=int, default=None, help='Retry-After seconds on failures')
+    parser.add_argument('--delay', type=float, default=0.0, help='Seconds before every answer')
+    parser.add_argument('--slow-rate', type=float, default=0.0, help='Fraction of answers that are slow')
+    parser.add_argument('--slow-delay', type=float, default=0.0, help='Seconds before a slow answer')
+    parser.add_argument('--latency', type=parse_latency, default=None,
+                        help='Latency distribution in seconds: fixed:S, uniform:MIN:MAX, exp:MEAN '
+                             'or lognormal:MEDIAN:SIGMA (replaces --delay)')
+    parser.add_argument('--drop-rate', type=float, default=0.0,
+                        help='Fraction of requests whose connection is closed without an answer')
+    parser.add_argument('--reply-words', type=parse_words, default=None,
+                        help='Words per answer: N or MIN:MAX (default: the fixed reply)')
+    parser.add_argument('--seed', type=int, default=None, help='Random seed for reproducible runs')
+    args = parser.parse_args()
+
+    if args.seed is not None:
+        random.seed(args.seed)
+
+    MockGeminiHandler.chunk_delay = args.chunk_delay
+    MockGeminiHandler.chunk_words = args.chunk_words
+    MockGeminiHandler.error_rate = args.error_rate
+    MockGeminiHandler.error_status = args.error_status
+    MockGeminiHandler.retry_after = args.retry_after
+    MockGeminiHandler.delay = args.delay
+    MockGeminiHandler.slow_rate = args.slow_rate
+    MockGeminiHandler.slow_delay = args.slow_delay
+    MockGeminiHandler.latency = args.latency
+    MockGeminiHandler.drop_rate = args.drop_rate
+    MockGeminiHandler.reply_words = args.reply_words
+
+    server = MockGeminiServer((args.host, args.port), MockGeminiHandler)
+    print(f"Mock Gemini listening on http://{args.host}:{args.port}/v1beta/models/mock")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""
+Mock Gemini HTTP/2 per Robot Dialog Server
+Come mock_gemini.py, ma parla HTTP/2 in chiaro (h2c con prior knowledge):
+serve a verificare che il server multiplexi le chiamate AI concorrenti su
+poche connessioni. Alla chiusura di ogni connessione stampa quanti stream
+ha portato e quanti erano attivi al massimo nello stesso momento.
+
+Richiede il pacchetto h2 (pip install h2)
+
+Uso:
+    python3 mock_gemini_h2.py --port 8091 --delay 0.5
+    GEMINI_API_KEY=test GEMINI_API_BASE_URL=http://127.0.0.1:8091/v1beta/models/mock ./robot_dialog_server -k -m 100
+"""
+
+import argparse
+import asyncio
+import json
+
+from h2.config import H2Configuration
+from h2.connection import H2Connection
+from h2.events import ConnectionTerminated, DataReceived, RequestReceived, StreamEnded, StreamReset
+from h2.settings import SettingCodes
+
+from mock_gemini import REPLY
+
+
+def candidate(text):
+    """Costruisce una risposta generateContent con il testo dato"""
+    return {
+        "candidates": [{
+            "content": {"parts": [{"text": text}], "role": "model"},
+            "index": 0
+        }]
+    }
+
+
+class H2MockConnection:
+    """Una connessione HTTP/2: smista gli stream e tiene le statistiche"""
+    count = 0
+
+    def __init__(self, reader, writer, args):
+        H2MockConnection.count += 1
+        self.id = H2MockConnection.count
+        self.reader = reader
+        self.writer = writer
+        self.args = args
+        self.conn = H2Connection(config=H2Configuration(client_side=False, header_encoding='utf-8'))
+        self.requests = {}
+        self.active = 0
+        self.peak = 0
+        self.streams = 0
+
+    def flush(self):
+        """Invia i frame in attesa"""
+        data = self.conn.data_to_send()
+        if data:
+            self.writer.write(data)
+
+    async def run(self):
+        self.conn.initiate_connection()
+        self.conn.update_settings({SettingCodes.MAX_CONCURRENT_STREAMS: self.args.max_streams})
+        self.flush()
+        try:
+            while True:
+                data = await self.reader.read(65536)
+                if not data:
+                    break
+                for event in self.conn.receive_data(data):
+                    if isinstance(event, RequestReceived):
+                        self.requests[event.stream_id] = [dict(event.headers), b'']
+                    elif isinstance(event, DataReceived):
+                        self.requests[event.stream_id][1] += event.data
+                        self.conn.acknowledge_received_data(event.flow_controlled_length, event.stream_id)
+                    elif isinstance(event, StreamEnded):
+                        headers, body = self.requests.pop(event.stream_id)
+                        asyncio.ensure_future(self.respond(event.stream_id, headers, body))
+                    elif isinstance(event, StreamReset):
+                        self.requests.pop(event.stream_id, None)
+                    elif isinstance(event, ConnectionTerminated):
+                        break
+                self.flush()
+        except (ConnectionError, asyncio.IncompleteReadError):
+            pass
+        finally:
+            self.writer.close()
+            print(f"connection {self.id} closed: {self.streams} streams, "
+                  f"peak {self.peak} concurrent")
+
+    async def respond(self, stream_id, headers, body):
+        """Risponde a uno stream (JSON completo o eventi SSE)"""
+        self.streams += 1
+        self.active += 1
+        self.peak = max(self.peak, self.active)
+        try:
+            await asyncio.sleep(self.args.delay)
+            path = headers.get(':path', '')
+            try:
+                json.loads(body)
+            except ValueError:
+                self.send(stream_id, 400, {"error": {"code": 400, "message": "Invalid JSON payload"}})
+                return
+
+            if ':streamGenerateContent' in path:
+                await self.stream(stream_id)
+            elif ':generateContent' in path:
+                self.send(stream_id, 200, candidate(REPLY))
+            else:
+                self.send(stream_id, 404, {"error": {"code": 404, "message": "Unknown method"}})
+        except Exception:
+            # Lo stream o la connessione sono stati chiusi dal client
+            pass
+        finally:
+            self.active -= 1
+
+    def send(self, stream_id, status, payload):
+        """Invia una risposta JSON completa"""
+        data = json.dumps(payload).encode()
+        self.conn.send_headers(stream_id, [(':status', str(status)),
+                                           ('content-type', 'application/json'),
+                                           ('content-length', str(len(data)))])
+        self.conn.send_data(stream_id, data, end_stream=True)
+        self.flush()
+
+    async def stream(self, stream_id):
+        """Invia la risposta come eventi SSE, qualche parola per evento"""
+        self.conn.send_headers(stream_id, [(':status', '200'), ('content-type', 'text/event-stream')])
+        words = REPLY.split(' ')
+        step = self.args.chunk_words
+        for i in range(0, len(words), step):
+            text = ' '.join(words[i:i + step])
+            if i + step < len(words):
+                text += ' '
+            self.conn.send_data(stream_id, f"data: {json.dumps(candidate(text))}\r\n\r\n".encode())
+            self.flush()
+            await asyncio.sleep(self.args.chunk_delay)
+        self.conn.end_stream(stream_id)
+        self.flush()
+
+
+async def serve(args):
+    async def on_connect(reader, writer):
+        await H2MockConnection(reader, writer, args).run()
+
+    server = await asyncio.start_server(on_connect, args.host, args.port, backlog=256)
+    print(f"Mock Gemini (h2c) listening on http://{args.host}:{args.port}/v1beta/models/mock")
+    async with server:
+        await server.serve_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Local HTTP/2 (h2c) Gemini stand-in')
+    parser.add_argument('--host', default='127.0.0.1', help='Listen address')
+    parser.add_argument('--port', type=int, default=8091, help='Listen port')
+    parser.add_argument('--delay', type=float, default=0.0, help='Seconds before answering each call')
+    parser.add_argument('--chunk-delay', type=float, default=0.05, help='Seconds between stream events')
+    parser.add_argument('--chunk-words', type=int, default=4, help='Words per stream event')
+    parser.add_argument('--max-streams', type=int, default=100, help='Advertised SETTINGS_MAX_CONCURRENT_STREAMS')
+    args = parser.parse_args()
+
+    try:
+        asyncio.run(serve(args))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
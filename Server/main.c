@@ -3,8 +3,17 @@
  * Main server entry point and initialization
  *********************************************************************************/
 
+#include "ai_client.h"
+#include "api_keys.h"
+#include "circuit_breaker.h"
+#include "conversation.h"
 #include "network.h"
+#include "prompt_template.h"
+#include "response_cache.h"
+#include "single_flight.h"
 #include "thread_pool.h"
+#include "upstream.h"
+#include "uring_backend.h"
 #include "utils.h"
 
 /**
@@ -23,58 +32,73 @@ signal_handler(int signum)
 }
 
 /**
- * @brief Initialize the server
- * Sets up sockets, epoll, thread pool, and all server components
- * @param port Port number to listen on
- * @param gemini_api_key Google Gemini API key
- * @return 0 on success, -1 on error
+ * @brief Close the sockets owned by a reactor
+ * @param reactor Reactor to close
  */
-static int
-init_server(int port, const char *gemini_api_key)
+static void
+close_reactor(reactor_t *reactor)
 {
-#if SHOW_INFO
-  printf("[INFO] Initializing Robot Dialog Server...\n");
+#ifdef USE_IO_URING
+  uring_reactor_destroy(reactor);
 #endif
+  if (reactor->epoll_fd != -1)
+  {
+    close(reactor->epoll_fd);
+    reactor->epoll_fd = -1;
+  }
 
-  // Clear server structure
-  memset(&g_server, 0, sizeof(server_context_t));
-
-  // Store API key
-  safe_strncpy(g_server.gemini_api_key, gemini_api_key, sizeof(g_server.gemini_api_key));
-
-  // Initialize cURL library for HTTP requests
-  if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+  if (reactor->listen_fd != -1)
   {
-#if SHOW_ERROR
-    printf("[ERROR] Failed to initialize cURL library\n");
-#endif
-    return (-1);
+    close(reactor->listen_fd);
+    reactor->listen_fd = -1;
   }
+}
 
-  // Create main server socket
-  g_server.server_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (g_server.server_fd == -1)
+/**
+ * @brief Open the listening socket and epoll instance of a reactor
+ * With several reactors every one binds its own SO_REUSEPORT listener, so the
+ * kernel spreads incoming connections across them
+ * @param reactor Reactor to initialize
+ * @param port Port number to listen on
+ * @param reuse_port 1 to set SO_REUSEPORT on the listener
+ * @return 0 on success, -1 on error
+ */
+static int
+open_reactor(reactor_t *reactor, int port, int reuse_port)
+{
+  reactor->listen_fd = -1;
+  reactor->epoll_fd = -1;
+
+  // Create listening socket
+  reactor->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (reactor->listen_fd == -1)
   {
     perror("socket");
-    curl_global_cleanup();
     return (-1);
   }
 
   // Set socket options for address reuse
   int opt = 1;
-  if (setsockopt(g_server.server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+  if (setsockopt(reactor->listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
   {
     perror("setsockopt");
-    close(g_server.server_fd);
-    curl_global_cleanup();
+    close_reactor(reactor);
+    return (-1);
+  }
+
+  // Let every reactor bind its own listener on the same port
+  if (reuse_port &&
+      setsockopt(reactor->listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+  {
+    perror("setsockopt: SO_REUSEPORT");
+    close_reactor(reactor);
     return (-1);
   }
 
   // Make server socket non-blocking
-  if (make_socket_non_blocking(g_server.server_fd) < 0)
+  if (make_socket_non_blocking(reactor->listen_fd) < 0)
   {
-    close(g_server.server_fd);
-    curl_global_cleanup();
+    close_reactor(reactor);
     return (-1);
   }
 
@@ -86,46 +110,126 @@ init_server(int port, const char *gemini_api_key)
   server_addr.sin_port = htons(port);
 
   // Bind socket to address
-  if (bind(g_server.server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+  if (bind(reactor->listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
   {
     perror("bind");
-    close(g_server.server_fd);
-    curl_global_cleanup();
+    close_reactor(reactor);
     return (-1);
   }
 
   // Start listening for connections
-  if (listen(g_server.server_fd, BACKLOG) < 0)
+  if (listen(reactor->listen_fd, BACKLOG) < 0)
   {
     perror("listen");
-    close(g_server.server_fd);
-    curl_global_cleanup();
+    close_reactor(reactor);
     return (-1);
   }
 
+#ifdef USE_IO_URING
+  // Completion-based backend: accepts are submitted on the reactor's ring
+  if (uring_reactor_init(reactor) < 0)
+  {
+    close_reactor(reactor);
+    return (-1);
+  }
+#else
   // Create epoll instance for efficient I/O monitoring
-  g_server.epoll_fd = epoll_create1(0);
-  if (g_server.epoll_fd == -1)
+  reactor->epoll_fd = epoll_create1(0);
+  if (reactor->epoll_fd == -1)
   {
     perror("epoll_create1");
-    close(g_server.server_fd);
-    curl_global_cleanup();
+    close_reactor(reactor);
     return (-1);
   }
 
   // Add server socket to epoll monitoring
   struct epoll_event event;
   event.events = EPOLLIN; // Monitor for incoming connections
-  event.data.fd = g_server.server_fd;
+  event.data.fd = reactor->listen_fd;
 
-  if (epoll_ctl(g_server.epoll_fd, EPOLL_CTL_ADD, g_server.server_fd, &event) == -1)
+  if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->listen_fd, &event) == -1)
   {
-    perror("epoll_ctl: server_fd");
-    close(g_server.epoll_fd);
-    close(g_server.server_fd);
-    curl_global_cleanup();
+    perror("epoll_ctl: listen_fd");
+    close_reactor(reactor);
+    return (-1);
+  }
+#endif
+
+  return (0);
+}
+
+/**
+ * @brief Initialize the server
+ * Sets up sockets, epoll, thread pool, and all server components
+ * @param port Port number to listen on
+ * @param gemini_api_keys Google Gemini API keys (comma separated)
+ * @param requests_per_min Request quota of each key (0 = unlimited)
+ * @param tokens_per_min Token quota of each key (0 = unlimited)
+ * @param gemini_api_base Gemini model endpoint URL
+ * @param keep_alive 1 to keep client connections open across requests
+ * @param reactor_count Number of event loops (each with its own listener)
+ * @param upstream_count Number of upstream threads driving AI calls
+ * @param http2_streams Streams per HTTP/2 upstream connection (0 = HTTP/1.1)
+ * @param hedge_percentile Latency percentile that triggers a hedged AI call (0 = off)
+ * @param conversation_max_tokens Token budget of the history sent upstream (0 = unlimited)
+ * @return 0 on success, -1 on error
+ */
+static int
+init_server(int port, const char *gemini_api_keys, long requests_per_min, long tokens_per_min,
+            const char *gemini_api_base, int keep_alive, int reactor_count, int upstream_count, int http2_streams,
+            int hedge_percentile, long conversation_max_tokens)
+{
+#if SHOW_INFO
+  printf("[INFO] Initializing Robot Dialog Server...\n");
+#endif
+
+  // Clear server structure
+  memset(&g_server, 0, sizeof(server_context_t));
+
+  // Store API keys
+  int key_count = api_keys_init(gemini_api_keys, requests_per_min, tokens_per_min);
+  if (key_count < 0)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] No valid Gemini API key\n");
+#endif
     return (-1);
   }
+  safe_strncpy(g_server.gemini_api_base, gemini_api_base, sizeof(g_server.gemini_api_base));
+  g_server.conversation_max_tokens = conversation_max_tokens;
+
+  // Connection mode
+  g_server.keep_alive = keep_alive;
+  for (int fd = 0; fd < MAX_CLIENTS; ++fd)
+  {
+    pthread_mutex_init(&g_server.connections[fd].lock, NULL);
+    pthread_mutex_init(&g_server.connections[fd].write_lock, NULL);
+  }
+
+  // Initialize cURL library for HTTP requests
+  if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Failed to initialize cURL library\n");
+#endif
+    return (-1);
+  }
+
+  // Create one listener and epoll instance per reactor
+  for (int i = 0; i < reactor_count; ++i)
+  {
+    g_server.reactors[i].id = i;
+    if (open_reactor(&g_server.reactors[i], port, reactor_count > 1) < 0)
+    {
+      for (int j = 0; j < i; ++j)
+      {
+        close_reactor(&g_server.reactors[j]);
+      }
+      curl_global_cleanup();
+      return (-1);
+    }
+  }
+  g_server.reactor_count = reactor_count;
 
   // Create thread pool for concurrent request processing
   g_server.pool = thread_pool_create(THREAD_POOL_INITIAL_SIZE);
@@ -134,8 +238,43 @@ init_server(int port, const char *gemini_api_key)
 #if SHOW_ERROR
     printf("[ERROR] Failed to create enhanced thread pool\n");
 #endif
-    close(g_server.epoll_fd);
-    close(g_server.server_fd);
+    for (int i = 0; i < reactor_count; ++i)
+    {
+      close_reactor(&g_server.reactors[i]);
+    }
+    curl_global_cleanup();
+    return (-1);
+  }
+
+  // Cache of AI responses shared by all connections
+  if (response_cache_init() < 0)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Failed to initialize response cache\n");
+#endif
+    thread_pool_destroy(g_server.pool);
+    g_server.pool = NULL;
+    for (int i = 0; i < reactor_count; ++i)
+    {
+      close_reactor(&g_server.reactors[i]);
+    }
+    curl_global_cleanup();
+    return (-1);
+  }
+
+  // Start the engines that drive AI calls without blocking workers
+  if (upstream_init(upstream_count, http2_streams, hedge_percentile) < 0)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Failed to start upstream engines\n");
+#endif
+    response_cache_destroy();
+    thread_pool_destroy(g_server.pool);
+    g_server.pool = NULL;
+    for (int i = 0; i < reactor_count; ++i)
+    {
+      close_reactor(&g_server.reactors[i]);
+    }
     curl_global_cleanup();
     return (-1);
   }
@@ -148,8 +287,35 @@ init_server(int port, const char *gemini_api_key)
   printf("[INFO] - Port: %d\n", port);
   printf("[INFO] - Max clients: %d\n", MAX_CLIENTS);
   printf("[INFO] - Thread pool size: %d\n", THREAD_POOL_INITIAL_SIZE);
+  printf("[INFO] - Connection mode: %s\n", keep_alive ? "keep-alive" : "stateless");
+  printf("[INFO] - Reactors: %d\n", reactor_count);
+  printf("[INFO] - Upstream engines: %d\n", upstream_count);
+  printf("[INFO] - API keys: %d", key_count);
+  if (requests_per_min > 0 || tokens_per_min > 0)
+  {
+    printf(" (quota per key: %ld requests/min, %ld tokens/min)", requests_per_min, tokens_per_min);
+  }
+  printf("\n");
+  if (http2_streams > 0)
+  {
+    printf("[INFO] - Upstream protocol: HTTP/2 (%d streams per connection)\n", http2_streams);
+  }
+  else
+  {
+    printf("[INFO] - Upstream protocol: HTTP/1.1\n");
+  }
+  if (hedge_percentile > 0)
+  {
+    printf("[INFO] - Hedged AI calls: after p%d latency\n", hedge_percentile);
+  }
+#ifdef USE_IO_URING
+  printf("[INFO] - I/O backend: io_uring\n");
+#else
+  printf("[INFO] - I/O backend: epoll\n");
+#endif
+  printf("[INFO] - Response cache: %d entries, %ds TTL\n", RESPONSE_CACHE_CAPACITY, RESPONSE_CACHE_TTL_SEC);
   printf("[INFO] - Supported languages: ALL\n");
-  printf("[INFO] - AI Provider: Google Gemini\n");
+  printf("[INFO] - AI Provider: Google Gemini (%s)\n", gemini_api_base);
 #endif
 
   return (0);
@@ -168,21 +334,31 @@ cleanup_server(void)
   // Stop accepting new work
   g_server.running = 0;
 
+  // Finish outstanding AI calls first: their completions still reply to clients
+  upstream_shutdown();
+
   // Destroy thread pool (waits for all threads to finish)
   if (g_server.pool)
   {
     thread_pool_destroy(g_server.pool);
   }
 
-  // Close server sockets
-  if (g_server.epoll_fd != -1)
+  // No completion can store responses anymore
+  response_cache_destroy();
+  prompt_templates_destroy();
+
+  // Close remaining client connections
+  for (int fd = 0; fd < MAX_CLIENTS; ++fd)
   {
-    close(g_server.epoll_fd);
+    remove_client(fd);
+    pthread_mutex_destroy(&g_server.connections[fd].lock);
+    pthread_mutex_destroy(&g_server.connections[fd].write_lock);
   }
 
-  if (g_server.server_fd != -1)
+  // Close server sockets
+  for (int i = 0; i < g_server.reactor_count; ++i)
   {
-    close(g_server.server_fd);
+    close_reactor(&g_server.reactors[i]);
   }
 
   // Clean up cURL
@@ -193,50 +369,136 @@ cleanup_server(void)
 #endif
 }
 
+/**
+ * @brief Wait for and dispatch one batch of events on a reactor
+ * @param reactor Reactor to poll
+ * @return 0 on success, -1 on fatal epoll error
+ */
+static int
+reactor_poll(reactor_t *reactor)
+{
+#ifdef USE_IO_URING
+  return uring_reactor_poll(reactor);
+#else
+  struct epoll_event events[MAX_EVENTS];
+
+  int nfds = epoll_wait(reactor->epoll_fd, events, MAX_EVENTS, 1000);
+
+  if (nfds == -1)
+  {
+    if (errno == EINTR)
+      return (0);
+    perror("epoll_wait");
+    return (-1);
+  }
+
+  for (int i = 0; i < nfds; ++i)
+  {
+    int fd = events[i].data.fd;
+    if (fd == reactor->listen_fd)
+    {
+      accept_new_connections(reactor);
+    }
+    else
+    {
+      handle_client_data(fd, events[i].events);
+    }
+  }
+
+  return (0);
+#endif
+}
+
+/**
+ * @brief Event loop of an additional reactor thread
+ * @param arg Pointer to the reactor_t to run
+ */
+static void *
+reactor_thread(void *arg)
+{
+  reactor_t *reactor = (reactor_t *)arg;
+
+#if SHOW_DEBUG
+  printf("[DEBUG] Reactor %d started\n", reactor->id);
+#endif
+  while (g_server.running)
+  {
+    if (reactor_poll(reactor) < 0)
+    {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
 /**
  * @brief Main server event loop
- * Uses epoll to efficiently handle multiple client connections
+ * Uses epoll to efficiently handle multiple client connections. Reactor 0
+ * runs on the main thread, which also sweeps idle connections and prints
+ * statistics; additional reactors run on their own threads
  */
 static void run_server(void)
 {
-  struct epoll_event events[MAX_EVENTS];
   time_t last_stats_time = time(NULL);
+  time_t last_sweep_time = last_stats_time;
+
+  // Start the additional reactors
+  int started = 1;
+  for (; started < g_server.reactor_count; ++started)
+  {
+    reactor_t *reactor = &g_server.reactors[started];
+    if (pthread_create(&reactor->thread, NULL, reactor_thread, reactor) != 0)
+    {
+#if SHOW_ERROR
+      printf("[ERROR] Failed to start reactor %d\n", started);
+#endif
+      break;
+    }
+  }
 
 #if SHOW_INFO
-  printf("[INFO] Server started, waiting for connections...\n");
+  printf("[INFO] Server started with %d reactors, waiting for connections...\n", started);
   printf("[INFO] Press Ctrl+C to shutdown gracefully\n");
 #endif
 
   // Main event loop
   while (g_server.running)
   {
-    int nfds = epoll_wait(g_server.epoll_fd, events, MAX_EVENTS, 1000);
-
-    if (nfds == -1)
+    if (reactor_poll(&g_server.reactors[0]) < 0)
     {
-      if (errno == EINTR)
-        continue;
-      perror("epoll_wait");
       break;
     }
 
-    for (int i = 0; i < nfds; ++i)
+    // Evict idle connections
+    time_t now = time(NULL);
+    if (now - last_sweep_time >= IDLE_SWEEP_INTERVAL_SEC)
     {
-      int fd = events[i].data.fd;
-      if (fd == g_server.server_fd)
-      {
-        accept_new_connection();
-      }
+      evict_idle_connections();
+      last_sweep_time = now;
     }
 
     // Print statistics every 30 seconds
-    time_t now = time(NULL);
     if (now - last_stats_time >= 30)
     {
       thread_pool_print_stats(g_server.pool);
+      upstream_print_stats();
+      response_cache_print_stats();
+      single_flight_print_stats();
+      prompt_print_stats();
+      circuit_breaker_print_stats();
+      api_keys_print_stats();
+      conversation_print_stats();
       last_stats_time = now;
     }
   }
+
+  // Wait for the other reactors to notice the shutdown
+  g_server.running = 0;
+  for (int i = 1; i < started; ++i)
+  {
+    pthread_join(g_server.reactors[i].thread, NULL);
+  }
 #if SHOW_INFO
   printf("[INFO] Server event loop terminated\n");
 #endif
@@ -257,7 +519,36 @@ print_usage(const char *program_name)
   printf("  Google Gemini API key (required)\n\n");
   printf("Optional Options:\n");
   printf("  -p PORT           Server port (default: %d)\n", DEFAULT_PORT);
+  printf("  -k                Keep client connections open across requests\n");
+  printf("                    (idle connections closed after %ds)\n", CLIENT_IDLE_TIMEOUT_SEC);
+  printf("  -r COUNT          Event loop threads, each with its own SO_REUSEPORT\n");
+  printf("                    listener (default: %d, max: %d)\n", REACTOR_COUNT, MAX_REACTORS);
+  printf("  -u COUNT          Threads driving AI calls asynchronously\n");
+  printf("                    (default: %d, max: %d)\n", UPSTREAM_ENGINE_COUNT, UPSTREAM_MAX_ENGINES);
+  printf("  -m STREAMS        Multiplex AI calls over HTTP/2, up to STREAMS per\n");
+  printf("                    connection (default: %d = HTTP/1.1, max: %d)\n",
+         UPSTREAM_HTTP2_STREAMS, UPSTREAM_MAX_HTTP2_STREAMS);
+  printf("  -q RPM[:TPM]      Quota of each API key in requests (and tokens) per\n");
+  printf("                    minute; calls wait or are refused when every key\n");
+  printf("                    is exhausted (default: %d:%d, 0 = unlimited)\n",
+         API_KEY_REQUESTS_PER_MIN, API_KEY_TOKENS_PER_MIN);
+  printf("  -H PERCENTILE     Send a second (hedged) AI request when the first is\n");
+  printf("                    slower than this percentile of recent calls\n");
+  printf("                    (default: %d = off, max: 99)\n", UPSTREAM_HEDGE_PERCENTILE);
+  printf("  -c TOKENS         Send only the newest conversation turns that fit in\n");
+  printf("                    about TOKENS tokens (default: %d, 0 = unlimited)\n", CONVERSATION_MAX_TOKENS);
+  printf("  -s SCHEDULER      How the thread pool hands requests to its workers:\n");
+  printf("                    fifo (one shared queue) or steal (a queue per\n");
+  printf("                    worker, idle workers steal) (default: %s)\n", THREAD_POOL_SCHEDULER);
+  printf("  -a POLICY         How the thread pool sizes itself: latency (spare\n");
+  printf("                    workers, short queue waits), balanced or\n");
+  printf("                    throughput (busy workers) (default: %s)\n", THREAD_POOL_POLICY);
   printf("  -h                Show this help message\n\n");
+  printf("Environment:\n");
+  printf("  GEMINI_API_KEY       Google Gemini API key (required); several keys can be\n");
+  printf("                       given comma separated (max: %d)\n", API_KEY_MAX_COUNT);
+  printf("  GEMINI_API_BASE_URL  Model endpoint (default: %s)\n", GEMINI_API_BASE_URL);
+  printf("  AI_BACKEND           Provider of the AI calls (default: gemini)\n\n");
   printf("Supported Languages: EVERITHING\n\n");
   printf("Example:\n");
   printf("  %s -p 8080\n\n", program_name);
@@ -276,7 +567,28 @@ print_usage(const char *program_name)
 int main(int argc, char *argv[])
 {
   int port = DEFAULT_PORT;
-  char gemini_api_key[256] = {0};
+  int keep_alive = CLIENT_KEEP_ALIVE;
+  int reactor_count = REACTOR_COUNT;
+  int upstream_count = UPSTREAM_ENGINE_COUNT;
+  int http2_streams = UPSTREAM_HTTP2_STREAMS;
+  int hedge_percentile = UPSTREAM_HEDGE_PERCENTILE;
+  long conversation_max_tokens = CONVERSATION_MAX_TOKENS;
+  const char *scheduler = THREAD_POOL_SCHEDULER;
+  const char *policy = THREAD_POOL_POLICY;
+  char gemini_api_key[API_KEY_MAX_COUNT * API_KEY_MAX_LENGTH] = {0};
+  long requests_per_min = API_KEY_REQUESTS_PER_MIN;
+  long tokens_per_min = API_KEY_TOKENS_PER_MIN;
+  const char *gemini_api_base = NULL;
+
+  // Provider of the AI calls
+  if (ai_client_init(getenv("AI_BACKEND")) < 0)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Unknown AI backend: %s\n", getenv("AI_BACKEND"));
+#endif
+    return (EXIT_FAILURE);
+  }
+  gemini_api_base = ai_client_backend()->default_base;
 
   // Get API key from environment
   char *env_key = getenv("GEMINI_API_KEY");
@@ -285,6 +597,13 @@ int main(int argc, char *argv[])
     safe_strncpy(gemini_api_key, env_key, sizeof(gemini_api_key));
   }
 
+  // Optional endpoint override (e.g. a local stand-in for offline testing)
+  char *env_base = getenv("GEMINI_API_BASE_URL");
+  if (env_base && env_base[0] != '\0')
+  {
+    gemini_api_base = env_base;
+  }
+
   printf("Robot Dialog Server - LSO Project\n");
   printf("========================================\n");
 
@@ -303,6 +622,96 @@ int main(int argc, char *argv[])
         return (EXIT_FAILURE);
       }
     }
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+    {
+      // Number of reactors
+      reactor_count = atoi(argv[++i]);
+      if (reactor_count < 1 || reactor_count > MAX_REACTORS)
+      {
+#if SHOW_ERROR
+        printf("[ERROR] Invalid reactor count: %s (must be 1-%d)\n", argv[i], MAX_REACTORS);
+#endif
+        return (EXIT_FAILURE);
+      }
+    }
+    else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc)
+    {
+      // Number of upstream engines
+      upstream_count = atoi(argv[++i]);
+      if (upstream_count < 1 || upstream_count > UPSTREAM_MAX_ENGINES)
+      {
+#if SHOW_ERROR
+        printf("[ERROR] Invalid upstream count: %s (must be 1-%d)\n", argv[i], UPSTREAM_MAX_ENGINES);
+#endif
+        return (EXIT_FAILURE);
+      }
+    }
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+    {
+      // HTTP/2 multiplexing toward the AI provider
+      http2_streams = atoi(argv[++i]);
+      if (http2_streams < 0 || http2_streams > UPSTREAM_MAX_HTTP2_STREAMS)
+      {
+#if SHOW_ERROR
+        printf("[ERROR] Invalid stream count: %s (must be 0-%d)\n", argv[i], UPSTREAM_MAX_HTTP2_STREAMS);
+#endif
+        return (EXIT_FAILURE);
+      }
+    }
+    else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc)
+    {
+      // Hedged AI calls against tail latency
+      hedge_percentile = atoi(argv[++i]);
+      if (hedge_percentile < 0 || hedge_percentile > 99)
+      {
+#if SHOW_ERROR
+        printf("[ERROR] Invalid hedge percentile: %s (must be 0-99)\n", argv[i]);
+#endif
+        return (EXIT_FAILURE);
+      }
+    }
+    else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+    {
+      // Local quota of each API key
+      char *end = NULL;
+      requests_per_min = strtol(argv[++i], &end, 10);
+      tokens_per_min = (*end == ':') ? strtol(end + 1, &end, 10) : 0;
+      if (*end != '\0' || requests_per_min < 0 || tokens_per_min < 0)
+      {
+#if SHOW_ERROR
+        printf("[ERROR] Invalid quota: %s (must be RPM or RPM:TPM)\n", argv[i]);
+#endif
+        return (EXIT_FAILURE);
+      }
+    }
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+    {
+      // Token budget of the conversation history
+      char *end = NULL;
+      conversation_max_tokens = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || end == argv[i] || conversation_max_tokens < 0)
+      {
+#if SHOW_ERROR
+        printf("[ERROR] Invalid token budget: %s (must be >= 0)\n", argv[i]);
+#endif
+        return (EXIT_FAILURE);
+      }
+    }
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+    {
+      // Task scheduler of the thread pool
+      scheduler = argv[++i];
+    }
+    else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+    {
+      // Autoscaling policy of the thread pool
+      policy = argv[++i];
+    }
+    else if (strcmp(argv[i], "-k") == 0)
+    {
+      // Keep-alive connection mode
+      keep_alive = 1;
+    }
     else if (strcmp(argv[i], "-h") == 0)
     {
       // Help
@@ -330,13 +739,30 @@ int main(int argc, char *argv[])
     return (EXIT_FAILURE);
   }
 
+  if (thread_pool_set_scheduler(scheduler) < 0)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Invalid scheduler: %s (must be fifo or steal)\n", scheduler);
+#endif
+    return (EXIT_FAILURE);
+  }
+
+  if (thread_pool_set_policy(policy) < 0)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Invalid autoscaling policy: %s (must be latency, balanced or throughput)\n", policy);
+#endif
+    return (EXIT_FAILURE);
+  }
+
   // Setup signal handlers for graceful shutdown
   signal(SIGINT, signal_handler);  // Ctrl+C
   signal(SIGTERM, signal_handler); // Termination request
   signal(SIGPIPE, SIG_IGN);        // Ignore broken pipe signals
 
   // Initialize and run server
-  if (init_server(port, gemini_api_key) < 0)
+  if (init_server(port, gemini_api_key, requests_per_min, tokens_per_min, gemini_api_base, keep_alive,
+                  reactor_count, upstream_count, http2_streams, hedge_percentile, conversation_max_tokens) < 0)
   {
 #if SHOW_ERROR
     printf("[ERROR] Failed to initialize server\n");
@@ -1,81 +1,574 @@
 /*********************************************************************************
  * ===== FILE: network.c =====
- * Network management - PURE STATELESS IMPLEMENTATION
- * Each connection handles exactly one request then closes automatically
+ * Network management - STATELESS and KEEP-ALIVE connection modes
+ * Client sockets are non-blocking and monitored by epoll: the event loop
+ * buffers incoming bytes and only hands complete frames to the thread pool
+ * Stateless: each connection handles exactly one request then closes
+ * Keep-alive: connections are reused across requests until idle
  *********************************************************************************/
 
 #include "thread_pool.h"
 #include "network.h"
-#include "gemini_ai.h"
+#include "ai_client.h"
+#include "conversation.h"
 #include "protocol.h"
+#include "response_cache.h"
+#include "single_flight.h"
 #include "utils.h"
+#include "uring_backend.h"
+#include <poll.h>
+#include <stddef.h>
 
 // Global server context - accessible to all network functions
 server_context_t g_server;
 
 /**
- * @brief Process a single client request and immediately close connection
- * PURE STATELESS: Each TCP connection handles exactly one request
- * @param client_fd Client socket file descriptor
+ * @brief Request answered asynchronously by an upstream completion
+ * Owns the client request until the reply is sent; dialog points into it.
+ * Upstream threads never write to the client: the response is handed to a
+ * thread pool worker, and streamed text is buffered in the outbox and sent
+ * by one
+ */
+typedef struct
+{
+  client_request_t *request; // Request being answered (framing and request id)
+  client_message_t dialog;   // Parsed dialog fields
+  single_flight_t *flight;   // Flight this request leads (NULL if none)
+  flight_waiter_t waiter;    // Link while waiting on another request's call
+  ai_response_t *response;   // Response to send, until a worker delivers it
+
+  // Streamed replies
+  pthread_mutex_t lock;      // Guards the fields below
+  char *outbox;              // Text received and not sent yet
+  size_t outbox_length;      // Valid bytes in outbox
+  size_t outbox_capacity;    // Allocated size of outbox
+  int flushing;              // 1 while a worker task owns the sending
+  int send_failed;           // 1 once a send to the client failed
+  int finished;              // 1 once the stream is over
+  int result;                // Outcome of the stream (0 completed, -1 failed)
+  int chunks;                // Fragments the stream delivered
+} async_reply_t;
+
+static void finish_request(int fd, int keep);
+
+/**
+ * @brief Send the reply of an asynchronous request and complete it
+ * Runs on the worker that sent the reply, or on the thread that could not
+ * hand it to a worker (sent is then -1 and the connection is closed)
+ * @param reply Reply context (freed here, with its request)
+ * @param sent 0 if the reply was sent, -1 on error
  */
 static void
-process_single_request_and_close(int client_fd)
+complete_async_reply(async_reply_t *reply, int sent)
 {
-#if SHOW_INFO
-  printf("[INFO] Processing stateless request on fd %d\n", client_fd);
-#endif
+  int client_fd = reply->request->client_fd;
+
+  pthread_mutex_destroy(&reply->lock);
+  free(reply->outbox);
+  free(reply->request);
+  free(reply);
+  finish_request(client_fd, sent == 0);
+}
 
-  // Set socket timeouts to prevent indefinite blocking
-  struct timeval timeout;
-  timeout.tv_sec = CLIENT_SOCKET_TIMEOUT_SEC;
-  timeout.tv_usec = 0;
+/**
+ * @brief Send the answer of an AI dialog request and complete it
+ * Falls back to a test response when the AI call failed, like the
+ * synchronous MSG_AI_DIALOG_REQUEST -> MSG_TEST_DIALOG_REQUEST path
+ * @param reply Request to answer
+ * @param response AI response, or NULL when the circuit breaker refused the call
+ */
+static void
+answer_dialog(async_reply_t *reply, const ai_response_t *response)
+{
+  int client_fd = reply->request->client_fd;
+  const message_t *msg = &reply->request->msg;
+  int sent;
 
-  if (setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+  if (!response)
+  {
+    sent = send_reply(client_fd, msg, MSG_TEST_DIALOG_RESPONSE, fallback_response(reply->dialog.language));
+  }
+  else if (response->success)
+  {
+    // Send response with behavioral cues
+    sent = send_reply(client_fd, msg, MSG_AI_DIALOG_RESPONSE, response->response);
+  }
+  else
   {
+#if SHOW_ERROR
+    printf("[ERROR] AI response failed for fd %d\n", client_fd);
+#endif
+    sent = send_reply(client_fd, msg, MSG_TEST_DIALOG_RESPONSE,
+                      test_response(reply->dialog.language));
+  }
 #if SHOW_WARNING
-    printf("[WARNING] Failed to set receive timeout for fd %d\n", client_fd);
+  if (sent != 0)
+  {
+    printf("[WARNING] Failed to send response to fd %d\n", client_fd);
+  }
 #endif
+  complete_async_reply(reply, sent);
+}
+
+/**
+ * @brief Send the response held by a reply
+ * Thread pool task (see schedule_answer)
+ */
+static void
+answer_dialog_task(void *arg)
+{
+  async_reply_t *reply = (async_reply_t *)arg;
+  ai_response_t *response = reply->response;
+
+  reply->response = NULL;
+  answer_dialog(reply, response);
+  free(response);
+}
+
+/**
+ * @brief Have a worker send a response to a request
+ * The connection is closed instead when no worker can take it
+ * @param reply Request to answer
+ * @param response AI response (copied), or NULL when the circuit breaker refused the call
+ */
+static void
+schedule_answer(async_reply_t *reply, const ai_response_t *response)
+{
+  reply->response = NULL;
+  if (response)
+  {
+    reply->response = malloc(sizeof(ai_response_t));
+    if (!reply->response)
+    {
+      complete_async_reply(reply, -1);
+      return;
+    }
+    *reply->response = *response;
   }
 
-  if (setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
+  if (thread_pool_add_task(g_server.pool, answer_dialog_task, reply) != 0)
   {
-#if SHOW_WARNING
-    printf("[WARNING] Failed to set send timeout for fd %d\n", client_fd);
+#if SHOW_ERROR
+    printf("[ERROR] Cannot schedule the AI response for fd %d\n", reply->request->client_fd);
 #endif
+    free(reply->response);
+    reply->response = NULL;
+    complete_async_reply(reply, -1);
   }
+}
 
-  // Receive exactly one message
-  message_t msg;
-  if (receive_message(client_fd, &msg) < 0)
+/**
+ * @brief End a flight and answer the requests that joined it
+ * Each request is answered by its own task, so a client that reads
+ * slowly does not delay the others
+ */
+static void
+answer_waiters(single_flight_t *flight, const ai_response_t *response)
+{
+  flight_waiter_t *waiter = single_flight_finish(flight);
+  while (waiter)
+  {
+    flight_waiter_t *next = waiter->next;
+    schedule_answer((async_reply_t *)((char *)waiter - offsetof(async_reply_t, waiter)), response);
+    waiter = next;
+  }
+}
+
+/**
+ * @brief Deliver the response of an AI dialog request
+ * Thread pool task: stores the response in the cache, hands it to the
+ * requests that joined its flight and sends it to the request
+ * @param arg Reply holding the response (see ai_response_done)
+ */
+static void
+deliver_response_task(void *arg)
+{
+  async_reply_t *reply = (async_reply_t *)arg;
+  ai_response_t *response = reply->response;
+
+  // Cache first: a request arriving after the flight ends must hit
+  if (response->success && !(reply->request->msg.flags & PROTOCOL_V2_FLAG_NO_CACHE))
+  {
+    response_cache_store(&reply->dialog, response->response);
+  }
+  if (reply->flight)
+  {
+    answer_waiters(reply->flight, response);
+  }
+  reply->response = NULL;
+  answer_dialog(reply, response);
+  free(response);
+}
+
+/**
+ * @brief Upstream completion of an AI dialog request
+ * Runs on an upstream thread, so the response is only handed to a worker
+ */
+static void
+ai_response_done(const ai_response_t *response, void *context)
+{
+  async_reply_t *reply = (async_reply_t *)context;
+
+  reply->response = malloc(sizeof(ai_response_t));
+  if (reply->response)
+  {
+    *reply->response = *response;
+    if (thread_pool_add_task(g_server.pool, deliver_response_task, reply) == 0)
+    {
+      return;
+    }
+    free(reply->response);
+    reply->response = NULL;
+  }
+
+#if SHOW_ERROR
+  printf("[ERROR] Cannot schedule the AI response for fd %d\n", reply->request->client_fd);
+#endif
+  // No worker will answer: drop the connection instead of writing here
+  if (reply->flight)
+  {
+    answer_waiters(reply->flight, response);
+  }
+  complete_async_reply(reply, -1);
+}
+
+/**
+ * @brief Send the end of a stream whose text was all sent, and complete it
+ * Runs on a thread pool worker
+ */
+static void
+end_stream(async_reply_t *reply)
+{
+  int client_fd = reply->request->client_fd;
+  const message_t *msg = &reply->request->msg;
+  int sent = reply->send_failed ? -1 : 0;
+
+  if (sent == 0 && reply->result != 0 && reply->chunks == 0)
+  {
+    // Nothing reached the client yet: answer like the non-streaming path
+    sent = send_reply(client_fd, msg, MSG_AI_STREAM_CHUNK, test_response(reply->dialog.language));
+  }
+  else if (sent == 0 && reply->result != 0)
   {
+    // Partial answer already sent: tell the client it is incomplete
+    complete_async_reply(reply, send_reply(client_fd, msg, MSG_ERROR, "AI stream interrupted"));
+    return;
+  }
+
+  if (sent == 0)
+  {
+    sent = send_reply(client_fd, msg, MSG_AI_STREAM_END, NULL);
+  }
 #if SHOW_WARNING
-    printf("[WARNING] Failed to receive message from fd %d\n", client_fd);
+  if (sent != 0)
+  {
+    printf("[WARNING] Failed to send stream end to fd %d\n", client_fd);
+  }
 #endif
-    close(client_fd);
+  complete_async_reply(reply, sent);
+}
+
+/**
+ * @brief Send the buffered text of a stream to the client
+ * Thread pool task: sends until the outbox is empty, then ends the stream
+ * if it is over. Fragments that arrived together go out as one chunk
+ * @param arg Reply (see schedule_flush_locked)
+ */
+static void
+flush_stream_task(void *arg)
+{
+  async_reply_t *reply = (async_reply_t *)arg;
+
+  pthread_mutex_lock(&reply->lock);
+  while (reply->outbox_length > 0 && !reply->send_failed)
+  {
+    // Take the outbox: the upstream thread starts a new one meanwhile
+    char *text = reply->outbox;
+    reply->outbox = NULL;
+    reply->outbox_length = 0;
+    reply->outbox_capacity = 0;
+    pthread_mutex_unlock(&reply->lock);
+
+    int sent = send_reply(reply->request->client_fd, &reply->request->msg, MSG_AI_STREAM_CHUNK, text);
+    free(text);
+
+    pthread_mutex_lock(&reply->lock);
+    if (sent != 0)
+    {
+      reply->send_failed = 1;
+    }
+  }
+
+  if (!reply->finished)
+  {
+    reply->flushing = 0;
+    pthread_mutex_unlock(&reply->lock);
+    return;
+  }
+  pthread_mutex_unlock(&reply->lock);
+
+  // The upstream call is over and this task owns the reply
+  end_stream(reply);
+}
+
+/**
+ * @brief Make sure a worker sends the outbox
+ * Caller holds reply->lock
+ * @return 0 on success, -1 if the thread pool refused the task
+ */
+static int
+schedule_flush_locked(async_reply_t *reply)
+{
+  if (reply->flushing)
+  {
+    return (0);
+  }
+  if (thread_pool_add_task(g_server.pool, flush_stream_task, reply) < 0)
+  {
+    return (-1);
+  }
+  reply->flushing = 1;
+  return (0);
+}
+
+/**
+ * @brief Queue one streamed text fragment for the client
+ * Runs on an upstream thread, so it never writes to the socket
+ * @return 0 to continue, -1 to abort the stream (client gone)
+ */
+static int
+forward_stream_chunk(const char *text, void *context)
+{
+  async_reply_t *reply = (async_reply_t *)context;
+  size_t length = strlen(text);
+  int result = -1;
+
+  pthread_mutex_lock(&reply->lock);
+  if (!reply->send_failed)
+  {
+    if (reply->outbox_length + length + 1 > reply->outbox_capacity)
+    {
+      size_t capacity = reply->outbox_capacity > 0 ? reply->outbox_capacity : 1024;
+      while (reply->outbox_length + length + 1 > capacity)
+      {
+        capacity *= 2;
+      }
+      char *outbox = realloc(reply->outbox, capacity);
+      if (outbox)
+      {
+        reply->outbox = outbox;
+        reply->outbox_capacity = capacity;
+      }
+    }
+    if (reply->outbox_length + length + 1 <= reply->outbox_capacity)
+    {
+      memcpy(reply->outbox + reply->outbox_length, text, length + 1);
+      reply->outbox_length += length;
+      result = schedule_flush_locked(reply);
+    }
+    if (result != 0)
+    {
+      reply->send_failed = 1;
+    }
+  }
+  pthread_mutex_unlock(&reply->lock);
+  return (result);
+}
+
+/**
+ * @brief Tell the upstream engine whether a stream may deliver more text
+ * The transfer is paused while AI_STREAM_BUFFER_MAX bytes wait for a slow client
+ */
+static int
+stream_ready(void *context)
+{
+  async_reply_t *reply = (async_reply_t *)context;
+
+  pthread_mutex_lock(&reply->lock);
+  int ready = reply->outbox_length < AI_STREAM_BUFFER_MAX || reply->send_failed;
+  pthread_mutex_unlock(&reply->lock);
+  return (ready);
+}
+
+/**
+ * @brief Upstream completion of a streamed AI request
+ * The end of the stream is sent by the worker flushing the outbox
+ */
+static void
+stream_done(int result, int chunks, void *context)
+{
+  async_reply_t *reply = (async_reply_t *)context;
+
+  pthread_mutex_lock(&reply->lock);
+  reply->finished = 1;
+  reply->result = result;
+  reply->chunks = chunks;
+  if (schedule_flush_locked(reply) == 0)
+  {
+    pthread_mutex_unlock(&reply->lock);
     return;
   }
+  pthread_mutex_unlock(&reply->lock);
+
+#if SHOW_ERROR
+  printf("[ERROR] Cannot schedule the end of the stream for fd %d\n", reply->request->client_fd);
+#endif
+  // No worker will send anything: drop the connection
+  complete_async_reply(reply, -1);
+}
+
+/**
+ * @brief Answer an AI request with a cached response
+ * Streamed requests get the whole answer as a single chunk
+ * @return 0 if the reply was sent, -1 on error
+ */
+static int
+send_cached_reply(int client_fd, const message_t *msg, const char *cached)
+{
+#if SHOW_INFO
+  printf("[INFO] Cached AI response for fd %d\n", client_fd);
+#endif
+  if (msg->type == MSG_AI_STREAM_REQUEST)
+  {
+    if (send_reply(client_fd, msg, MSG_AI_STREAM_CHUNK, cached) < 0)
+    {
+      return (-1);
+    }
+    return (send_reply(client_fd, msg, MSG_AI_STREAM_END, NULL));
+  }
+  return (send_reply(client_fd, msg, MSG_AI_DIALOG_RESPONSE, cached));
+}
+
+/**
+ * @brief Answer an AI request with the localized fallback
+ * Used while the circuit breaker refuses AI calls; streamed requests get
+ * the fallback as a single chunk
+ * @return 0 if the reply was sent, -1 on error
+ */
+static int
+send_fallback_reply(int client_fd, const message_t *msg, const char *language)
+{
+#if SHOW_INFO
+  printf("[INFO] AI unavailable, fallback response for fd %d\n", client_fd);
+#endif
+  if (msg->type == MSG_AI_STREAM_REQUEST)
+  {
+    if (send_reply(client_fd, msg, MSG_AI_STREAM_CHUNK, fallback_response(language)) < 0)
+    {
+      return (-1);
+    }
+    return (send_reply(client_fd, msg, MSG_AI_STREAM_END, NULL));
+  }
+  return (send_reply(client_fd, msg, MSG_TEST_DIALOG_RESPONSE, fallback_response(language)));
+}
+
+/**
+ * @brief Start an AI call answered by an upstream completion
+ * @param request Request being answered (owned by the reply on success)
+ * @param dialog Parsed dialog fields
+ * @return 0 if the call was started, -1 or AI_CALL_REJECTED if the caller
+ *         must answer itself
+ */
+static int
+start_async_reply(client_request_t *request, const client_message_t *dialog)
+{
+  async_reply_t *reply = malloc(sizeof(async_reply_t));
+  if (!reply)
+  {
+    return (-1);
+  }
+  reply->request = request;
+  reply->dialog = *dialog;
+  reply->flight = NULL;
+  reply->response = NULL;
+  pthread_mutex_init(&reply->lock, NULL);
+  reply->outbox = NULL;
+  reply->outbox_length = 0;
+  reply->outbox_capacity = 0;
+  reply->flushing = 0;
+  reply->send_failed = 0;
+  reply->finished = 0;
+  reply->result = 0;
+  reply->chunks = 0;
+
+  // Identical dialog requests share one upstream call
+  if (request->msg.type == MSG_AI_DIALOG_REQUEST && !(request->msg.flags & PROTOCOL_V2_FLAG_NO_CACHE))
+  {
+    request_key_t key;
+    request_key_init(&key, &reply->dialog);
+    if (single_flight_join(&key, &reply->waiter, &reply->flight) == 1)
+    {
+      return (0); // Answered when the leader's call completes
+    }
+  }
+
+  int started;
+  if (request->msg.type == MSG_AI_STREAM_REQUEST)
+  {
+    started = stream_ai_response(g_server.gemini_api_base,
+                                 dialog->personality, dialog->language, dialog->conversation,
+                                 forward_stream_chunk, stream_ready, stream_done, reply);
+  }
+  else
+  {
+    started = generate_ai_response(g_server.gemini_api_base,
+                                   dialog->personality, dialog->language, dialog->conversation,
+                                   ai_response_done, reply);
+  }
+
+  if (started < 0)
+  {
+    if (reply->flight)
+    {
+      // Requests that joined meanwhile get the fallback answer too
+      ai_response_t failed = {.success = 0};
+      answer_waiters(reply->flight, started == AI_CALL_REJECTED ? NULL : &failed);
+    }
+    pthread_mutex_destroy(&reply->lock);
+    free(reply);
+    return (started);
+  }
+  return (0);
+}
+
+/**
+ * @brief Process one received message and send the reply
+ * Shared by the stateless and keep-alive connection modes. AI requests are
+ * handed to the upstream engine and answered by its completion callback,
+ * so the worker is free again without waiting for Gemini
+ * @param client_request Request received from the client
+ * @return 0 if the connection may be reused, -1 if it must be closed,
+ *         1 if the request is answered asynchronously (the completion owns it)
+ */
+static int
+process_request(client_request_t *client_request)
+{
+  int client_fd = client_request->client_fd;
+  message_t *msg = &client_request->msg;
+
+  // Parsed at most once: the payload is split in place
+  client_message_t request = {0};
 
 #if SHOW_INFO
-  printf("[INFO] Received message type %d from fd %d\n", msg.type, client_fd);
+  printf("[INFO] Received message type %d from fd %d\n", msg->type, client_fd);
 #endif
   // Process the message based on type
-  switch (msg.type)
+  switch (msg->type)
   {
   case MSG_AI_DIALOG_REQUEST:
+  case MSG_AI_STREAM_REQUEST:
   {
 #if SHOW_INFO
     printf("[INFO] Processing MSG_REQUEST from fd %d\n", client_fd);
 #endif
     // Parse the complete stateless request
-    client_message_t request;
-    if (parse_client_dialog_message(msg.data, &request) != 0)
+    if (parse_client_dialog_message(msg, &request) != 0)
     {
 #if SHOW_ERROR
       printf("[ERROR] Failed to parse client message from fd %d\n", client_fd);
 #endif
-      send_message(client_fd, MSG_ERROR, "Invalid request format");
-      close(client_fd);
-      return;
+      send_reply(client_fd, msg, MSG_ERROR, "Invalid request format");
+      return (-1);
     }
 
     // Validate required components
@@ -86,66 +579,73 @@ process_single_request_and_close(int client_fd)
 #if SHOW_ERROR
       printf("[ERROR] Missing required fields from fd %d\n", client_fd);
 #endif
-      send_message(client_fd, MSG_ERROR, "Missing required fields");
-      close(client_fd);
-      return;
+      send_reply(client_fd, msg, MSG_ERROR, "Missing required fields");
+      return (-1);
+    }
+
+    // Only the newest turns within the token budget go upstream (and into the cache key)
+    if (conversation_trim(request.conversation, g_server.conversation_max_tokens, &request.conversation) < 0)
+    {
+#if SHOW_ERROR
+      printf("[ERROR] Malformed conversation from fd %d\n", client_fd);
+#endif
+      send_reply(client_fd, msg, MSG_ERROR, "Invalid conversation format");
+      return (-1);
     }
 #if SHOW_INFO
     printf("[INFO] AI request for fd %d: personality=%.30s..., language=%s\n",
            client_fd, request.personality, request.language);
 #endif
-    // Generate AI response - COMPLETELY STATELESS
-    ai_response_t ai_response;
-    int ai_result = generate_ai_response(g_server.gemini_api_key,
-                                         request.personality,
-                                         request.language,
-                                         request.conversation,
-                                         &ai_response);
-
-    if (ai_result == 0 && ai_response.success)
+    // Identical requests are answered from the cache unless the client opts out
+    if (!(msg->flags & PROTOCOL_V2_FLAG_NO_CACHE))
     {
-      // Send response with behavioral cues
-      char response_ai[MAX_AI_RESPONSE_SIZE];
-      snprintf(response_ai, sizeof(response_ai), "%s", ai_response.response);
-
-      if (send_message(client_fd, MSG_AI_DIALOG_RESPONSE, response_ai) == 0)
-      {
-#if SHOW_INFO
-        printf("[INFO] Successfully processed ai request for fd %d\n", client_fd);
-#endif
-      }
-      else
+      char cached[MAX_AI_RESPONSE_SIZE];
+      if (response_cache_lookup(&request, cached, sizeof(cached)) == 0)
       {
-#if SHOW_WARNING
-        printf("[WARNING] Failed to send response to fd %d\n", client_fd);
-#endif
+        return (send_cached_reply(client_fd, msg, cached));
       }
-      break; // to make continue in test case
     }
-    else
+
+    // Generate AI response - COMPLETELY STATELESS
+    int started = start_async_reply(client_request, &request);
+    if (started == 0)
     {
+      return (1);
+    }
+    if (started == AI_CALL_REJECTED)
+    {
+      // Gemini is failing: answer now instead of waiting for another error
+      return (send_fallback_reply(client_fd, msg, request.language));
+    }
 #if SHOW_ERROR
-      printf("[ERROR] AI response failed for fd %d\n", client_fd);
+    printf("[ERROR] Could not start AI call for fd %d\n", client_fd);
 #endif
-      // send_message(client_fd, MSG_ERROR, "Failed to generate AI response");
+    if (msg->type == MSG_AI_STREAM_REQUEST)
+    {
+      // Answer with a one-chunk stream
+      if (send_reply(client_fd, msg, MSG_AI_STREAM_CHUNK, test_response(request.language)) < 0 ||
+          send_reply(client_fd, msg, MSG_AI_STREAM_END, NULL) < 0)
+      {
+        return (-1);
+      }
+      break;
     }
   }
+  // fall through
 
   case MSG_TEST_DIALOG_REQUEST:
   {
-    // Parse the complete stateless request
-    client_message_t request;
-    if (parse_client_dialog_message(msg.data, &request) != 0)
+    // Parse the complete stateless request (unless the AI case already did)
+    if (!request.is_valid && parse_client_dialog_message(msg, &request) != 0)
     {
 #if SHOW_ERROR
       printf("[ERROR] Failed to parse client message from fd %d\n", client_fd);
 #endif
-      send_message(client_fd, MSG_ERROR, "Invalid request format");
-      close(client_fd);
-      return;
+      send_reply(client_fd, msg, MSG_ERROR, "Invalid request format");
+      return (-1);
     }
 
-    if (send_message(client_fd, MSG_TEST_DIALOG_RESPONSE, test_response(request.language)) == 0)
+    if (send_reply(client_fd, msg, MSG_TEST_DIALOG_RESPONSE, test_response(request.language)) == 0)
     {
 #if SHOW_INFO
       printf("[INFO] Successfully processed test request for fd %d\n", client_fd);
@@ -156,6 +656,7 @@ process_single_request_and_close(int client_fd)
 #if SHOW_WARNING
       printf("[WARNING] Failed to send response to fd %d\n", client_fd);
 #endif
+      return (-1);
     }
     break;
   }
@@ -163,113 +664,936 @@ process_single_request_and_close(int client_fd)
   default:
   {
 #if SHOW_WARNING
-    printf("[WARNING] Unknown message type %d from fd %d\n", msg.type, client_fd);
+    printf("[WARNING] Unknown message type %d from fd %d\n", msg->type, client_fd);
 #endif
-    send_message(client_fd, MSG_ERROR, "Unknown message type");
+    send_reply(client_fd, msg, MSG_ERROR, "Unknown message type");
     break;
   }
   }
 
-// Close connection after processing (stateless behavior)
-#if SHOW_INFO
-  printf("[INFO] Closing connection fd %d (stateless mode)\n", client_fd);
-#endif
-  close(client_fd);
+  return (0);
 }
 
-/**
- * @brief Worker function for handling client request
- * Executed by thread pool worker
- * @param arg Pointer to client file descriptor (allocated memory)
- */
-static void
-handle_client_task(void *arg)
-{
-  int client_fd = *((int *)arg);
-  free(arg); // Free the memory allocated in accept_new_connection
-#if SHOW_DEBUG
-  printf("[DEBUG] Worker thread handling client fd %d\n", client_fd);
-#endif
-  process_single_request_and_close(client_fd);
-#if SHOW_DEBUG
-  printf("[DEBUG] Worker thread finished with client fd %d\n", client_fd);
-#endif
-}
+
+static void pause_connection_locked(int fd, connection_t *conn);
 
 /**
- * @brief Accept new connection and immediately schedule for processing
- * STATELESS: No client tracking, immediate processing via thread pool
+ * @brief Close a connection and release its slot
+ * While workers still serve requests of the connection the close is
+ * deferred: reading stops and the last finishing worker closes it, so the
+ * fd cannot be reused while replies are still being written to it
+ * Caller must hold conn->lock
+ * @param fd Client socket file descriptor
+ * @param conn Connection slot for fd
  */
-void accept_new_connection(void)
+static void
+close_connection_locked(int fd, connection_t *conn)
 {
-  struct sockaddr_in client_addr;
-  socklen_t addr_len = sizeof(client_addr);
-
-  // Accept the connection
-  int client_fd = accept(g_server.server_fd, (struct sockaddr *)&client_addr, &addr_len);
-  if (client_fd == -1)
+  if (!conn->in_use)
   {
-    if (errno != EAGAIN && errno != EWOULDBLOCK)
+    return;
+  }
+
+  if (conn->in_flight > 0)
+  {
+    conn->closing = 1;
+    pause_connection_locked(fd, conn);
+    return;
+  }
+
+  free(conn->read_buffer);
+  conn->read_buffer = NULL;
+  conn->read_len = 0;
+  free(conn->pending);
+  conn->pending = NULL;
+  conn->pending_filled = 0;
+  conn->protocol = 0;
+  conn->in_use = 0;
+  conn->closing = 0;
+  conn->peer_closed = 0;
+
+#ifdef USE_IO_URING
+  // The reactor shuts the socket down and closes it after any queued send
+  conn->registered = 0;
+  if (g_server.running)
+  {
+    uring_close_connection(conn->reactor, fd);
+  }
+  else
+  {
+    close(fd);
+  }
+#else
+  if (conn->registered)
+  {
+    epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    conn->registered = 0;
+  }
+  close(fd);
+#endif
+
+#if SHOW_DEBUG
+  printf("[DEBUG] Connection fd %d closed\n", fd);
+#endif
+}
+
+/**
+ * @brief Locate where the next received bytes belong
+ * The payload of a v2 frame being assembled is received straight into its
+ * request allocation; everything else goes to the connection read buffer
+ * Caller must hold conn->lock
+ * @param conn Connection slot
+ * @param room Output number of bytes that fit at the returned position
+ * @return Position to receive into
+ */
+static char *
+receive_target_locked(connection_t *conn, size_t *room)
+{
+  if (conn->pending && conn->pending_filled < conn->pending->msg.length)
+  {
+    *room = conn->pending->msg.length - conn->pending_filled;
+    return (conn->pending->msg.data + conn->pending_filled);
+  }
+
+  *room = BUFFER_SIZE - conn->read_len;
+  return (conn->read_buffer + conn->read_len);
+}
+
+/**
+ * @brief Account for bytes written at the position given by receive_target_locked
+ * Caller must hold conn->lock
+ */
+static void
+receive_advance_locked(connection_t *conn, size_t length)
+{
+  if (conn->pending && conn->pending_filled < conn->pending->msg.length)
+  {
+    conn->pending_filled += length;
+  }
+  else
+  {
+    conn->read_len += length;
+  }
+}
+
+/**
+ * @brief Stop monitoring a connection while its read buffer cannot accept data
+ * Level-triggered epoll would otherwise report the fd readable in a loop;
+ * with io_uring the receive is simply not re-armed
+ * Caller must hold conn->lock
+ */
+static void
+pause_connection_locked(int fd, connection_t *conn)
+{
+  if (conn->registered)
+  {
+#ifndef USE_IO_URING
+    epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#else
+    (void)fd;
+#endif
+    conn->registered = 0;
+  }
+}
+
+/**
+ * @brief Resume monitoring a paused connection
+ * Caller must hold conn->lock
+ * @return 0 on success, -1 on error
+ */
+static int
+resume_connection_locked(int fd, connection_t *conn)
+{
+  if (conn->registered || conn->peer_closed)
+  {
+    return (0);
+  }
+
+#ifdef USE_IO_URING
+  size_t room;
+  receive_target_locked(conn, &room);
+  if (uring_resume_connection(conn->reactor, fd, conn->generation, room) < 0)
+  {
+    return (-1);
+  }
+#else
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.fd = fd;
+
+  if (epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+  {
+    perror("epoll_ctl: resume client");
+    return (-1);
+  }
+#endif
+
+  conn->registered = 1;
+  return (0);
+}
+
+/**
+ * @brief Worker function for handling one client frame
+ * Executed by thread pool worker
+ * @param arg Pointer to client_request_t (taken by dispatch_next_frame_locked)
+ */
+static void handle_client_task(void *arg);
+
+/**
+ * @brief Take the next complete v1 frame out of the read buffer
+ * Caller must hold conn->lock
+ * @param fd Client socket file descriptor
+ * @param conn Connection slot for fd
+ * @param request Output request (payload copied after the structure)
+ * @return 1 if a frame was taken, 0 if none is complete, -1 on error
+ */
+static int
+next_text_frame_locked(int fd, connection_t *conn, client_request_t **request)
+{
+  *request = NULL;
+
+  // Cheap check before decoding: no newline means no complete frame yet
+  if (!memchr(conn->read_buffer, '\n', conn->read_len))
+  {
+    // A full buffer without a newline can never become a valid frame
+    if (conn->read_len == BUFFER_SIZE)
+    {
+#if SHOW_WARNING
+      printf("[WARNING] Frame from fd %d exceeds %d bytes\n", fd, BUFFER_SIZE);
+#endif
+      send_message(fd, MSG_ERROR, "Message too large");
+      return (-1);
+    }
+    return (0);
+  }
+
+  message_t msg;
+  size_t consumed = 0;
+  int result = decode_message_frame(conn->read_buffer, conn->read_len, &msg, &consumed);
+
+  // The decoded payload points into the read buffer: copy it out first
+  if (result == 1)
+  {
+    *request = malloc(sizeof(client_request_t) + msg.length + 1);
+    if (*request)
     {
-      perror("accept");
+      (*request)->msg = msg;
+      (*request)->msg.data = (char *)(*request + 1);
+      memcpy((*request)->msg.data, msg.data, msg.length);
+      (*request)->msg.data[msg.length] = '\0';
     }
-    return;
   }
 
-#if SHOW_INFO
-  printf("[INFO] New connection: fd=%d from %s:%d\n",
-         client_fd, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+  // Discard the consumed bytes (frame and blank lines)
+  if (consumed > 0)
+  {
+    conn->read_len -= consumed;
+    memmove(conn->read_buffer, conn->read_buffer + consumed, conn->read_len);
+  }
+
+  if (result == 1 && !*request)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Memory allocation failed for client request\n");
 #endif
-  // NO CLIENT TRACKING - immediately schedule for processing
-  int *fd_ptr = malloc(sizeof(int));
-  if (!fd_ptr)
+    return (-1);
+  }
+#if SHOW_WARNING
+  if (result < 0)
   {
+    printf("[WARNING] Failed to decode message from fd %d\n", fd);
+  }
+#endif
+  return (result);
+}
+
+/**
+ * @brief Take the next complete v2 frame, assembling its payload if needed
+ * Once the header is decoded the request is allocated at its final size;
+ * payload bytes already buffered are moved into it and the rest is received
+ * directly into it by the event loop, so frames have no size ceiling
+ * Caller must hold conn->lock
+ * @param fd Client socket file descriptor
+ * @param conn Connection slot for fd
+ * @param request Output request
+ * @return 1 if a frame was taken, 0 if none is complete, -1 on error
+ */
+static int
+next_binary_frame_locked(int fd, connection_t *conn, client_request_t **request)
+{
+  *request = NULL;
+
+  if (!conn->pending)
+  {
+    message_t header;
+    int result = decode_frame_header(conn->read_buffer, conn->read_len, &header);
+    if (result < 0)
+    {
+      if (header.version == PROTOCOL_V2)
+      {
+        send_reply(fd, &header, MSG_ERROR, "Message too large");
+      }
+      return (-1);
+    }
+    if (result == 0)
+    {
+      return (0);
+    }
+
+    conn->pending = malloc(sizeof(client_request_t) + header.length + 1);
+    if (!conn->pending)
+    {
 #if SHOW_ERROR
-    printf("[ERROR] Memory allocation failed for client task\n");
+      printf("[ERROR] Memory allocation failed for %zu byte frame\n", header.length);
 #endif
-    close(client_fd);
-    return;
+      return (-1);
+    }
+    conn->pending->msg = header;
+    conn->pending->msg.data = (char *)(conn->pending + 1);
+
+    size_t available = conn->read_len - PROTOCOL_V2_HEADER_SIZE;
+    if (available > header.length)
+    {
+      available = header.length;
+    }
+    memcpy(conn->pending->msg.data, conn->read_buffer + PROTOCOL_V2_HEADER_SIZE, available);
+    conn->pending_filled = available;
+
+    conn->read_len -= PROTOCOL_V2_HEADER_SIZE + available;
+    memmove(conn->read_buffer, conn->read_buffer + PROTOCOL_V2_HEADER_SIZE + available,
+            conn->read_len);
+  }
+
+  if (conn->pending_filled < conn->pending->msg.length)
+  {
+    return (0); // The rest of the payload is received in place
+  }
+
+  *request = conn->pending;
+  (*request)->msg.data[(*request)->msg.length] = '\0';
+  conn->pending = NULL;
+  conn->pending_filled = 0;
+  return (1);
+}
+
+/**
+ * @brief Hand the next complete buffered frame to the thread pool
+ * The first frame on a connection selects its framing (v1 text or v2 binary)
+ * Caller must hold conn->lock
+ * @param fd Client socket file descriptor
+ * @param conn Connection slot for fd
+ * @return 1 if a frame was dispatched, 0 if none is complete, -1 if the connection was closed
+ */
+static int
+dispatch_next_frame_locked(int fd, connection_t *conn)
+{
+  if (conn->protocol == 0)
+  {
+    if (conn->read_len == 0)
+    {
+      return (0);
+    }
+    conn->protocol = ((unsigned char)conn->read_buffer[0] == PROTOCOL_V2_MAGIC)
+                         ? PROTOCOL_V2
+                         : PROTOCOL_V1;
   }
 
-  *fd_ptr = client_fd;
+  client_request_t *request = NULL;
+  int result = (conn->protocol == PROTOCOL_V2)
+                   ? next_binary_frame_locked(fd, conn, &request)
+                   : next_text_frame_locked(fd, conn, &request);
+
+  if (result <= 0)
+  {
+    if (result < 0)
+    {
+      close_connection_locked(fd, conn);
+    }
+    return (result);
+  }
+
+  request->client_fd = fd;
+  conn->in_flight++;
 
   // Add to thread pool for immediate processing
-  if (thread_pool_add_task(g_server.pool, handle_client_task, fd_ptr) < 0)
+  if (thread_pool_add_task(g_server.pool, handle_client_task, request) < 0)
   {
 #if SHOW_ERROR
     printf("[ERROR] Failed to add task to thread pool\n");
 #endif
-    free(fd_ptr);
-    close(client_fd);
+    free(request);
+    conn->in_flight--;
+    close_connection_locked(fd, conn);
+    return (-1);
+  }
+#if SHOW_DEBUG
+  printf("[DEBUG] Frame from fd %d scheduled for processing\n", fd);
+#endif
+  return (1);
+}
+
+/**
+ * @brief Number of requests a connection may have in flight
+ * v1 frames carry no request id, so replies must keep request order and
+ * only one frame is served at a time. v2 replies carry the request id and
+ * may complete in any order
+ */
+static int
+max_in_flight(const connection_t *conn)
+{
+  if (conn->protocol == PROTOCOL_V2 && g_server.keep_alive)
+  {
+    return (PROTOCOL_V2_MAX_IN_FLIGHT);
+  }
+  return (1);
+}
+
+/**
+ * @brief Dispatch every frame the connection may start, then decide whether
+ * to keep reading, stop reading or close
+ * Reading stops while the buffer cannot accept data (requests in flight
+ * will resume it) and after the peer has shut down its side
+ * Caller must hold conn->lock
+ * @param fd Client socket file descriptor
+ * @param conn Connection slot for fd
+ */
+static void
+pump_connection_locked(int fd, connection_t *conn)
+{
+  if (!conn->in_use || conn->closing)
+  {
     return;
   }
+
+  while (conn->in_flight < max_in_flight(conn))
+  {
+    int dispatched = dispatch_next_frame_locked(fd, conn);
+    if (dispatched < 0)
+    {
+      return; // Connection closed
+    }
+    if (dispatched == 0)
+    {
+      break;
+    }
+  }
+
+  if (conn->peer_closed)
+  {
+    if (conn->in_flight == 0)
+    {
+      close_connection_locked(fd, conn);
+    }
+    else
+    {
+      // The last worker closes the connection when it finishes
+      pause_connection_locked(fd, conn);
+    }
+    return;
+  }
+
+  size_t room;
+  receive_target_locked(conn, &room);
+  if (room == 0)
+  {
+    pause_connection_locked(fd, conn);
+  }
+  else if (resume_connection_locked(fd, conn) < 0)
+  {
+    close_connection_locked(fd, conn);
+  }
+}
+
+/**
+ * @brief Complete a request on a connection
+ * Stateless connections are closed; keep-alive connections dispatch the next
+ * buffered frames or go back to waiting for data
+ * @param fd Client socket file descriptor
+ * @param keep 1 if the connection may be reused
+ */
+static void
+finish_request(int fd, int keep)
+{
+  connection_t *conn = &g_server.connections[fd];
+
+  pthread_mutex_lock(&conn->lock);
+
+  conn->in_flight--;
+  conn->last_activity = time(NULL);
+
+  if (conn->closing)
+  {
+    // Deferred close: the last request in flight closes the connection
+    if (conn->in_flight == 0)
+    {
+      close_connection_locked(fd, conn);
+    }
+  }
+  else if (!keep || !g_server.keep_alive)
+  {
+#if SHOW_INFO
+    printf("[INFO] Closing connection fd %d (%s)\n", fd,
+           g_server.keep_alive ? "error" : "stateless mode");
+#endif
+    close_connection_locked(fd, conn);
+  }
+  else
+  {
+    pump_connection_locked(fd, conn);
+  }
+
+  pthread_mutex_unlock(&conn->lock);
+}
+
+static void
+handle_client_task(void *arg)
+{
+  client_request_t *request = (client_request_t *)arg;
+  int client_fd = request->client_fd;
 #if SHOW_DEBUG
-  printf("[DEBUG] Client fd %d scheduled for processing\n", client_fd);
+  printf("[DEBUG] Worker thread handling client fd %d\n", client_fd);
+#endif
+  int result = process_request(request);
+  if (result == 1)
+  {
+    return; // The upstream completion answers and finishes the request
+  }
+  free(request); // Request and payload share one allocation
+
+  finish_request(client_fd, result == 0);
+#if SHOW_DEBUG
+  printf("[DEBUG] Worker thread finished with client fd %d\n", client_fd);
+#endif
+}
+
+/**
+ * @brief Register a freshly accepted socket with a reactor
+ * @param reactor Reactor that accepted the connection
+ * @param client_fd Client socket file descriptor (already non-blocking)
+ * @return 0 on success, -1 on error (the caller owns the fd)
+ */
+int register_client(reactor_t *reactor, int client_fd)
+{
+  if (client_fd >= MAX_CLIENTS)
+  {
+#if SHOW_WARNING
+    printf("[WARNING] Connection table full, rejecting fd %d\n", client_fd);
+#endif
+    return (-1);
+  }
+
+  connection_t *conn = &g_server.connections[client_fd];
+
+  pthread_mutex_lock(&conn->lock);
+
+  conn->read_buffer = malloc(BUFFER_SIZE);
+  if (!conn->read_buffer)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Memory allocation failed for connection buffer\n");
+#endif
+    pthread_mutex_unlock(&conn->lock);
+    return (-1);
+  }
+
+  conn->reactor = reactor;
+  conn->generation++;
+  conn->in_use = 1;
+  conn->in_flight = 0;
+  conn->closing = 0;
+  conn->registered = 0;
+  conn->peer_closed = 0;
+  conn->protocol = 0;
+  conn->read_len = 0;
+  conn->pending = NULL;
+  conn->pending_filled = 0;
+  conn->last_activity = time(NULL);
+
+  if (resume_connection_locked(client_fd, conn) < 0)
+  {
+    free(conn->read_buffer);
+    conn->read_buffer = NULL;
+    conn->in_use = 0;
+    pthread_mutex_unlock(&conn->lock);
+    return (-1);
+  }
+
+  pthread_mutex_unlock(&conn->lock);
+  return (0);
+}
+
+/**
+ * @brief Accept all pending connections on a reactor's listener
+ * Drains accept4() until EAGAIN so a burst of reconnecting clients is
+ * handled in one readiness event. Sockets are created non-blocking
+ * @param reactor Reactor whose listener is readable
+ */
+void accept_new_connections(reactor_t *reactor)
+{
+  while (g_server.running)
+  {
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+
+    // Accept the connection
+    int client_fd = accept4(reactor->listen_fd, (struct sockaddr *)&client_addr, &addr_len,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        perror("accept4");
+      }
+      return;
+    }
+
+#if SHOW_INFO
+    printf("[INFO] New connection on reactor %d: fd=%d from %s:%d\n", reactor->id,
+           client_fd, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
 #endif
+    if (register_client(reactor, client_fd) < 0)
+    {
+      close(client_fd);
+    }
+  }
+}
+
+/**
+ * @brief Read all available bytes from a client socket into its buffer
+ * Stops when the socket would block or the buffer is full. Payload bytes of
+ * a v2 frame being assembled are received directly into the request
+ * Caller must hold conn->lock
+ */
+static void
+read_client_data_locked(int fd, connection_t *conn)
+{
+  for (;;)
+  {
+    size_t room;
+    char *target = receive_target_locked(conn, &room);
+    if (room == 0)
+    {
+      return;
+    }
+
+    ssize_t received = recv(fd, target, room, 0);
+
+    if (received > 0)
+    {
+      receive_advance_locked(conn, (size_t)received);
+      continue;
+    }
+
+    if (received == 0)
+    {
+#if SHOW_INFO
+      printf("[INFO] Client fd %d disconnected\n", fd);
+#endif
+      conn->peer_closed = 1;
+      return;
+    }
+
+    if (errno == EINTR)
+    {
+      continue;
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+#if SHOW_WARNING
+      printf("[WARNING] Error receiving from client fd %d: %s\n", fd, strerror(errno));
+#endif
+      conn->peer_closed = 1;
+    }
+    return;
+  }
+}
+
+/**
+ * @brief Handle readiness on a client socket
+ * Called from the epoll loop: buffers the available bytes and dispatches a
+ * frame to the thread pool once it is complete
+ * @param client_fd Client socket file descriptor
+ * @param events epoll event mask reported for the fd
+ */
+void handle_client_data(int client_fd, uint32_t events)
+{
+  if (client_fd < 0 || client_fd >= MAX_CLIENTS)
+  {
+    return;
+  }
+
+  connection_t *conn = &g_server.connections[client_fd];
+
+  pthread_mutex_lock(&conn->lock);
+
+  if (!conn->in_use)
+  {
+    pthread_mutex_unlock(&conn->lock);
+    return;
+  }
+
+  if (events & EPOLLERR)
+  {
+    close_connection_locked(client_fd, conn);
+    pthread_mutex_unlock(&conn->lock);
+    return;
+  }
+
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+  {
+    read_client_data_locked(client_fd, conn);
+  }
+
+  pump_connection_locked(client_fd, conn);
+
+  pthread_mutex_unlock(&conn->lock);
+}
+
+/**
+ * @brief Deliver bytes received by a completion-based backend (io_uring)
+ * @param client_fd Client socket file descriptor
+ * @param generation Connection generation the receive was armed for
+ * @param data Received bytes (NULL with length 0 on end of stream or error)
+ * @param length Number of received bytes, at most the room announced earlier
+ * @return Free space to receive into next, 0 if the receive must not be re-armed
+ */
+size_t connection_receive(int client_fd, unsigned int generation,
+                          const char *data, size_t length)
+{
+  if (client_fd < 0 || client_fd >= MAX_CLIENTS)
+  {
+    return (0);
+  }
+
+  connection_t *conn = &g_server.connections[client_fd];
+  size_t room = 0;
+
+  pthread_mutex_lock(&conn->lock);
+
+  // Stale completion for a connection that was closed meanwhile
+  if (!conn->in_use || conn->generation != generation)
+  {
+    pthread_mutex_unlock(&conn->lock);
+    return (0);
+  }
+
+  if (length == 0)
+  {
+    conn->peer_closed = 1;
+  }
+  else
+  {
+    // May span the end of a v2 payload and the start of the next frame
+    while (length > 0)
+    {
+      size_t space;
+      char *target = receive_target_locked(conn, &space);
+      size_t chunk = (length < space) ? length : space;
+      if (chunk == 0)
+      {
+        break;
+      }
+      memcpy(target, data, chunk);
+      receive_advance_locked(conn, chunk);
+      data += chunk;
+      length -= chunk;
+    }
+  }
+
+  pump_connection_locked(client_fd, conn);
+
+  if (conn->in_use && conn->registered)
+  {
+    receive_target_locked(conn, &room);
+    if (room == 0)
+    {
+      pause_connection_locked(client_fd, conn);
+    }
+  }
+
+  pthread_mutex_unlock(&conn->lock);
+  return (room);
 }
 
 /**
- * @brief Handle client data - NOT USED in pure stateless mode
- * In stateless mode, client sockets are never added to epoll
- * Only the server socket is monitored with epoll
+ * @brief Write a complete buffer to a client connection
+ * @param client_fd Client socket file descriptor
+ * @param data Bytes to send
+ * @param length Number of bytes to send
+ * @return 0 on success, -1 on error
  */
-void handle_client_data(int client_fd)
+int connection_send(int client_fd, const char *data, size_t length)
 {
+  struct iovec iov;
+  iov.iov_base = (void *)data;
+  iov.iov_len = length;
+  return connection_sendv(client_fd, &iov, 1);
+}
+
+/**
+ * @brief Write a set of buffers to a client connection as one message
+ * With epoll the data is written directly with sendmsg(), waiting with poll()
+ * when the non-blocking socket is full; with io_uring it is queued on the
+ * reactor owning the connection, which submits it in order
+ * @param client_fd Client socket file descriptor
+ * @param iov Buffers to send, in order
+ * @param iovcnt Number of buffers (at most 8)
+ * @return 0 on success, -1 on error
+ */
+int connection_sendv(int client_fd, const struct iovec *iov, int iovcnt)
+{
+#ifdef USE_IO_URING
+  if (client_fd >= 0 && client_fd < MAX_CLIENTS && g_server.running)
+  {
+    return uring_send(g_server.connections[client_fd].reactor, client_fd, iov, iovcnt);
+  }
+#endif
+  struct iovec pending[8];
+  if (iovcnt > 8)
+  {
+    return (-1);
+  }
+  memcpy(pending, iov, sizeof(struct iovec) * (size_t)iovcnt);
+
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = pending;
+  message.msg_iovlen = (size_t)iovcnt;
+
+  // Workers answering multiplexed requests must not interleave their replies
+  pthread_mutex_t *write_lock = NULL;
+  if (client_fd >= 0 && client_fd < MAX_CLIENTS)
+  {
+    write_lock = &g_server.connections[client_fd].write_lock;
+    pthread_mutex_lock(write_lock);
+  }
+
+  int result = 0;
+  while (message.msg_iovlen > 0)
+  {
+    // Skip buffers that are already fully written (or empty)
+    if (message.msg_iov->iov_len == 0)
+    {
+      ++message.msg_iov;
+      --message.msg_iovlen;
+      continue;
+    }
+
+    ssize_t sent = sendmsg(client_fd, &message, MSG_NOSIGNAL);
+
+    if (sent <= 0)
+    {
+      if (sent < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (sent == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      {
 #if SHOW_WARNING
-  printf("[WARNING] handle_client_data should not be called in stateless mode\n");
+        printf("[WARNING] Failed to send message to client fd %d: %s\n",
+               client_fd, strerror(errno));
+#endif
+        result = -1;
+        break;
+      }
+      // Client sockets are non-blocking: wait until the socket is writable
+      struct pollfd pfd = {.fd = client_fd, .events = POLLOUT};
+      if (poll(&pfd, 1, CLIENT_SOCKET_TIMEOUT_SEC * 1000) <= 0)
+      {
+#if SHOW_WARNING
+        printf("[WARNING] Send to client fd %d timed out\n", client_fd);
+#endif
+        result = -1;
+        break;
+      }
+      continue;
+    }
+
+    // Advance past the bytes written
+    size_t written = (size_t)sent;
+    while (written > 0)
+    {
+      size_t step = (written < message.msg_iov->iov_len) ? written : message.msg_iov->iov_len;
+      message.msg_iov->iov_base = (char *)message.msg_iov->iov_base + step;
+      message.msg_iov->iov_len -= step;
+      written -= step;
+      if (message.msg_iov->iov_len == 0)
+      {
+        ++message.msg_iov;
+        --message.msg_iovlen;
+      }
+    }
+  }
+
+  if (write_lock)
+  {
+    pthread_mutex_unlock(write_lock);
+  }
+  return (result);
+}
+
+/**
+ * @brief Evict connections idle for too long
+ * Keep-alive connections are closed after CLIENT_IDLE_TIMEOUT_SEC, stateless
+ * connections that never complete a request after CLIENT_SOCKET_TIMEOUT_SEC.
+ * Connections currently being served by a worker are never evicted
+ */
+void evict_idle_connections(void)
+{
+  time_t now = time(NULL);
+  int timeout = g_server.keep_alive ? CLIENT_IDLE_TIMEOUT_SEC : CLIENT_SOCKET_TIMEOUT_SEC;
+  int evicted = 0;
+
+  for (int fd = 0; fd < MAX_CLIENTS; ++fd)
+  {
+    connection_t *conn = &g_server.connections[fd];
+
+    pthread_mutex_lock(&conn->lock);
+    if (conn->in_use && conn->in_flight == 0 && now - conn->last_activity >= timeout)
+    {
+      close_connection_locked(fd, conn);
+      ++evicted;
+    }
+    pthread_mutex_unlock(&conn->lock);
+  }
+
+#if SHOW_INFO
+  if (evicted > 0)
+  {
+    printf("[INFO] Evicted %d idle connections\n", evicted);
+  }
+#else
+  (void)evicted;
 #endif
-  close(client_fd);
 }
 
 /**
  * @brief Remove client
- * In stateless mode, this just closes the socket (no state to remove)
+ * Unregisters the fd from epoll, releases its buffer and closes the socket.
+ * Used at shutdown once the workers are gone, so requests still counted as
+ * in flight do not defer the close
  * @param fd Client socket file descriptor
  */
 void remove_client(int fd)
 {
 #if SHOW_DEBUG
-  printf("[DEBUG] remove_client called for fd %d (stateless mode)\n", fd);
+  printf("[DEBUG] remove_client called for fd %d\n", fd);
 #endif
-  close(fd);
+  if (fd < 0 || fd >= MAX_CLIENTS)
+  {
+    close(fd);
+    return;
+  }
+
+  connection_t *conn = &g_server.connections[fd];
+
+  pthread_mutex_lock(&conn->lock);
+  conn->in_flight = 0;
+  close_connection_locked(fd, conn);
+  pthread_mutex_unlock(&conn->lock);
 }
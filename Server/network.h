@@ -2,11 +2,17 @@
 #define NETWORK_H
 
 #include "server.h"
+#include <sys/uio.h>
 
 // Network function declarations
 void remove_client(int fd);
-void accept_new_connection(void);
-void handle_client_data(int client_fd);
+void accept_new_connections(reactor_t * reactor);
+int register_client(reactor_t * reactor, int client_fd);
+void handle_client_data(int client_fd, uint32_t events);
+size_t connection_receive(int client_fd, unsigned int generation, const char * data, size_t length);
+int connection_send(int client_fd, const char * data, size_t length);
+int connection_sendv(int client_fd, const struct iovec * iov, int iovcnt);
+void evict_idle_connections(void);
 
 // Global server context
 extern server_context_t g_server;
@@ -0,0 +1,390 @@
+/*********************************************************************************
+ * ===== FILE: prompt_template.h/prompt_template.c =====
+ * Precompiled Gemini request templates
+ * Everything in a generateContent request except the conversation depends
+ * only on the language and the personality profile. The JSON up to the
+ * conversation (fixed generationConfig/safetySettings plus the escaped
+ * premise) is compiled once per (language, quantized personality) and
+ * cached; a request is then three copies into one exactly sized buffer
+ *********************************************************************************/
+
+#include "prompt_template.h"
+#include "utils.h"
+
+// Fixed request JSON before the premise text
+static const char PROMPT_JSON_HEAD[] =
+    "{"
+    "  \"generationConfig\": {"
+    "    \"temperature\": 0.9,"
+    "    \"maxOutputTokens\": 800,"
+    "    \"topP\": 1,"
+    "    \"topK\": 1"
+    "  },"
+    "  \"safetySettings\": ["
+    "    {"
+    "      \"category\": \"HARM_CATEGORY_HARASSMENT\","
+    "      \"threshold\": \"BLOCK_MEDIUM_AND_ABOVE\""
+    "    },"
+    "    {"
+    "      \"category\": \"HARM_CATEGORY_HATE_SPEECH\","
+    "      \"threshold\": \"BLOCK_MEDIUM_AND_ABOVE\""
+    "    },"
+    "    {"
+    "      \"category\": \"HARM_CATEGORY_SEXUALLY_EXPLICIT\","
+    "      \"threshold\": \"BLOCK_MEDIUM_AND_ABOVE\""
+    "    },"
+    "    {"
+    "      \"category\": \"HARM_CATEGORY_DANGEROUS_CONTENT\","
+    "      \"threshold\": \"BLOCK_MEDIUM_AND_ABOVE\""
+    "    }"
+    "  ],"
+    "  \"contents\": ["
+    "    {"
+    "      \"role\": \"user\","
+    "      \"parts\": ["
+    "        {"
+    "          \"text\": \"";
+
+// Between the premise text and the conversation
+static const char PROMPT_JSON_PREMISE_END[] =
+    "\""
+    "        }"
+    "      ]"
+    "    },"
+    "    ";
+
+// After the conversation
+static const char PROMPT_JSON_TAIL[] =
+    "  ]"
+    "}";
+
+/**
+ * @brief Compiled request prefix for one language and personality
+ */
+typedef struct
+{
+  uint64_t hash;                    // Hash of the key below
+  char language[MAX_LANGUAGE_SIZE]; // Lowercased language
+  char *personality;                // Canonical (quantized) personality
+  char *prefix;                     // Request JSON up to the conversation
+  size_t prefix_length;
+} prompt_template_t;
+
+// Direct-mapped table: a new key replaces the template in its slot.
+// Readers copy the prefix under the read lock, so replacement is safe
+static pthread_rwlock_t g_template_lock = PTHREAD_RWLOCK_INITIALIZER;
+static prompt_template_t *g_templates[PROMPT_TEMPLATE_SLOTS];
+
+// Statistics
+static atomic_long g_template_hits;
+static atomic_long g_template_misses;
+
+/**
+ * @brief Append text escaped for a JSON string
+ * @param out Output buffer (NULL to only measure)
+ * @param text Text to escape
+ * @return Number of bytes written (or needed)
+ */
+static size_t
+json_escape(char *out, const char *text)
+{
+  static const char hex[] = "0123456789abcdef";
+  size_t length = 0;
+
+  for (const unsigned char *src = (const unsigned char *)text; *src; ++src)
+  {
+    char escape = 0;
+    switch (*src)
+    {
+    case '"':
+      escape = '"';
+      break;
+    case '\\':
+      escape = '\\';
+      break;
+    case '\n':
+      escape = 'n';
+      break;
+    case '\r':
+      escape = 'r';
+      break;
+    case '\t':
+      escape = 't';
+      break;
+    default:
+      break;
+    }
+
+    if (escape)
+    {
+      if (out)
+      {
+        out[length] = '\\';
+        out[length + 1] = escape;
+      }
+      length += 2;
+    }
+    else if (*src < 0x20)
+    {
+      if (out)
+      {
+        memcpy(out + length, "\\u00", 4);
+        out[length + 4] = hex[*src >> 4];
+        out[length + 5] = hex[*src & 0xF];
+      }
+      length += 6;
+    }
+    else
+    {
+      if (out)
+      {
+        out[length] = (char)*src;
+      }
+      length += 1;
+    }
+  }
+  return (length);
+}
+
+/**
+ * @brief Canonical form of a personality profile
+ * Every comma separated trait that ends in a number ("Extroversion = 4.44",
+ * "Openness to experiences 4.9", "extraversion:4.4" or a bare "4.0") gets
+ * that number rounded to the nearest PROMPT_PERSONALITY_STEP, so nearby
+ * profiles share a template. Anything else is kept as is (trimmed)
+ * @param personality Personality profile from the request
+ * @param out Output buffer
+ * @param size Size of the output buffer
+ */
+static void
+canonical_personality(const char *personality, char *out, size_t size)
+{
+  char copy[PROMPT_MAX_PERSONALITY];
+  safe_strncpy(copy, personality, sizeof(copy));
+  const char *trimmed = trim_whitespace(copy);
+
+  // Fallback: the trimmed profile as is
+  safe_strncpy(out, trimmed, size);
+  if (PROMPT_PERSONALITY_STEP <= 0.0)
+  {
+    return;
+  }
+
+  char scratch[PROMPT_MAX_PERSONALITY];
+  char quantized_profile[PROMPT_MAX_PERSONALITY];
+  size_t used = 0;
+  char *saveptr = NULL;
+
+  safe_strncpy(scratch, trimmed, sizeof(scratch));
+  quantized_profile[0] = '\0';
+  for (char *item = strtok_r(scratch, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr))
+  {
+    // The value is the number the trait ends with; the rest is its label
+    char *trait = trim_whitespace(item);
+    char *number = trait + strlen(trait);
+    while (number > trait && (isdigit((unsigned char)number[-1]) || number[-1] == '.'))
+    {
+      --number;
+    }
+    if (number > trait && (number[-1] == '-' || number[-1] == '+'))
+    {
+      --number;
+    }
+    char *end = NULL;
+    double value = strtod(number, &end);
+    if (end == number || *end != '\0')
+    {
+      return; // Not a list of traits with values
+    }
+
+    *number = '\0';
+    double steps = value / PROMPT_PERSONALITY_STEP;
+    double quantized = PROMPT_PERSONALITY_STEP * (double)(long)(steps + (steps >= 0 ? 0.5 : -0.5));
+    int written = snprintf(quantized_profile + used, sizeof(quantized_profile) - used, "%s%s%.1f",
+                           used ? ", " : "", trait, quantized);
+    if (written < 0 || (size_t)written >= sizeof(quantized_profile) - used)
+    {
+      return;
+    }
+    used += (size_t)written;
+  }
+  safe_strncpy(out, quantized_profile, size);
+}
+
+/**
+ * @brief Compile the request prefix for a language and canonical personality
+ * @return The template, or NULL on error
+ */
+static prompt_template_t *
+compile_template(uint64_t hash, const char *language, const char *personality)
+{
+  char premise[PROMPT_MAX_PERSONALITY + 512];
+  snprintf(premise, sizeof(premise),
+           "You are a robot assistant (Furhat robot) designed to adapt to human personality. "
+           "Respond in %s language. Here is your personality profile: %s\n\n"
+           "Keep responses concise (1-3 sentences) and naturally conversational.",
+           language, personality);
+
+  size_t head = sizeof(PROMPT_JSON_HEAD) - 1;
+  size_t escaped = json_escape(NULL, premise);
+  size_t end = sizeof(PROMPT_JSON_PREMISE_END) - 1;
+
+  prompt_template_t *template = calloc(1, sizeof(prompt_template_t));
+  char *prefix = malloc(head + escaped + end + 1);
+  char *canonical = strdup(personality);
+  if (!template || !prefix || !canonical)
+  {
+    free(template);
+    free(prefix);
+    free(canonical);
+    return (NULL);
+  }
+
+  memcpy(prefix, PROMPT_JSON_HEAD, head);
+  json_escape(prefix + head, premise);
+  memcpy(prefix + head + escaped, PROMPT_JSON_PREMISE_END, end);
+  prefix[head + escaped + end] = '\0';
+
+  template->hash = hash;
+  safe_strncpy(template->language, language, sizeof(template->language));
+  template->personality = canonical;
+  template->prefix = prefix;
+  template->prefix_length = head + escaped + end;
+  return (template);
+}
+
+/**
+ * @brief Free a template
+ */
+static void
+free_template(prompt_template_t *template)
+{
+  if (template)
+  {
+    free(template->personality);
+    free(template->prefix);
+    free(template);
+  }
+}
+
+/**
+ * @brief Copy a template's prefix, the conversation and the tail into a new buffer
+ */
+static char *
+splice_request(const prompt_template_t *template, const char *conversation, size_t *length)
+{
+  size_t conversation_length = strlen(conversation);
+  size_t tail = sizeof(PROMPT_JSON_TAIL) - 1;
+  size_t total = template->prefix_length + conversation_length + tail;
+
+  char *request = malloc(total + 1);
+  if (!request)
+  {
+    return (NULL);
+  }
+  memcpy(request, template->prefix, template->prefix_length);
+  memcpy(request + template->prefix_length, conversation, conversation_length);
+  memcpy(request + template->prefix_length + conversation_length, PROMPT_JSON_TAIL, tail);
+  request[total] = '\0';
+
+  if (length)
+  {
+    *length = total;
+  }
+  return (request);
+}
+
+/**
+ * @brief Build a complete generateContent request
+ * @param personality User's personality profile
+ * @param language User's language preference
+ * @param conversation Already formatted JSON conversation history
+ * @param length Set to the request length (may be NULL)
+ * @return The request JSON (malloc'd), or NULL on error
+ */
+char *prompt_build_request(const char *personality, const char *language,
+                           const char *conversation, size_t *length)
+{
+  char canonical[PROMPT_MAX_PERSONALITY];
+  canonical_personality(personality, canonical, sizeof(canonical));
+
+  char lowered[MAX_LANGUAGE_SIZE];
+  safe_strncpy(lowered, language, sizeof(lowered));
+  for (char *c = lowered; *c; ++c)
+  {
+    *c = (char)tolower((unsigned char)*c);
+  }
+
+  // FNV-1a over language, separator and personality
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char *c = lowered; ; ++c)
+  {
+    hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+    if (!*c)
+    {
+      break;
+    }
+  }
+  for (const char *c = canonical; *c; ++c)
+  {
+    hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+  }
+  size_t slot = hash % PROMPT_TEMPLATE_SLOTS;
+
+  pthread_rwlock_rdlock(&g_template_lock);
+  prompt_template_t *template = g_templates[slot];
+  if (template && template->hash == hash && strcmp(template->language, lowered) == 0 &&
+      strcmp(template->personality, canonical) == 0)
+  {
+    char *request = splice_request(template, conversation, length);
+    pthread_rwlock_unlock(&g_template_lock);
+    atomic_fetch_add(&g_template_hits, 1);
+    return (request);
+  }
+  pthread_rwlock_unlock(&g_template_lock);
+  atomic_fetch_add(&g_template_misses, 1);
+
+  // Compile outside the lock, then publish it for later requests
+  template = compile_template(hash, lowered, canonical);
+  if (!template)
+  {
+    return (NULL);
+  }
+  char *request = splice_request(template, conversation, length);
+
+  pthread_rwlock_wrlock(&g_template_lock);
+  prompt_template_t *old = g_templates[slot];
+  g_templates[slot] = template;
+  pthread_rwlock_unlock(&g_template_lock);
+  free_template(old);
+
+  return (request);
+}
+
+/**
+ * @brief Free every cached template
+ */
+void prompt_templates_destroy(void)
+{
+  pthread_rwlock_wrlock(&g_template_lock);
+  for (int i = 0; i < PROMPT_TEMPLATE_SLOTS; ++i)
+  {
+    free_template(g_templates[i]);
+    g_templates[i] = NULL;
+  }
+  pthread_rwlock_unlock(&g_template_lock);
+}
+
+/**
+ * @brief Print template cache statistics
+ */
+void prompt_print_stats(void)
+{
+  long hits = atomic_load(&g_template_hits);
+  long misses = atomic_load(&g_template_misses);
+
+  printf("\n=== PROMPT TEMPLATE STATISTICS ===\n");
+  printf("Templates compiled: %ld, reused: %ld (%.1f%% hit rate)\n", misses, hits,
+         (hits + misses) > 0 ? 100.0 * hits / (hits + misses) : 0.0);
+  printf("==================================\n\n");
+}
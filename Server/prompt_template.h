@@ -0,0 +1,11 @@
+#ifndef PROMPT_TEMPLATE_H
+#define PROMPT_TEMPLATE_H
+
+#include "server.h"
+
+char * prompt_build_request(const char * personality, const char * language,
+                            const char * conversation, size_t * length);
+void prompt_templates_destroy(void);
+void prompt_print_stats(void);
+
+#endif /* PROMPT_TEMPLATE_H */
@@ -1,15 +1,66 @@
 /*********************************************************************************
  * ===== FILE: protocol.c =====
- * Text-based MESSAGE_TYPE|payload communication protocol handling
+ * Client-Server communication protocol handling
+ * v1: text-based MESSAGE_TYPE|payload\n frames
+ * v2: length-prefixed binary frames with a request id and typed fields
+ *     (see PROTOCOL_V2_* in config.h). A connection uses the framing of its
+ *     first frame; v2 frames start with PROTOCOL_V2_MAGIC, which can never
+ *     start a v1 frame, so old clients keep working unchanged
  *********************************************************************************/
 
 #include "protocol.h"
+#include "network.h"
 #include "utils.h"
 #include <string.h>
+#include <sys/uio.h>
+
+/**
+ * @brief Read a big-endian 16 bit value
+ */
+static uint16_t
+read_u16(const char *buffer)
+{
+  const unsigned char *bytes = (const unsigned char *)buffer;
+  return (uint16_t)((bytes[0] << 8) | bytes[1]);
+}
+
+/**
+ * @brief Read a big-endian 32 bit value
+ */
+static uint32_t
+read_u32(const char *buffer)
+{
+  const unsigned char *bytes = (const unsigned char *)buffer;
+  return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+         ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
+}
+
+/**
+ * @brief Write a big-endian 16 bit value
+ */
+static void
+write_u16(char *buffer, uint16_t value)
+{
+  buffer[0] = (char)(value >> 8);
+  buffer[1] = (char)value;
+}
+
+/**
+ * @brief Write a big-endian 32 bit value
+ */
+static void
+write_u32(char *buffer, uint32_t value)
+{
+  buffer[0] = (char)(value >> 24);
+  buffer[1] = (char)(value >> 16);
+  buffer[2] = (char)(value >> 8);
+  buffer[3] = (char)value;
+}
 
 /**
  * @brief Send a message to a client using MESSAGE_TYPE|payload format
- * Sends message as text string: "MESSAGE_TYPE|payload\n"
+ * Sends message as text string: "MESSAGE_TYPE|payload\n". The payload is
+ * sent from the caller's buffer, only the type prefix is formatted
  * @param client_fd Client socket file descriptor
  * @param msg_type Type of message (see MSG_* constants)
  * @param data Message payload (can be NULL or empty)
@@ -17,160 +68,165 @@
  */
 int send_message(int client_fd, int msg_type, const char *data)
 {
+  char prefix[16];
+  int prefix_len = snprintf(prefix, sizeof(prefix), "%d|", msg_type);
+  size_t data_len = data ? strlen(data) : 0;
 
-  char message_buffer[MAX_MESSAGE_SIZE + 32]; // Extra space for type and separator
-
-  // Format message as "MESSAGE_TYPE|payload\n"
-  if (data && strlen(data) > 0)
-  {
-    snprintf(message_buffer, sizeof(message_buffer), "%d|%s\n", msg_type, data);
-  }
-  else
-  {
-    snprintf(message_buffer, sizeof(message_buffer), "%d|\n", msg_type); // Empty payload
-  }
-
-  size_t message_len = strlen(message_buffer);
-  ssize_t total_sent = 0;
 #if SHOW_DEBUG
-  printf("[DEBUG] Sending message: '%.*s' to client fd %d\n",
-         (int)(message_len - 1), message_buffer, client_fd); // -1 to skip \n in log
+  printf("[DEBUG] Sending message: '%s%.*s' to client fd %d\n",
+         prefix, (int)data_len, data ? data : "", client_fd);
 #endif
 
+  struct iovec iov[3];
+  iov[0].iov_base = prefix;
+  iov[0].iov_len = (size_t)prefix_len;
+  iov[1].iov_base = (void *)(data ? data : "");
+  iov[1].iov_len = data_len;
+  iov[2].iov_base = "\n";
+  iov[2].iov_len = 1;
+
   // Send the complete message
-  while (total_sent < (ssize_t)message_len)
+  if (connection_sendv(client_fd, iov, 3) < 0)
   {
-    ssize_t sent = send(client_fd, message_buffer + total_sent,
-                        message_len - total_sent, MSG_NOSIGNAL);
-
-    if (sent <= 0)
-    {
-      if (sent == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
-      {
-#if SHOW_WARNING
-        printf("[WARNING] Failed to send message to client fd %d: %s\n",
-               client_fd, strerror(errno));
-#endif
-        return (-1);
-      }
-      // For EAGAIN/EWOULDBLOCK, continue trying
-      continue;
-    }
-
-    total_sent += sent;
+    return (-1);
   }
 #if SHOW_DEBUG
   printf("[DEBUG] Successfully sent message type %d (%zu bytes) to client fd %d\n",
-         msg_type, message_len, client_fd);
+         msg_type, (size_t)prefix_len + data_len + 1, client_fd);
 #endif
   return (0);
 }
 
 /**
- * @brief Receive a line from socket (helper function)
- * Reads data character by character until newline is found
- * Handles non-blocking sockets properly
+ * @brief Send a v2 binary frame
  * @param client_fd Client socket file descriptor
- * @param buffer Output buffer for received line
- * @param buffer_size Size of output buffer
- * @return Number of bytes received (excluding newline), -1 on error
- *
- * @example "Ciao! \nCome stai" -> "Ciao! Come stai"
+ * @param msg_type Type of message (see MSG_* constants)
+ * @param flags Header flags
+ * @param request_id Request id of the frame being answered
+ * @param data Payload bytes (can be NULL when length is 0)
+ * @param length Payload length
+ * @return 0 on success, -1 on error
  */
 static int
-receive_line(int client_fd, char *buffer, size_t buffer_size)
+send_frame_v2(int client_fd, int msg_type, unsigned int flags, uint32_t request_id,
+              const char *data, size_t length)
 {
-  size_t pos = 0;
-  char ch;
-
-  while (pos < buffer_size - 1)
-  {
-    ssize_t received = recv(client_fd, &ch, 1, 0);
-
-    if (received <= 0)
-    {
-      if (received == 0)
-      {
-#if SHOW_INFO
-        printf("[INFO] Client fd %d disconnected while reading line\n", client_fd);
-#endif
-        return (-1);
-      }
-
-#if SHOW_WARNING
-      printf("[WARNING] Error receiving from client fd %d: %s\n",
-             client_fd, strerror(errno));
-#endif
-      return (-1);
-    }
-
-    if (ch == '\n')
-    {
-      break;
-    }
-    // Skip carriage return (handle Windows line endings)
-    if (ch == '\r')
-    {
-      continue;
-    }
-
-    // Add character to buffer
-    buffer[pos++] = ch;
-  }
-
-  // Null-terminate the string
-  buffer[pos] = '\0';
+  char header[PROTOCOL_V2_HEADER_SIZE];
+
+  header[0] = (char)PROTOCOL_V2_MAGIC;
+  header[1] = PROTOCOL_V2;
+  write_u16(header + 2, (uint16_t)msg_type);
+  write_u16(header + 4, (uint16_t)flags);
+  write_u16(header + 6, 0);
+  write_u32(header + 8, request_id);
+  write_u32(header + 12, (uint32_t)length);
+
+  struct iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = (void *)(data ? data : "");
+  iov[1].iov_len = length;
 
 #if SHOW_DEBUG
-  printf("[DEBUG] Received line (%zu bytes): '%s'\n", pos, buffer);
+  printf("[DEBUG] Sending v2 frame type %d id %u (%zu bytes) to client fd %d\n",
+         msg_type, request_id, length, client_fd);
 #endif
-  return ((int)pos);
+  return connection_sendv(client_fd, iov, 2);
 }
 
 /**
- * @brief Receive and parse MESSAGE_TYPE|payload into message_t struct
- * Reads text line from socket and parses it into structured format
+ * @brief Answer a request using the framing it arrived with
+ * v1 requests get a "MESSAGE_TYPE|payload\n" line, v2 requests a binary frame
+ * carrying the same request id with the text as payload
  * @param client_fd Client socket file descriptor
- * @param msg Output message structure to populate
+ * @param request Message being answered
+ * @param msg_type Type of message (see MSG_* constants)
+ * @param data Reply text (can be NULL or empty)
  * @return 0 on success, -1 on error
  */
-int receive_message(int client_fd, message_t *msg)
+int send_reply(int client_fd, const message_t *request, int msg_type, const char *data)
 {
-  char line_buffer[MAX_MESSAGE_SIZE + 64]; // Extra space for message type and separators
-  // Initialize message structure
-  memset(msg, 0, sizeof(message_t));
+  if (request->version == PROTOCOL_V2)
+  {
+    return send_frame_v2(client_fd, msg_type, 0, request->request_id,
+                         data, data ? strlen(data) : 0);
+  }
+  return send_message(client_fd, msg_type, data);
+}
 
-  // Step 1: Receive complete line from socket
-  int line_length = receive_line(client_fd, line_buffer, sizeof(line_buffer));
-  if (line_length < 0)
+/**
+ * @brief Decode the next MESSAGE_TYPE|payload frame from a connection read buffer
+ * Frames are newline terminated; blank lines are skipped and a trailing
+ * carriage return (Windows line endings) is dropped. Nothing is read from the
+ * socket here: the event loop fills the buffer, so workers never block on it.
+ * The frame is split in place: msg->data points into buffer
+ * @param buffer Bytes received from the client (not null-terminated)
+ * @param length Number of valid bytes in buffer
+ * @param msg Output message structure to populate
+ * @param consumed Output number of bytes to discard from the buffer
+ * @return 1 if a frame was decoded, 0 if more data is needed, -1 on invalid frame
+ *
+ * @example "1|Hello\r\n2|..." -> type=1, data="Hello", consumed=8
+ */
+int decode_message_frame(char *buffer, size_t length, message_t *msg, size_t *consumed)
+{
+  size_t offset = 0;
+  *consumed = 0;
+
+  // Skip blank lines left between requests
+  while (offset < length && (buffer[offset] == '\n' || buffer[offset] == '\r'))
   {
-    return (-1);
+    ++offset;
+  }
+  *consumed = offset;
+
+  char *line = buffer + offset;
+  char *newline = memchr(line, '\n', length - offset);
+  if (!newline)
+  {
+    return (0); // Incomplete frame, wait for more data
   }
 
-  // Step 2: Validate minimum message format
+  *consumed = (size_t)(newline - buffer) + 1;
+
+  // Terminate the line in place (drop '\r' before '\n')
+  size_t line_length = (size_t)(newline - line);
+  if (line_length > 0 && line[line_length - 1] == '\r')
+  {
+    --line_length;
+  }
+  line[line_length] = '\0';
+
+  // Initialize message structure
+  memset(msg, 0, sizeof(message_t));
+  msg->version = PROTOCOL_V1;
+
+#if SHOW_DEBUG
+  printf("[DEBUG] Received line (%zu bytes): '%s'\n", line_length, line);
+#endif
+
+  // Step 1: Validate minimum message format
   if (line_length < 2)
   {
 #if SHOW_WARNING
-    printf("[WARNING] Received too short message from client fd %d: '%s'\n",
-           client_fd, line_buffer);
+    printf("[WARNING] Received too short message: '%s'\n", line);
 #endif
     return (-1);
   }
 
-  // Step 3: Find the pipe separator
-  char *pipe_pos = strchr(line_buffer, '|');
+  // Step 2: Find the pipe separator
+  char *pipe_pos = strchr(line, '|');
   if (!pipe_pos)
   {
 #if SHOW_WARNING
-    printf("[WARNING] Invalid message format from client fd %d (missing '|'): '%s'\n",
-           client_fd, line_buffer);
+    printf("[WARNING] Invalid message format (missing '|'): '%s'\n", line);
 #endif
     return (-1);
   }
 
-  // Step 4: Extract and parse message type
+  // Step 3: Extract and parse message type
   *pipe_pos = '\0'; // Split the string at pipe
-  char *type_str = trim_whitespace(line_buffer);
+  char *type_str = trim_whitespace(line);
   char *payload_str = pipe_pos + 1; // Payload starts after pipe
 
   // Parse message type as integer
@@ -181,87 +237,91 @@ int receive_message(int client_fd, message_t *msg)
   if (*endptr != '\0' || parsed_type < 0 || parsed_type > 1000)
   {
 #if SHOW_WARNING
-    printf("[WARNING] Invalid message type from client fd %d: '%s'\n",
-           client_fd, type_str);
+    printf("[WARNING] Invalid message type: '%s'\n", type_str);
 #endif
     return (-1);
   }
 
-  // Step 5: Populate message_t structure
+  // Step 4: Populate message_t structure
   msg->type = (int)parsed_type;
-
-  // Handle payload
-  size_t payload_len = strlen(payload_str);
-  if (payload_len > MAX_MESSAGE_SIZE - 1)
-  {
-#if SHOW_WARNING
-    printf("[WARNING] Payload too large from client fd %d (%zu bytes), truncating to %d\n",
-           client_fd, payload_len, MAX_MESSAGE_SIZE - 1);
-#endif
-    payload_len = MAX_MESSAGE_SIZE - 1;
-  }
-
-  msg->length = (int)payload_len;
-  if (payload_len > 0)
-  {
-    memcpy(msg->data, payload_str, payload_len);
-  }
-  msg->data[payload_len] = '\0'; // Ensure null termination
+  msg->data = payload_str;
+  msg->length = (size_t)((line + line_length) - payload_str);
 
 #if SHOW_DEBUG
-  printf("[DEBUG] Successfully received message from client fd %d: type=%d, length=%d\n",
-         client_fd, msg->type, msg->length);
+  printf("[DEBUG] Successfully decoded message: type=%d, length=%zu\n",
+         msg->type, msg->length);
   printf("[DEBUG] Message payload: '%.100s%s'\n",
-         msg->data, (payload_len > 100) ? "..." : "");
+         msg->data, (msg->length > 100) ? "..." : "");
 #endif
 
-  return (0);
+  return (1);
 }
 
 /**
- * @brief Parse complete stateless client message into components
- * Expected payload format: "personality_data|language_code|conversation"
- * @param data Input message payload (from msg->data)
- * @param parsed_msg Output structure with parsed components
- * @return 0 on success, -1 on error
+ * @brief Decode a v2 frame header from a connection read buffer
+ * Only the fixed header is decoded; the payload is received by the caller
+ * @param buffer Bytes received from the client
+ * @param length Number of valid bytes in buffer
+ * @param msg Output message (version, type, flags, request_id and length)
+ * @return 1 if a header was decoded, 0 if more data is needed, -1 on invalid
+ *         header (msg->version is PROTOCOL_V2 if the request id is usable)
  */
-int parse_client_dialog_message(const char *data, client_message_t *parsed_msg)
+int decode_frame_header(const char *buffer, size_t length, message_t *msg)
 {
-#if SHOW_DEBUG
-  printf("[DEBUG] Parsing stateless client message payload: %.100s%s\n",
-         data, (strlen(data) > 100) ? "..." : "");
-#endif
-  // Initialize structure
-  memset(parsed_msg, 0, sizeof(client_message_t));
+  if (length < PROTOCOL_V2_HEADER_SIZE)
+  {
+    return (0);
+  }
 
-  // Check for empty data
-  if (!data || strlen(data) == 0)
+  memset(msg, 0, sizeof(message_t));
+
+  if ((unsigned char)buffer[0] != PROTOCOL_V2_MAGIC || buffer[1] != PROTOCOL_V2)
   {
-#if SHOW_ERROR
-    printf("[ERROR] Empty message payload\n");
+#if SHOW_WARNING
+    printf("[WARNING] Invalid v2 frame header (magic 0x%02x, version %d)\n",
+           (unsigned char)buffer[0], buffer[1]);
 #endif
     return (-1);
   }
 
-  // Make a copy since strtok modifies the string
-  char *data_copy = strdup(data);
-  if (!data_copy)
+  msg->version = PROTOCOL_V2;
+  msg->type = read_u16(buffer + 2);
+  msg->flags = read_u16(buffer + 4);
+  msg->request_id = read_u32(buffer + 8);
+  msg->length = read_u32(buffer + 12);
+
+  if (msg->length > PROTOCOL_V2_MAX_PAYLOAD)
   {
-#if SHOW_ERROR
-    printf("[ERROR] Failed to allocate memory for message parsing\n");
+#if SHOW_WARNING
+    printf("[WARNING] v2 frame %u announces %zu bytes (limit %d)\n",
+           msg->request_id, msg->length, PROTOCOL_V2_MAX_PAYLOAD);
 #endif
     return (-1);
   }
 
+#if SHOW_DEBUG
+  printf("[DEBUG] Decoded v2 header: type=%d, id=%u, length=%zu\n",
+         msg->type, msg->request_id, msg->length);
+#endif
+  return (1);
+}
+
+/**
+ * @brief Parse v1 dialog payload "personality|language|conversation" in place
+ */
+static int
+parse_text_dialog_message(char *data, client_message_t *parsed_msg)
+{
   // Parse the three components: personality|language|conversation
   char *parts[3];
   int part_count = 0;
-  char *token = strtok(data_copy, "|");
+  char *save_ptr = NULL;
+  char *token = strtok_r(data, "|", &save_ptr);
 
   while (token != NULL && part_count < 3)
   {
     parts[part_count] = token;
-    token = strtok(NULL, "|");
+    token = strtok_r(NULL, "|", &save_ptr);
     ++part_count;
   }
 
@@ -273,20 +333,120 @@ int parse_client_dialog_message(const char *data, client_message_t *parsed_msg)
     printf("[ERROR] Expected format: personality|language|conversation\n");
     printf("[ERROR] Example: 'extraversion:5.2,agreeableness:4.1|en|[xxx]Hello robot'\n");
 #endif
-    free(data_copy);
     return (-1);
   }
 
-  // Copy components to output structure with bounds checking
-  safe_strncpy(parsed_msg->personality, parts[0], sizeof(parsed_msg->personality));
-  safe_strncpy(parsed_msg->language, parts[1], sizeof(parsed_msg->language));
-  safe_strncpy(parsed_msg->conversation, parts[2], sizeof(parsed_msg->conversation));
+  parsed_msg->personality = parts[0];
+  parsed_msg->language = parts[1];
+  parsed_msg->conversation = parts[2];
+  return (0);
+}
+
+/**
+ * @brief Parse v2 typed fields in place
+ * All field headers are read first, then each value is null-terminated in
+ * place (overwriting the next field's already-parsed tag). Unknown tags are
+ * skipped so newer clients can add fields
+ */
+static int
+parse_binary_dialog_message(char *data, size_t length, client_message_t *parsed_msg)
+{
+  char *values[FIELD_CONVERSATION + 1] = {NULL};
+  size_t lengths[FIELD_CONVERSATION + 1] = {0};
+  size_t offset = 0;
+
+  while (offset < length)
+  {
+    if (length - offset < PROTOCOL_V2_FIELD_HEADER_SIZE)
+    {
+#if SHOW_ERROR
+      printf("[ERROR] Truncated v2 field header at offset %zu\n", offset);
+#endif
+      return (-1);
+    }
+
+    uint16_t tag = read_u16(data + offset);
+    uint32_t field_length = read_u32(data + offset + 2);
+    offset += PROTOCOL_V2_FIELD_HEADER_SIZE;
+
+    if (field_length > length - offset)
+    {
+#if SHOW_ERROR
+      printf("[ERROR] v2 field %u overruns the payload (%u bytes)\n", tag, field_length);
+#endif
+      return (-1);
+    }
+
+    if (tag >= FIELD_PERSONALITY && tag <= FIELD_CONVERSATION)
+    {
+      values[tag] = data + offset;
+      lengths[tag] = field_length;
+    }
+    offset += field_length;
+  }
+
+  for (int tag = FIELD_PERSONALITY; tag <= FIELD_CONVERSATION; ++tag)
+  {
+    if (values[tag])
+    {
+      values[tag][lengths[tag]] = '\0'; // data has a spare byte after the payload
+    }
+    else
+    {
+      values[tag] = data + length; // Missing field: empty string
+    }
+  }
+
+  parsed_msg->personality = values[FIELD_PERSONALITY];
+  parsed_msg->language = values[FIELD_LANGUAGE];
+  parsed_msg->conversation = values[FIELD_CONVERSATION];
+  return (0);
+}
+
+/**
+ * @brief Parse complete stateless client message into components
+ * v1 payload format: "personality_data|language_code|conversation"
+ * v2 payload format: FIELD_PERSONALITY, FIELD_LANGUAGE and FIELD_CONVERSATION
+ * The payload is split in place; parsed_msg points into msg->data
+ * @param msg Received message (payload is modified)
+ * @param parsed_msg Output structure with parsed components
+ * @return 0 on success, -1 on error
+ */
+int parse_client_dialog_message(message_t *msg, client_message_t *parsed_msg)
+{
+#if SHOW_DEBUG
+  printf("[DEBUG] Parsing v%d client message payload: %.100s%s\n", msg->version,
+         msg->data, (msg->length > 100) ? "..." : "");
+#endif
+  // Initialize structure
+  memset(parsed_msg, 0, sizeof(client_message_t));
+
+  // Check for empty data
+  if (!msg->data || msg->length == 0)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Empty message payload\n");
+#endif
+    return (-1);
+  }
+
+  int result = (msg->version == PROTOCOL_V2)
+                   ? parse_binary_dialog_message(msg->data, msg->length, parsed_msg)
+                   : parse_text_dialog_message(msg->data, parsed_msg);
+  if (result != 0)
+  {
+    return (-1);
+  }
+
+  // Language codes are short; keep the historical bound
+  if (strlen(parsed_msg->language) >= MAX_LANGUAGE_SIZE)
+  {
+    ((char *)parsed_msg->language)[MAX_LANGUAGE_SIZE - 1] = '\0';
+  }
 
   // Mark as successfully parsed
   parsed_msg->is_valid = 1;
 
-  free(data_copy);
-
 #if SHOW_INFO
   printf("[INFO] Successfully parsed stateless message:\n");
   printf("[INFO] - Language: %s\n", parsed_msg->language);
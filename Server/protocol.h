@@ -4,7 +4,9 @@
 #include "server.h"
 
 int send_message(int client_fd, int msg_type, const char *data);
-int receive_message(int client_fd, message_t *msg);
-int parse_client_dialog_message(const char *data, client_message_t *parsed_msg);
+int send_reply(int client_fd, const message_t *request, int msg_type, const char *data);
+int decode_message_frame(char *buffer, size_t length, message_t *msg, size_t *consumed);
+int decode_frame_header(const char *buffer, size_t length, message_t *msg);
+int parse_client_dialog_message(message_t *msg, client_message_t *parsed_msg);
 
 #endif /* PROTOCOL_H */
@@ -0,0 +1,349 @@
+/*********************************************************************************
+ * ===== FILE: response_cache.h/response_cache.c =====
+ * In-process cache of AI dialog responses
+ * Sessions that open with the same personality, language and history get
+ * the stored answer instead of another Gemini call. Entries live in
+ * RESPONSE_CACHE_SHARDS independent shards (one lock each), are evicted in
+ * LRU order when a shard is full and expire after RESPONSE_CACHE_TTL_SEC
+ *********************************************************************************/
+
+#include "response_cache.h"
+#include "utils.h"
+
+#define SHARD_CAPACITY (RESPONSE_CACHE_CAPACITY / RESPONSE_CACHE_SHARDS)
+#define SHARD_BUCKETS (SHARD_CAPACITY * 2) // Power of 2: chains stay short
+
+/**
+ * @brief One cached response
+ */
+typedef struct cache_entry
+{
+  uint64_t hash;
+  size_t length[3];          // Key field lengths
+  char *key;                 // Key fields back to back (no terminators)
+  char *response;            // Cached answer
+  time_t expires;            // Monotonic expiry time
+  struct cache_entry *chain; // Next entry in the same bucket
+  struct cache_entry *prev;  // LRU list (head = most recently used)
+  struct cache_entry *next;
+} cache_entry_t;
+
+/**
+ * @brief Independent part of the cache with its own lock
+ */
+typedef struct
+{
+  pthread_mutex_t lock;
+  cache_entry_t *buckets[SHARD_BUCKETS];
+  cache_entry_t *lru_head;
+  cache_entry_t *lru_tail;
+  int count;
+} cache_shard_t;
+
+static cache_shard_t g_shards[RESPONSE_CACHE_SHARDS];
+
+// Statistics
+static atomic_long g_hits;
+static atomic_long g_misses;
+static atomic_long g_evictions;
+static atomic_long g_expirations;
+static atomic_long g_stores;
+
+/**
+ * @brief Current monotonic time in seconds
+ */
+static time_t
+monotonic_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec);
+}
+
+/**
+ * @brief Check whether an entry stores exactly this key
+ */
+static int
+entry_matches(const cache_entry_t *entry, const request_key_t *key)
+{
+  if (entry->hash != key->hash)
+  {
+    return (0);
+  }
+
+  const char *stored = entry->key;
+  for (int i = 0; i < 3; ++i)
+  {
+    if (entry->length[i] != key->length[i] || memcmp(stored, key->field[i], key->length[i]) != 0)
+    {
+      return (0);
+    }
+    stored += key->length[i];
+  }
+  return (1);
+}
+
+/**
+ * @brief Shard and bucket of a hash (different bits for each)
+ */
+static cache_shard_t *
+shard_for(uint64_t hash)
+{
+  return (&g_shards[(hash >> 32) % RESPONSE_CACHE_SHARDS]);
+}
+
+static cache_entry_t **
+bucket_for(cache_shard_t *shard, uint64_t hash)
+{
+  return (&shard->buckets[hash & (SHARD_BUCKETS - 1)]);
+}
+
+/**
+ * @brief Unlink an entry from its shard's LRU list
+ */
+static void
+lru_unlink(cache_shard_t *shard, cache_entry_t *entry)
+{
+  if (entry->prev)
+  {
+    entry->prev->next = entry->next;
+  }
+  else
+  {
+    shard->lru_head = entry->next;
+  }
+  if (entry->next)
+  {
+    entry->next->prev = entry->prev;
+  }
+  else
+  {
+    shard->lru_tail = entry->prev;
+  }
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+/**
+ * @brief Put an entry at the head of its shard's LRU list
+ */
+static void
+lru_push_front(cache_shard_t *shard, cache_entry_t *entry)
+{
+  entry->prev = NULL;
+  entry->next = shard->lru_head;
+  if (shard->lru_head)
+  {
+    shard->lru_head->prev = entry;
+  }
+  else
+  {
+    shard->lru_tail = entry;
+  }
+  shard->lru_head = entry;
+}
+
+/**
+ * @brief Remove an entry from its shard and free it
+ * Caller holds the shard lock
+ */
+static void
+remove_entry(cache_shard_t *shard, cache_entry_t *entry)
+{
+  cache_entry_t **link = bucket_for(shard, entry->hash);
+  while (*link && *link != entry)
+  {
+    link = &(*link)->chain;
+  }
+  if (*link)
+  {
+    *link = entry->chain;
+  }
+
+  lru_unlink(shard, entry);
+  shard->count--;
+  free(entry->key);
+  free(entry->response);
+  free(entry);
+}
+
+/**
+ * @brief Find the entry for a key (caller holds the shard lock)
+ */
+static cache_entry_t *
+find_entry(cache_shard_t *shard, const request_key_t *key)
+{
+  cache_entry_t *entry = *bucket_for(shard, key->hash);
+  while (entry && !entry_matches(entry, key))
+  {
+    entry = entry->chain;
+  }
+  return (entry);
+}
+
+/**
+ * @brief Initialize the cache
+ * @return 0 on success, -1 on error
+ */
+int response_cache_init(void)
+{
+  memset(g_shards, 0, sizeof(g_shards));
+  for (int i = 0; i < RESPONSE_CACHE_SHARDS; ++i)
+  {
+    if (pthread_mutex_init(&g_shards[i].lock, NULL) != 0)
+    {
+      while (--i >= 0)
+      {
+        pthread_mutex_destroy(&g_shards[i].lock);
+      }
+      return (-1);
+    }
+  }
+  return (0);
+}
+
+/**
+ * @brief Free every entry and the shard locks
+ */
+void response_cache_destroy(void)
+{
+  for (int i = 0; i < RESPONSE_CACHE_SHARDS; ++i)
+  {
+    cache_shard_t *shard = &g_shards[i];
+
+    pthread_mutex_lock(&shard->lock);
+    while (shard->lru_head)
+    {
+      remove_entry(shard, shard->lru_head);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    pthread_mutex_destroy(&shard->lock);
+  }
+}
+
+/**
+ * @brief Look up the cached response of a request
+ * @param request Parsed dialog request
+ * @param response Output buffer
+ * @param size Size of the output buffer
+ * @return 0 on hit (response filled), -1 on miss
+ */
+int response_cache_lookup(const client_message_t *request, char *response, size_t size)
+{
+  request_key_t key;
+  request_key_init(&key, request);
+
+  cache_shard_t *shard = shard_for(key.hash);
+  int found = -1;
+
+  pthread_mutex_lock(&shard->lock);
+  cache_entry_t *entry = find_entry(shard, &key);
+  if (entry && entry->expires <= monotonic_seconds())
+  {
+    remove_entry(shard, entry);
+    atomic_fetch_add(&g_expirations, 1);
+    entry = NULL;
+  }
+  if (entry)
+  {
+    lru_unlink(shard, entry);
+    lru_push_front(shard, entry);
+
+    size_t length = strlen(entry->response);
+    if (length >= size)
+    {
+      length = size - 1;
+    }
+    memcpy(response, entry->response, length);
+    response[length] = '\0';
+    found = 0;
+  }
+  pthread_mutex_unlock(&shard->lock);
+
+  atomic_fetch_add(found == 0 ? &g_hits : &g_misses, 1);
+  return (found);
+}
+
+/**
+ * @brief Store (or refresh) the response of a request
+ * Evicts the shard's least recently used entry when it is full
+ * @param request Parsed dialog request
+ * @param response Response to cache
+ */
+void response_cache_store(const client_message_t *request, const char *response)
+{
+  request_key_t key;
+  request_key_init(&key, request);
+
+  // Allocate outside the lock
+  cache_entry_t *entry = calloc(1, sizeof(cache_entry_t));
+  char *stored_key = malloc(key.length[0] + key.length[1] + key.length[2] + 1);
+  char *stored_response = strdup(response);
+  if (!entry || !stored_key || !stored_response)
+  {
+    free(entry);
+    free(stored_key);
+    free(stored_response);
+    return;
+  }
+
+  size_t offset = 0;
+  for (int i = 0; i < 3; ++i)
+  {
+    memcpy(stored_key + offset, key.field[i], key.length[i]);
+    entry->length[i] = key.length[i];
+    offset += key.length[i];
+  }
+  entry->hash = key.hash;
+  entry->key = stored_key;
+  entry->response = stored_response;
+  entry->expires = monotonic_seconds() + RESPONSE_CACHE_TTL_SEC;
+
+  cache_shard_t *shard = shard_for(key.hash);
+
+  pthread_mutex_lock(&shard->lock);
+  cache_entry_t *old = find_entry(shard, &key);
+  if (old)
+  {
+    remove_entry(shard, old);
+  }
+  else if (shard->count >= SHARD_CAPACITY)
+  {
+    remove_entry(shard, shard->lru_tail);
+    atomic_fetch_add(&g_evictions, 1);
+  }
+
+  cache_entry_t **bucket = bucket_for(shard, key.hash);
+  entry->chain = *bucket;
+  *bucket = entry;
+  lru_push_front(shard, entry);
+  shard->count++;
+  pthread_mutex_unlock(&shard->lock);
+
+  atomic_fetch_add(&g_stores, 1);
+}
+
+/**
+ * @brief Print cache statistics
+ */
+void response_cache_print_stats(void)
+{
+  long hits = atomic_load(&g_hits);
+  long misses = atomic_load(&g_misses);
+  int entries = 0;
+
+  for (int i = 0; i < RESPONSE_CACHE_SHARDS; ++i)
+  {
+    pthread_mutex_lock(&g_shards[i].lock);
+    entries += g_shards[i].count;
+    pthread_mutex_unlock(&g_shards[i].lock);
+  }
+
+  printf("\n=== RESPONSE CACHE STATISTICS ===\n");
+  printf("Entries: %d / %d (%d shards)\n", entries, RESPONSE_CACHE_CAPACITY, RESPONSE_CACHE_SHARDS);
+  printf("Hits: %ld, misses: %ld (%.1f%% hit rate)\n", hits, misses,
+         (hits + misses) > 0 ? 100.0 * hits / (hits + misses) : 0.0);
+  printf("Stores: %ld, evictions: %ld, expirations: %ld\n",
+         atomic_load(&g_stores), atomic_load(&g_evictions), atomic_load(&g_expirations));
+  printf("=================================\n\n");
+}
@@ -0,0 +1,12 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include "server.h"
+
+int response_cache_init(void);
+void response_cache_destroy(void);
+int response_cache_lookup(const client_message_t * request, char * response, size_t size);
+void response_cache_store(const client_message_t * request, const char * response);
+void response_cache_print_stats(void);
+
+#endif /* RESPONSE_CACHE_H */
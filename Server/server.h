@@ -6,8 +6,14 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+// accept4() and SOCK_NONBLOCK are GNU extensions
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 // Standard C libraries
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -22,6 +28,7 @@
 #include <sys/types.h>
 #include <ctype.h>
 #include <stdatomic.h>
+#include <stdint.h>
 
 // External libraries for AI integration
 #include <curl/curl.h>   // For HTTP requests to Gemini API
@@ -32,16 +39,30 @@
 
 /**
  * @brief Client message structure
- * Used temporarily to parse the complete client message
+ * Fields of a dialog request, pointing into the request payload (no copies)
  */
 typedef struct
 {
-  char personality[MAX_PERSONALITY_SIZE];   // Personality
-  char language[MAX_LANGUAGE_SIZE];         // Language code (en, it, es, fr)
-  char conversation[MAX_CONVERSATION_SIZE]; // JSON conversation history
-  int is_valid;                             // 1 if parsing was successful
+  const char *personality;  // Personality
+  const char *language;     // Language code (en, it, es, fr)
+  const char *conversation; // JSON conversation history
+  int is_valid;             // 1 if parsing was successful
 } client_message_t;
 
+/**
+ * @brief Normalized identity of a dialog request
+ * Two requests with equal keys get the same AI answer: personality and
+ * conversation are trimmed, language is trimmed and lowercased. Views point
+ * into the request (language into the key itself)
+ */
+typedef struct
+{
+  const char *field[3];              // Personality, language, conversation
+  size_t length[3];                  // Field lengths
+  char language[MAX_LANGUAGE_SIZE];  // Lowercased language
+  uint64_t hash;                     // FNV-1a of the fields and their lengths
+} request_key_t;
+
 /**
  * @brief AI response structure
  * Contains the response from Gemini AI with behavioral instructions
@@ -58,54 +79,214 @@ typedef struct
  */
 typedef struct
 {
-  int type;                    // Message type
-  int length;                  // Length of data field
-  char data[MAX_MESSAGE_SIZE]; // Message payload
+  int version;         // Framing the message arrived with (PROTOCOL_V1/V2)
+  int type;            // Message type
+  unsigned int flags;  // Header flags (v2 only)
+  uint32_t request_id; // Request id echoed in the reply (v2 only)
+  size_t length;       // Length of data field
+  char *data;          // Message payload, null-terminated
 } message_t;
 
+/**
+ * @brief Client request
+ * A complete frame handed from the event loop to a worker thread. The
+ * payload is stored right after the structure in the same allocation
+ */
+typedef struct
+{
+  int client_fd; // Connection the frame was received on
+  message_t msg; // Decoded frame (msg.data points past this structure)
+} client_request_t;
+
 /**
  * @brief Thread pool task
- * Represents work to be done by worker threads
+ * Represents work to be done by worker threads. Tasks are nodes of a
+ * per-pool slab, one cache line each, recycled through a free stack
  */
 typedef struct task
 {
-  void (*function)(void *); // Function to execute
-  void *argument;           // Argument to pass to function
-  struct task *next;        // Next task in queue
+  _Alignas(64) void (*function)(void *); // Function to execute
+  void *argument;                        // Argument to pass to function
+  atomic_uint next_free;                 // Next node of the free stack
 } task_t;
 
+/**
+ * @brief Slot of the task queue ring
+ * The sequence says whose turn it is: the producer of position p fills
+ * the slot when sequence == p, the consumer empties it when sequence == p + 1
+ */
+typedef struct
+{
+  atomic_size_t sequence; // Turn of the slot (see above)
+  void *item;             // Queued item
+} task_slot_t;
+
+/**
+ * @brief Bounded lock-free multi-producer multi-consumer queue
+ * Idle consumers park on an eventfd instead of a condition variable
+ */
+typedef struct
+{
+  task_slot_t *slots;                       // Ring of mask + 1 slots
+  size_t mask;                              // Capacity - 1 (capacity is a power of 2)
+  _Alignas(64) atomic_size_t enqueue_pos;   // Next position to fill
+  _Alignas(64) atomic_size_t dequeue_pos;   // Next position to empty
+  _Alignas(64) atomic_int sleepers;         // Consumers parked, not yet claimed by a producer
+  int wake_fd;                              // eventfd (semaphore mode) parked consumers read
+} task_queue_t;
+
+/**
+ * @brief Work-stealing deque of one worker (Chase-Lev)
+ * Only the owner pushes and takes at the bottom; others steal at the top
+ */
+typedef struct
+{
+  _Atomic(task_t *) *buffer;       // Ring of mask + 1 tasks
+  long mask;                       // Capacity - 1 (capacity is a power of 2)
+  _Alignas(64) atomic_long top;    // Oldest task (advanced by thieves and the owner)
+  _Alignas(64) atomic_long bottom; // Next free position (written by the owner only)
+} task_deque_t;
+
+/**
+ * @brief How the thread pool hands tasks to its workers
+ */
+typedef enum
+{
+  THREAD_POOL_FIFO,  // One queue shared by all workers
+  THREAD_POOL_STEAL  // A deque and an inbox per worker; idle workers steal
+} thread_pool_scheduler_t;
+
+/**
+ * @brief Life cycle of a thread pool slot
+ */
+typedef enum
+{
+  WORKER_FREE,    // No thread
+  WORKER_RUNNING, // Thread running (it may be about to retire)
+  WORKER_EXITED   // Thread retired, waiting to be joined
+} worker_state_t;
+
+/**
+ * @brief Per-worker state of the thread pool (one per thread slot)
+ */
+typedef struct thread_pool_worker
+{
+  struct thread_pool *pool; // Pool the worker belongs to
+  int index;                // Slot in pool->threads
+  atomic_int state;         // worker_state_t of the slot
+  task_deque_t deque;       // Tasks the worker submitted itself (steal scheduler)
+  task_queue_t inbox;       // Tasks other threads gave it (steal scheduler)
+} thread_pool_worker_t;
+
+/**
+ * @brief Autoscaling policy of the thread pool controller
+ */
+typedef struct
+{
+  const char *name;
+  double utilization;   // Fraction of busy workers aimed for
+  double max_wait_ms;   // Queue wait above which workers are added
+  double smoothing_ms;  // Time constant of the moving averages
+  double hysteresis;    // How far below the thread count (fraction) the target must be to shrink
+  long shrink_delay_ms; // How long it must stay there first
+} thread_pool_policy_t;
+
 /**
  * @brief Thread pool management
  * Handles concurrent processing of client requests
  */
-typedef struct
+typedef struct thread_pool
 {
-  pthread_t *threads; // Array of worker threads
-  int thread_count;   // Number of threads in pool
-  int min_threads;    // Minimum thread count
-  int max_threads;    // Maximum thread count
+  pthread_t *threads;             // Array of worker threads (slots need not be contiguous)
+  thread_pool_worker_t *workers;  // Worker state, one per thread slot
+  int thread_count;               // Number of threads in pool (not counting those due to retire)
+  int min_threads;                // Minimum thread count
+  int max_threads;                // Maximum thread count
+  thread_pool_scheduler_t scheduler;
 
   // Task queue
-  task_t *queue_head; // First task in queue
-  task_t *queue_tail; // Last task in queue
+  task_queue_t queue;                            // Tasks waiting for a worker (lock-free); with the
+                                                 // steal scheduler, overflow and parking of idle workers
+  task_t *task_slab;                             // THREAD_POOL_QUEUE_CAPACITY task nodes
+  _Alignas(64) atomic_uint_least64_t free_tasks; // Top of the free node stack (ABA tag << 32 | index)
+  atomic_uint next_worker;                       // Round-robin target of the steal scheduler
 
   // Synchronization
-  pthread_mutex_t queue_mutex; // Protects task queue
-  pthread_cond_t queue_cond;   // Signals when work available
-  int shutdown;                // 1 when shutting down
+  pthread_mutex_t scale_mutex; // Serializes scaling (thread array and count)
+  atomic_int shutdown;         // 1 when shutting down
+  atomic_int retire_tokens;    // Workers asked to exit; each idle worker may take one
 
   // Auto-scaling metrics
   atomic_int active_threads;         // Number of threads currently working
-  atomic_int queue_size;             // Current queue size
   atomic_long total_tasks_completed; // Total tasks completed
-  time_t last_scale_time;            // Last time we checked for scaling
+
+  // Autoscaling controller (see thread_pool_auto_scale())
+  const thread_pool_policy_t *policy; // Targets of the controller
+  pthread_t controller;               // Thread running the controller every THREAD_POOL_CONTROL_INTERVAL_MS
+  pthread_mutex_t controller_mutex;   // Guards controller_stop
+  pthread_cond_t controller_cond;     // Signalled to stop the controller
+  int controller_stop;                // 1 when the controller must exit
+  double busy_ewma;                   // Moving average of busy workers
+  double queued_ewma;                 // Moving average of queued tasks
+  double arrival_ewma;                // Moving average of the arrival rate (tasks/s)
+  double wait_ewma_ms;                // Queue wait derived from the averages (Little's law)
+  int target_threads;                 // Thread count last computed by the controller
+  long below_since_ms;                // Since when the target is below the thread count (0 = it is not)
+  long sampled_ms;                    // Time of the last sample
+  long sampled_completed;             // total_tasks_completed at the last sample
+  size_t sampled_queued;              // Queued tasks at the last sample
 
   // Performance tracking
   atomic_long total_task_time_ms; // Total time spent on tasks
   atomic_long min_task_time_ms;   // Minimum task time
   atomic_long max_task_time_ms;   // Maximum task time
+  atomic_long tasks_stolen;       // Tasks run by a worker other than the one they were given to
 } thread_pool_t;
 
+/**
+ * @brief Event loop (reactor)
+ * Each reactor owns a listening socket and an epoll instance; connections
+ * accepted by a reactor are monitored by that reactor only
+ */
+typedef struct
+{
+  int id;           // Reactor index
+  int listen_fd;    // Listening socket (SO_REUSEPORT when several reactors)
+  int epoll_fd;     // epoll instance for async I/O (-1 with io_uring)
+  void *uring;      // io_uring backend state (USE_IO_URING builds only)
+  pthread_t thread; // Thread running the loop (reactor 0 runs on main)
+} reactor_t;
+
+/**
+ * @brief Client connection state
+ * Tracks a client socket owned by a reactor (indexed by fd). Bytes are
+ * buffered here by the event loop until a complete frame is available.
+ * v1 connections serve one request at a time; v2 keep-alive connections
+ * multiplex up to PROTOCOL_V2_MAX_IN_FLIGHT requests, answered by request id
+ */
+typedef struct
+{
+  pthread_mutex_t lock;       // Protects this connection slot
+  pthread_mutex_t write_lock; // Serializes replies written by concurrent workers
+  reactor_t *reactor;         // Reactor that accepted the connection
+  unsigned int generation;    // Incremented on every accept of this fd
+  int in_use;                 // 1 when the slot holds an open connection
+  int in_flight;              // Requests currently being served by workers
+  int closing;                // 1 when the close waits for in-flight requests
+  int registered;             // 1 while the reactor is reading from the fd
+  int peer_closed;            // 1 once the peer has shut down its side
+  time_t last_activity;       // Last time a request completed on this connection
+  int protocol;               // Framing chosen by the first frame (0 = not known yet)
+
+  // Read buffer filled by the event loop
+  char *read_buffer; // BUFFER_SIZE bytes, allocated on accept
+  size_t read_len;   // Number of buffered bytes not yet consumed
+
+  // v2 frame whose payload is received straight into its final allocation
+  client_request_t *pending; // NULL when no payload is being assembled
+  size_t pending_filled;     // Payload bytes received so far
+} connection_t;
+
 /**
  * @brief Main server context
  * Contains all server state and configuration
@@ -113,17 +294,22 @@ typedef struct
 typedef struct
 {
   // Network components
-  int server_fd; // Main server socket
-  int epoll_fd;  // epoll instance for async I/O
+  reactor_t reactors[MAX_REACTORS]; // Event loops
+  int reactor_count;                // Number of running reactors
 
   // Processing
   thread_pool_t *pool; // Thread pool for request processing
 
+  // Keep-alive connections
+  int keep_alive;                        // 1 when client connections stay open
+  connection_t connections[MAX_CLIENTS]; // Connection table indexed by fd
+
   // Server state
   volatile int running; // 1 when server should keep running
 
   // AI configuration
-  char gemini_api_key[256]; // Google Gemini API key
+  char gemini_api_base[512];    // Model endpoint URL (GEMINI_API_BASE_URL by default)
+  long conversation_max_tokens; // Token budget of the history sent upstream (0 = unlimited)
 } server_context_t;
 
 #endif /* SERVER_H */
@@ -0,0 +1,129 @@
+/*********************************************************************************
+ * ===== FILE: single_flight.h/single_flight.c =====
+ * Coalescing of identical AI requests that are in flight at the same time
+ * The first request for a key leads the flight and makes the upstream call;
+ * identical requests arriving before it completes join as waiters and are
+ * answered from the leader's result. Waiters hold no thread while waiting
+ *********************************************************************************/
+
+#include "single_flight.h"
+#include "utils.h"
+
+/**
+ * @brief One upstream call and the requests waiting on it
+ */
+struct single_flight
+{
+  request_key_t key;             // Views into the leader's request payload
+  flight_waiter_t *waiters_head; // Joined requests, in arrival order
+  flight_waiter_t *waiters_tail;
+  int waiter_count;
+  struct single_flight *chain;   // Next flight in the same bucket
+};
+
+static pthread_mutex_t g_flight_lock = PTHREAD_MUTEX_INITIALIZER;
+static single_flight_t *g_flights[SINGLE_FLIGHT_BUCKETS];
+
+// Statistics
+static atomic_long g_leaders;
+static atomic_long g_coalesced;
+static atomic_int g_peak_waiters;
+
+/**
+ * @brief Join the flight for a key, or start one
+ * @param key Normalized request key (its views must outlive the flight)
+ * @param waiter Link embedded in the caller's request
+ * @param flight Set to the new flight when the caller leads it, else NULL
+ * @return 1 if the caller joined an existing flight (it is answered by
+ *         the leader), 0 if it leads a new flight (it must call
+ *         single_flight_finish), -1 if no flight could be created
+ */
+int single_flight_join(const request_key_t *key, flight_waiter_t *waiter, single_flight_t **flight)
+{
+  single_flight_t **bucket = &g_flights[key->hash % SINGLE_FLIGHT_BUCKETS];
+  *flight = NULL;
+
+  pthread_mutex_lock(&g_flight_lock);
+  for (single_flight_t *current = *bucket; current; current = current->chain)
+  {
+    if (request_key_equal(&current->key, key))
+    {
+      waiter->next = NULL;
+      if (current->waiters_tail)
+      {
+        current->waiters_tail->next = waiter;
+      }
+      else
+      {
+        current->waiters_head = waiter;
+      }
+      current->waiters_tail = waiter;
+      int waiters = ++current->waiter_count;
+      pthread_mutex_unlock(&g_flight_lock);
+
+      atomic_fetch_add(&g_coalesced, 1);
+      int peak = atomic_load(&g_peak_waiters);
+      while (waiters > peak && !atomic_compare_exchange_weak(&g_peak_waiters, &peak, waiters))
+      {
+      }
+      return (1);
+    }
+  }
+
+  single_flight_t *created = calloc(1, sizeof(single_flight_t));
+  if (!created)
+  {
+    pthread_mutex_unlock(&g_flight_lock);
+    return (-1);
+  }
+  created->key = *key;
+  created->key.field[1] = created->key.language; // Language view lives in the key
+  created->chain = *bucket;
+  *bucket = created;
+  pthread_mutex_unlock(&g_flight_lock);
+
+  atomic_fetch_add(&g_leaders, 1);
+  *flight = created;
+  return (0);
+}
+
+/**
+ * @brief End a flight: later identical requests start a new one
+ * @param flight Flight led by the caller (freed here)
+ * @return The waiters to answer, in arrival order
+ */
+flight_waiter_t *single_flight_finish(single_flight_t *flight)
+{
+  single_flight_t **link = &g_flights[flight->key.hash % SINGLE_FLIGHT_BUCKETS];
+
+  pthread_mutex_lock(&g_flight_lock);
+  while (*link && *link != flight)
+  {
+    link = &(*link)->chain;
+  }
+  if (*link)
+  {
+    *link = flight->chain;
+  }
+  pthread_mutex_unlock(&g_flight_lock);
+
+  flight_waiter_t *waiters = flight->waiters_head;
+  free(flight);
+  return (waiters);
+}
+
+/**
+ * @brief Print coalescing statistics
+ */
+void single_flight_print_stats(void)
+{
+  long leaders = atomic_load(&g_leaders);
+  long coalesced = atomic_load(&g_coalesced);
+
+  printf("\n=== SINGLE-FLIGHT STATISTICS ===\n");
+  printf("Upstream calls led: %ld\n", leaders);
+  printf("Requests coalesced: %ld (%.1f%% of AI requests)\n", coalesced,
+         (leaders + coalesced) > 0 ? 100.0 * coalesced / (leaders + coalesced) : 0.0);
+  printf("Peak waiters on one call: %d\n", atomic_load(&g_peak_waiters));
+  printf("================================\n\n");
+}
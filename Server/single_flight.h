@@ -0,0 +1,20 @@
+#ifndef SINGLE_FLIGHT_H
+#define SINGLE_FLIGHT_H
+
+#include "server.h"
+
+typedef struct single_flight single_flight_t;
+
+/**
+ * @brief Link embedded in a request waiting on another request's AI call
+ */
+typedef struct flight_waiter
+{
+  struct flight_waiter *next;
+} flight_waiter_t;
+
+int single_flight_join(const request_key_t * key, flight_waiter_t * waiter, single_flight_t ** flight);
+flight_waiter_t * single_flight_finish(single_flight_t * flight);
+void single_flight_print_stats(void);
+
+#endif /* SINGLE_FLIGHT_H */
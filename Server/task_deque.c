@@ -0,0 +1,124 @@
+/*********************************************************************************
+ * ===== FILE: task_deque.h/task_deque.c =====
+ * Work-stealing deque of one thread pool worker (Chase-Lev)
+ * The owner pushes and takes tasks at the bottom, newest first, without a
+ * CAS except when it races for the last task; other workers steal the
+ * oldest tasks from the top with one CAS. Bounded: a full deque refuses
+ * the task and the pool queues it elsewhere. Memory orders follow Lê et
+ * al., "Correct and Efficient Work-Stealing for Weak Memory Models"
+ *********************************************************************************/
+
+#include "task_deque.h"
+
+/**
+ * @brief Create a deque
+ * @param capacity Number of slots (power of 2)
+ * @return 0 on success, -1 on error
+ */
+int task_deque_init(task_deque_t *deque, long capacity)
+{
+  if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+  {
+    return (-1);
+  }
+
+  deque->buffer = malloc(capacity * sizeof(deque->buffer[0]));
+  if (!deque->buffer)
+  {
+    return (-1);
+  }
+  for (long i = 0; i < capacity; ++i)
+  {
+    atomic_init(&deque->buffer[i], NULL);
+  }
+  deque->mask = capacity - 1;
+  atomic_init(&deque->top, 0);
+  atomic_init(&deque->bottom, 0);
+  return (0);
+}
+
+/**
+ * @brief Free a deque (tasks still queued are not freed)
+ */
+void task_deque_destroy(task_deque_t *deque)
+{
+  free(deque->buffer);
+  deque->buffer = NULL;
+}
+
+/**
+ * @brief Add a task at the bottom (owner only)
+ * @return 0 on success, -1 if the deque is full
+ */
+int task_deque_push(task_deque_t *deque, task_t *task)
+{
+  long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  if (bottom - top > deque->mask)
+  {
+    return (-1);
+  }
+
+  // Release: a thief that sees the new bottom also sees the task's contents
+  atomic_store_explicit(&deque->buffer[bottom & deque->mask], task, memory_order_relaxed);
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+  return (0);
+}
+
+/**
+ * @brief Take the newest task (owner only)
+ * @return The task, or NULL if the deque is empty
+ */
+task_t *task_deque_take(task_deque_t *deque)
+{
+  long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  if (top > bottom)
+  {
+    // Empty: undo the reservation
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return (NULL);
+  }
+
+  task_t *task = atomic_load_explicit(&deque->buffer[bottom & deque->mask], memory_order_relaxed);
+  if (top == bottom)
+  {
+    // Last task: thieves may want it too, the CAS on top decides
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+    {
+      task = NULL;
+    }
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return (task);
+}
+
+/**
+ * @brief Steal the oldest task (any thread)
+ * A steal lost to a concurrent one is retried, so NULL means empty
+ * @return The task, or NULL if the deque is empty
+ */
+task_t *task_deque_steal(task_deque_t *deque)
+{
+  for (;;)
+  {
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom)
+    {
+      return (NULL);
+    }
+
+    task_t *task = atomic_load_explicit(&deque->buffer[top & deque->mask], memory_order_relaxed);
+    if (atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                memory_order_seq_cst, memory_order_relaxed))
+    {
+      return (task);
+    }
+  }
+}
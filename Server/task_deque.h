@@ -0,0 +1,12 @@
+#ifndef TASK_DEQUE_H
+#define TASK_DEQUE_H
+
+#include "server.h"
+
+int task_deque_init(task_deque_t * deque, long capacity);
+void task_deque_destroy(task_deque_t * deque);
+int task_deque_push(task_deque_t * deque, task_t * task);
+task_t * task_deque_take(task_deque_t * deque);
+task_t * task_deque_steal(task_deque_t * deque);
+
+#endif /* TASK_DEQUE_H */
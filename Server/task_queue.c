@@ -0,0 +1,303 @@
+/*********************************************************************************
+ * ===== FILE: task_queue.h/task_queue.c =====
+ * Bounded lock-free task queue of the thread pool
+ * A ring of sequence-numbered slots (Vyukov's MPMC queue): producers and
+ * consumers claim positions with one CAS each and never wait on a lock.
+ * Idle consumers park on an eventfd in semaphore mode. A producer only
+ * makes a system call when a consumer is parked, and then wakes exactly
+ * one; a busy pool enqueues and dequeues without entering the kernel
+ *********************************************************************************/
+
+#include "task_queue.h"
+#include <sys/eventfd.h>
+
+/**
+ * @brief Create a queue
+ * @param capacity Number of slots (power of 2, at least 2)
+ * @return 0 on success, -1 on error
+ */
+int task_queue_init(task_queue_t *queue, size_t capacity)
+{
+  if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+  {
+    return (-1);
+  }
+
+  queue->slots = malloc(capacity * sizeof(task_slot_t));
+  if (!queue->slots)
+  {
+    return (-1);
+  }
+  queue->wake_fd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
+  if (queue->wake_fd < 0)
+  {
+    free(queue->slots);
+    return (-1);
+  }
+
+  for (size_t i = 0; i < capacity; ++i)
+  {
+    atomic_init(&queue->slots[i].sequence, i);
+    queue->slots[i].item = NULL;
+  }
+  queue->mask = capacity - 1;
+  atomic_init(&queue->enqueue_pos, 0);
+  atomic_init(&queue->dequeue_pos, 0);
+  atomic_init(&queue->sleepers, 0);
+  return (0);
+}
+
+/**
+ * @brief Free a queue (items still queued are not freed)
+ */
+void task_queue_destroy(task_queue_t *queue)
+{
+  close(queue->wake_fd);
+  free(queue->slots);
+  queue->slots = NULL;
+}
+
+/**
+ * @brief Wake one parked consumer, if any
+ * The fence pairs with the one in task_queue_park_prepare(): either the
+ * consumer finds the item just made available, or this sees it parked
+ */
+void task_queue_notify(task_queue_t *queue)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  int sleepers = atomic_load_explicit(&queue->sleepers, memory_order_relaxed);
+  while (sleepers > 0)
+  {
+    // Claim one sleeper so that concurrent producers wake different ones
+    if (atomic_compare_exchange_weak(&queue->sleepers, &sleepers, sleepers - 1))
+    {
+      uint64_t one = 1;
+      ssize_t written = write(queue->wake_fd, &one, sizeof(one));
+      (void)written;
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Add an item without waking a consumer
+ * For callers that park consumers on another queue (see task_queue_notify())
+ * @param item Item to queue (not NULL)
+ * @return 0 on success, -1 if the queue is full
+ */
+int task_queue_offer(task_queue_t *queue, void *item)
+{
+  size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+  task_slot_t *slot;
+
+  for (;;)
+  {
+    slot = &queue->slots[pos & queue->mask];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+    if (diff == 0)
+    {
+      // The slot is free for this position: claim the position
+      if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      return (-1); // Still holds the item of the previous lap
+    }
+    else
+    {
+      pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    }
+  }
+
+  slot->item = item;
+  atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+  return (0);
+}
+
+/**
+ * @brief Add an item, waking a parked consumer if there is one
+ * @param item Item to queue (not NULL)
+ * @return 0 on success, -1 if the queue is full
+ */
+int task_queue_push(task_queue_t *queue, void *item)
+{
+  if (task_queue_offer(queue, item) != 0)
+  {
+    return (-1);
+  }
+  task_queue_notify(queue);
+  return (0);
+}
+
+/**
+ * @brief Take the oldest item without waiting
+ * @return The item, or NULL if the queue is empty
+ */
+void *task_queue_pop(task_queue_t *queue)
+{
+  size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+  task_slot_t *slot;
+
+  for (;;)
+  {
+    slot = &queue->slots[pos & queue->mask];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      return (NULL); // Not filled yet
+    }
+    else
+    {
+      pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    }
+  }
+
+  void *item = slot->item;
+  // Free the slot for the producer of the next lap
+  atomic_store_explicit(&slot->sequence, pos + queue->mask + 1, memory_order_release);
+  return (item);
+}
+
+/**
+ * @brief Announce that the caller is about to park
+ * It must then look for work once more, and either find none and call
+ * task_queue_park(), or call task_queue_park_cancel()
+ */
+void task_queue_park_prepare(task_queue_t *queue)
+{
+  atomic_fetch_add(&queue->sleepers, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * @brief Withdraw an announced park that did not happen after all
+ * If a producer already claimed it, the wakeup it sent is consumed so that
+ * it does not wake another consumer for nothing
+ */
+void task_queue_park_cancel(task_queue_t *queue)
+{
+  int sleepers = atomic_load(&queue->sleepers);
+  while (sleepers > 0)
+  {
+    if (atomic_compare_exchange_weak(&queue->sleepers, &sleepers, sleepers - 1))
+    {
+      return;
+    }
+  }
+
+  uint64_t value;
+  while (read(queue->wake_fd, &value, sizeof(value)) < 0 && errno == EINTR)
+  {
+  }
+}
+
+/**
+ * @brief Block until a producer, task_queue_wake() or task_queue_close()
+ * wakes the caller
+ * Must follow task_queue_park_prepare()
+ */
+void task_queue_park(task_queue_t *queue)
+{
+  uint64_t value;
+  while (read(queue->wake_fd, &value, sizeof(value)) < 0 && errno == EINTR)
+  {
+  }
+}
+
+/**
+ * @brief Take an item, parking until a producer pushes one
+ * @param find Looks for an item, NULL to pop the oldest one of the queue
+ * @param stop Tells not to park after all (e.g. at shutdown), may be NULL
+ * @param context Argument of find and stop
+ * @return The item, or NULL when woken without one (see task_queue_wake())
+ *         or when stop asked not to park
+ */
+void *task_queue_wait(task_queue_t *queue, task_queue_find_t find, task_queue_stop_t stop, void *context)
+{
+  void *item = find ? find(context) : task_queue_pop(queue);
+
+  // Parking costs two system calls and a context switch: give producers a
+  // few chances to run first
+  for (int spin = 0; !item && spin < THREAD_POOL_QUEUE_SPINS; ++spin)
+  {
+    sched_yield();
+    item = find ? find(context) : task_queue_pop(queue);
+  }
+  if (item)
+  {
+    return (item);
+  }
+
+  // Announce the park, then look again (see task_queue_notify())
+  task_queue_park_prepare(queue);
+  item = find ? find(context) : task_queue_pop(queue);
+  if (item || (stop && stop(context)))
+  {
+    task_queue_park_cancel(queue);
+    return (item);
+  }
+
+  task_queue_park(queue);
+  return (find ? find(context) : task_queue_pop(queue));
+}
+
+/**
+ * @brief Wake parked consumers without an item (e.g. to check a flag)
+ * Only consumers already parked are woken: one that parks later must
+ * look at the flag itself after task_queue_park_prepare()
+ * @param count Consumers to wake at most
+ * @return Number of consumers woken
+ */
+int task_queue_wake(task_queue_t *queue, int count)
+{
+  int sleepers = atomic_load(&queue->sleepers);
+  int claimed;
+  do
+  {
+    claimed = sleepers < count ? sleepers : count;
+    if (claimed <= 0)
+    {
+      return (0);
+    }
+  } while (!atomic_compare_exchange_weak(&queue->sleepers, &sleepers, sleepers - claimed));
+
+  uint64_t value = (uint64_t)claimed;
+  ssize_t written = write(queue->wake_fd, &value, sizeof(value));
+  (void)written;
+  return (claimed);
+}
+
+/**
+ * @brief Wake every consumer, now and for good (the queue is shutting down)
+ * From then on parking returns at once, so no consumer can miss it
+ */
+void task_queue_close(task_queue_t *queue)
+{
+  uint64_t value = UINT32_MAX;
+  ssize_t written = write(queue->wake_fd, &value, sizeof(value));
+  (void)written;
+}
+
+/**
+ * @brief Number of queued items (a snapshot)
+ */
+size_t task_queue_size(task_queue_t *queue)
+{
+  size_t dequeued = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+  size_t enqueued = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+  return (enqueued > dequeued ? enqueued - dequeued : 0);
+}
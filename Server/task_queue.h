@@ -0,0 +1,25 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include "server.h"
+
+/** @brief Look for an item to take (NULL if there is none) */
+typedef void *(*task_queue_find_t)(void * context);
+/** @brief Tell a consumer about to park to return instead */
+typedef int (*task_queue_stop_t)(void * context);
+
+int task_queue_init(task_queue_t * queue, size_t capacity);
+void task_queue_destroy(task_queue_t * queue);
+int task_queue_offer(task_queue_t * queue, void * item);
+int task_queue_push(task_queue_t * queue, void * item);
+void * task_queue_pop(task_queue_t * queue);
+void task_queue_notify(task_queue_t * queue);
+void task_queue_park_prepare(task_queue_t * queue);
+void task_queue_park_cancel(task_queue_t * queue);
+void task_queue_park(task_queue_t * queue);
+void * task_queue_wait(task_queue_t * queue, task_queue_find_t find, task_queue_stop_t stop, void * context);
+int task_queue_wake(task_queue_t * queue, int count);
+void task_queue_close(task_queue_t * queue);
+size_t task_queue_size(task_queue_t * queue);
+
+#endif /* TASK_QUEUE_H */
@@ -4,82 +4,276 @@
  *********************************************************************************/
 
 #include "thread_pool.h"
+#include "task_deque.h"
+#include "task_queue.h"
 #include "utils.h"
 
+#define TASK_NONE UINT32_MAX // Index ending the free node stack
+
+// Scheduler of the pools created from now on (see thread_pool_set_scheduler())
+static thread_pool_scheduler_t g_scheduler = THREAD_POOL_FIFO;
+
+// Worker running on this thread, NULL outside the pools
+static __thread thread_pool_worker_t *tls_worker = NULL;
+
+// Autoscaling policies (see thread_pool_auto_scale())
+static const thread_pool_policy_t POLICIES[] = {
+    // name, utilization, max_wait_ms, smoothing_ms, hysteresis, shrink_delay_ms
+    {"latency", 0.5, 5.0, 200.0, 0.25, 5000},
+    {"balanced", 0.7, 20.0, 500.0, 0.25, 3000},
+    {"throughput", 0.85, 100.0, 1000.0, 0.2, 2000},
+};
+
+// Policy of the pools created from now on (see thread_pool_set_policy())
+static const thread_pool_policy_t *g_policy = &POLICIES[1];
+
+/**
+ * @brief Current monotonic time in milliseconds
+ */
+static long
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000L + ts.tv_nsec / 1000000L);
+}
+
+/**
+ * @brief Take a task node from the pool's free stack
+ * The top carries a tag bumped on every change, so a node popped and
+ * pushed back between the load and the CAS cannot be mistaken for it (ABA)
+ * @return A node, or NULL if all THREAD_POOL_QUEUE_CAPACITY nodes are in use
+ */
+static task_t *
+acquire_task(thread_pool_t *pool)
+{
+  uint_least64_t top = atomic_load_explicit(&pool->free_tasks, memory_order_acquire);
+  for (;;)
+  {
+    uint32_t index = (uint32_t)top;
+    if (index == TASK_NONE)
+    {
+      return (NULL);
+    }
+    task_t *task = &pool->task_slab[index];
+    uint_least64_t next = atomic_load_explicit(&task->next_free, memory_order_relaxed);
+    if (atomic_compare_exchange_weak_explicit(&pool->free_tasks, &top,
+                                              (((top >> 32) + 1) << 32) | next,
+                                              memory_order_acquire, memory_order_acquire))
+    {
+      return (task);
+    }
+  }
+}
+
 /**
- * @brief Handler function to delete thread
+ * @brief Give a task node back to the pool's free stack
  */
 static void
-thread_cleanup(void *mutex)
+release_task(thread_pool_t *pool, task_t *task)
 {
-  pthread_mutex_unlock(mutex);
+  uint_least64_t index = (uint_least64_t)(task - pool->task_slab);
+  uint_least64_t top = atomic_load_explicit(&pool->free_tasks, memory_order_relaxed);
+  do
+  {
+    atomic_store_explicit(&task->next_free, (uint32_t)top, memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak_explicit(&pool->free_tasks, &top,
+                                                  (((top >> 32) + 1) << 32) | index,
+                                                  memory_order_release, memory_order_relaxed));
 }
 
 /**
- * @brief Enhanced worker thread function with performance tracking
+ * @brief Lower a statistic to value if it is smaller (0 = unset)
  */
-static void *thread_pool_worker(void *arg)
+static void
+store_min(atomic_long *statistic, long value)
 {
-  thread_pool_t *pool = (thread_pool_t *)arg;
+  long current = atomic_load_explicit(statistic, memory_order_relaxed);
+  while ((current == 0 || value < current) &&
+         !atomic_compare_exchange_weak_explicit(statistic, &current, value,
+                                                memory_order_relaxed, memory_order_relaxed))
+  {
+  }
+}
 
-  pthread_cleanup_push(thread_cleanup, &pool->queue_mutex);
+/**
+ * @brief Raise a statistic to value if it is larger
+ */
+static void
+store_max(atomic_long *statistic, long value)
+{
+  long current = atomic_load_explicit(statistic, memory_order_relaxed);
+  while (value > current &&
+         !atomic_compare_exchange_weak_explicit(statistic, &current, value,
+                                                memory_order_relaxed, memory_order_relaxed))
+  {
+  }
+}
 
-#if SHOW_DEBUG
-  printf("[DEBUG] Worker thread %lu started\n", pthread_self());
-#endif
-  while (1)
+/**
+ * @brief Look everywhere a worker can find a task
+ * FIFO scheduler: the pool queue. Steal scheduler: its own deque (newest
+ * first), its inbox, the overflow queue, then the deques and inboxes of
+ * the other slots, including those of retired workers
+ * @return A task, or NULL if none is queued
+ */
+static task_t *
+find_task(thread_pool_worker_t *worker)
+{
+  thread_pool_t *pool = worker->pool;
+  if (pool->scheduler == THREAD_POOL_FIFO)
   {
-    struct timespec task_start, task_end;
+    return (task_queue_pop(&pool->queue));
+  }
 
-    // Lock the queue to check for work
-    pthread_mutex_lock(&pool->queue_mutex);
+  task_t *task = task_deque_take(&worker->deque);
+  if (!task)
+  {
+    task = task_queue_pop(&worker->inbox);
+  }
+  if (!task)
+  {
+    task = task_queue_pop(&pool->queue);
+  }
 
-    // Make thread cancellable
-    if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL))
+  for (int i = 1; !task && i < pool->max_threads; ++i)
+  {
+    thread_pool_worker_t *victim = &pool->workers[(worker->index + i) % pool->max_threads];
+    task = task_deque_steal(&victim->deque);
+    if (!task)
     {
-#if SHOW_ERROR
-      printf("[ERROR] Thread %lu cannot cancel state\n", pthread_self());
-#endif
-      break;
+      task = task_queue_pop(&victim->inbox);
     }
+    if (task)
+    {
+      atomic_fetch_add_explicit(&pool->tasks_stolen, 1, memory_order_relaxed);
+    }
+  }
+  return (task);
+}
+
+/**
+ * @brief Tell whether a worker has tasks of its own queued
+ * It does not retire then, so they are run without waiting for a thief
+ */
+static int
+has_own_tasks(thread_pool_worker_t *worker)
+{
+  if (worker->pool->scheduler != THREAD_POOL_STEAL)
+  {
+    return (0);
+  }
+  long deque_size = atomic_load_explicit(&worker->deque.bottom, memory_order_relaxed) -
+                    atomic_load_explicit(&worker->deque.top, memory_order_relaxed);
+  return (deque_size > 0 || task_queue_size(&worker->inbox) > 0);
+}
 
-    // Wait for work or shutdown signal
-    while (pool->queue_head == NULL && !pool->shutdown)
+/**
+ * @brief Take a retire token if the autoscaler left one
+ * @return 1 if the worker must exit, 0 otherwise
+ */
+static int
+take_retire_token(thread_pool_worker_t *worker)
+{
+  thread_pool_t *pool = worker->pool;
+  int tokens = atomic_load_explicit(&pool->retire_tokens, memory_order_relaxed);
+  if (tokens <= 0 || has_own_tasks(worker))
+  {
+    return (0);
+  }
+  while (tokens > 0)
+  {
+    if (atomic_compare_exchange_weak(&pool->retire_tokens, &tokens, tokens - 1))
     {
-      pthread_cond_wait(&pool->queue_cond, &pool->queue_mutex);
+      return (1);
     }
+  }
+  return (0);
+}
+
+/**
+ * @brief find callback of task_queue_wait() for a worker
+ */
+static void *
+find_worker_task(void *context)
+{
+  return (find_task((thread_pool_worker_t *)context));
+}
+
+/**
+ * @brief stop callback of task_queue_wait(): the worker may have to exit
+ */
+static int
+worker_must_stop(void *context)
+{
+  thread_pool_t *pool = ((thread_pool_worker_t *)context)->pool;
+  return (atomic_load(&pool->shutdown) || atomic_load(&pool->retire_tokens) > 0);
+}
 
-    // Make thread cancellable
-    if (pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL))
+/**
+ * @brief Wait for a task
+ * Idle workers park on the pool queue. They look for work (and for a
+ * reason to stop) again after announcing the park, since producers and
+ * the autoscaler only wake workers that are parked
+ * @return A task, or NULL when woken without one (shutdown, retirement)
+ */
+static task_t *
+wait_for_task(thread_pool_worker_t *worker)
+{
+  return (task_queue_wait(&worker->pool->queue, find_worker_task, worker_must_stop, worker));
+}
+
+/**
+ * @brief Enhanced worker thread function with performance tracking
+ * Tasks come from the lock-free queues. A worker exits between tasks,
+ * either at shutdown or by taking a retire token when the pool shrinks
+ */
+static void *thread_pool_worker(void *arg)
+{
+  thread_pool_worker_t *worker = (thread_pool_worker_t *)arg;
+  thread_pool_t *pool = worker->pool;
+  tls_worker = worker;
+
+#if SHOW_DEBUG
+  printf("[DEBUG] Worker thread %lu started\n", pthread_self());
+#endif
+  while (1)
+  {
+    struct timespec task_start, task_end;
+
+    // Check if we should shutdown
+    if (atomic_load(&pool->shutdown))
     {
-#if SHOW_ERROR
-      printf("[ERROR] Thread %lu cannot cancel state\n", pthread_self());
+#if SHOW_DEBUG
+      printf("[DEBUG] Worker thread %lu shutting down\n", pthread_self());
 #endif
       break;
     }
 
-    // Check if we should shutdown
-    if (pool->shutdown)
+    // Retire if the pool is shrinking (the slot is joined by the autoscaler)
+    if (take_retire_token(worker))
     {
-      pthread_mutex_unlock(&pool->queue_mutex);
 #if SHOW_DEBUG
-      printf("[DEBUG] Worker thread %lu shutting down\n", pthread_self());
+      printf("[DEBUG] Worker thread %d retiring\n", worker->index);
 #endif
+      atomic_store_explicit(&worker->state, WORKER_EXITED, memory_order_release);
       break;
     }
-    // Get task from queue
-    task_t *task = pool->queue_head;
-    pool->queue_head = task->next;
-    if (pool->queue_head == NULL)
+
+    // Wait for work (NULL: woken to stop, or another worker was faster)
+    task_t *node = wait_for_task(worker);
+    if (!node)
     {
-      pool->queue_tail = NULL;
+      continue;
     }
 
-    // Update metrics
-    atomic_fetch_sub(&pool->queue_size, 1);
-    atomic_fetch_add(&pool->active_threads, 1);
+    // Copy the task out so that its node can be reused while it runs
+    task_t task;
+    task.function = node->function;
+    task.argument = node->argument;
+    release_task(pool, node);
 
-    pthread_mutex_unlock(&pool->queue_mutex);
+    atomic_fetch_add_explicit(&pool->active_threads, 1, memory_order_relaxed);
 
     // Execute the task with timing
     clock_gettime(CLOCK_MONOTONIC, &task_start);
@@ -87,7 +281,7 @@ static void *thread_pool_worker(void *arg)
 #if SHOW_DEBUG
     printf("[DEBUG] Worker thread %lu executing task\n", pthread_self());
 #endif
-    task->function(task->argument);
+    task.function(task.argument);
 
     clock_gettime(CLOCK_MONOTONIC, &task_end);
 
@@ -95,35 +289,458 @@ static void *thread_pool_worker(void *arg)
     long task_time_ms = (task_end.tv_sec - task_start.tv_sec) * 1000 +
                         (task_end.tv_nsec - task_start.tv_nsec) / 1000000;
 
-    pthread_mutex_lock(&pool->queue_mutex);
+    // Update performance metrics (atomics only, no lock)
+    atomic_fetch_add_explicit(&pool->total_tasks_completed, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pool->total_task_time_ms, task_time_ms, memory_order_relaxed);
+    store_min(&pool->min_task_time_ms, task_time_ms);
+    store_max(&pool->max_task_time_ms, task_time_ms);
+
+    atomic_fetch_sub_explicit(&pool->active_threads, 1, memory_order_relaxed);
+  }
+
+  return NULL;
+}
 
-    // Update performance metrics
-    atomic_fetch_add(&pool->total_tasks_completed, 1);
-    atomic_fetch_add(&pool->total_task_time_ms, task_time_ms);
+/**
+ * @brief Human readable name of a scheduler
+ */
+static const char *
+scheduler_name(thread_pool_scheduler_t scheduler)
+{
+  return (scheduler == THREAD_POOL_STEAL ? "steal" : "fifo");
+}
 
-    // Update min/max task times
-    long current_min = atomic_load(&pool->min_task_time_ms);
-    if (current_min == 0 || task_time_ms < current_min)
+/**
+ * @brief Free the worker slots (tasks still queued in them are dropped)
+ * @param count Slots whose deque and inbox were set up
+ */
+static void
+destroy_workers(thread_pool_t *pool, int count)
+{
+  if (pool->scheduler == THREAD_POOL_STEAL)
+  {
+    for (int i = 0; i < count; ++i)
     {
-      atomic_store(&pool->min_task_time_ms, task_time_ms);
+      task_deque_destroy(&pool->workers[i].deque);
+      task_queue_destroy(&pool->workers[i].inbox);
     }
+  }
+  free(pool->workers);
+  pool->workers = NULL;
+}
 
-    long current_max = atomic_load(&pool->max_task_time_ms);
-    if (task_time_ms > current_max)
+/**
+ * @brief Set up one worker slot per possible thread
+ * Deques and inboxes are only allocated for the steal scheduler
+ * @return 0 on success, -1 on error
+ */
+static int
+init_workers(thread_pool_t *pool)
+{
+  pool->workers = aligned_alloc(_Alignof(thread_pool_worker_t),
+                                sizeof(thread_pool_worker_t) * pool->max_threads);
+  if (!pool->workers)
+  {
+    return (-1);
+  }
+
+  for (int i = 0; i < pool->max_threads; ++i)
+  {
+    thread_pool_worker_t *worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->index = i;
+    atomic_init(&worker->state, WORKER_FREE);
+    if (pool->scheduler != THREAD_POOL_STEAL)
+    {
+      continue;
+    }
+    if (task_deque_init(&worker->deque, THREAD_POOL_WORKER_QUEUE_SIZE) != 0)
     {
-      atomic_store(&pool->max_task_time_ms, task_time_ms);
+      destroy_workers(pool, i);
+      return (-1);
     }
+    if (task_queue_init(&worker->inbox, THREAD_POOL_WORKER_QUEUE_SIZE) != 0)
+    {
+      task_deque_destroy(&worker->deque);
+      destroy_workers(pool, i);
+      return (-1);
+    }
+  }
+  return (0);
+}
 
-    atomic_fetch_sub(&pool->active_threads, 1);
+/**
+ * @brief Number of tasks waiting for a worker (a snapshot)
+ */
+static size_t
+queued_tasks(thread_pool_t *pool)
+{
+  size_t queued = task_queue_size(&pool->queue);
+  if (pool->scheduler == THREAD_POOL_STEAL)
+  {
+    for (int i = 0; i < pool->max_threads; ++i)
+    {
+      task_deque_t *deque = &pool->workers[i].deque;
+      long size = atomic_load_explicit(&deque->bottom, memory_order_relaxed) -
+                  atomic_load_explicit(&deque->top, memory_order_relaxed);
+      queued += (size > 0 ? (size_t)size : 0) + task_queue_size(&pool->workers[i].inbox);
+    }
+  }
+  return (queued);
+}
 
-    pthread_mutex_unlock(&pool->queue_mutex);
+/**
+ * @brief Start a worker thread in a free slot
+ * @return 0 on success, -1 on error
+ */
+static int
+start_worker(thread_pool_t *pool, int slot)
+{
+  atomic_store(&pool->workers[slot].state, WORKER_RUNNING);
+  if (pthread_create(&pool->threads[slot], NULL, thread_pool_worker, &pool->workers[slot]) != 0)
+  {
+    atomic_store(&pool->workers[slot].state, WORKER_FREE);
+    return (-1);
+  }
+  return (0);
+}
 
-    free(task);
+/**
+ * @brief Join the workers that retired and free their slots
+ * Caller holds scale_mutex
+ */
+static void
+reap_workers(thread_pool_t *pool)
+{
+  for (int i = 0; i < pool->max_threads; ++i)
+  {
+    if (atomic_load_explicit(&pool->workers[i].state, memory_order_acquire) == WORKER_EXITED)
+    {
+      pthread_join(pool->threads[i], NULL);
+      atomic_store_explicit(&pool->workers[i].state, WORKER_FREE, memory_order_relaxed);
+#if SHOW_DEBUG
+      printf("[DEBUG] Worker thread %d joined\n", i);
+#endif
+    }
   }
+}
 
-  pthread_cleanup_pop(0);
+/**
+ * @brief Add workers, reusing those about to retire first
+ * Caller holds scale_mutex
+ * @param new_thread_count Thread count to reach
+ */
+static void
+grow_pool(thread_pool_t *pool, int new_thread_count)
+{
+  // Keep workers that have not retired yet: take their tokens back
+  int tokens = atomic_load(&pool->retire_tokens);
+  while (tokens > 0 && pool->thread_count < new_thread_count)
+  {
+    if (atomic_compare_exchange_weak(&pool->retire_tokens, &tokens, tokens - 1))
+    {
+      pool->thread_count++;
+      tokens--;
+    }
+  }
 
-  return NULL;
+  //  Create additional threads in free slots
+  for (int i = 0; i < pool->max_threads && pool->thread_count < new_thread_count; i++)
+  {
+    if (atomic_load(&pool->workers[i].state) != WORKER_FREE)
+    {
+      continue;
+    }
+    if (start_worker(pool, i) == 0)
+    {
+      pool->thread_count++;
+#if SHOW_DEBUG
+      printf("[DEBUG] Created additional worker thread %d\n", i);
+      printf("[DEBUG] thread count = %d\n", pool->thread_count);
+#endif
+    }
+    else
+    {
+#if SHOW_ERROR
+      printf("[ERROR] Failed to create additional thread %d\n", i);
+#endif
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Retire workers once they are idle
+ * Caller holds scale_mutex
+ * @param new_thread_count Thread count to reach
+ */
+static void
+shrink_pool(thread_pool_t *pool, int new_thread_count)
+{
+  // Idle workers retire by themselves: running tasks are never interrupted
+  int retiring = pool->thread_count - new_thread_count;
+  atomic_fetch_add(&pool->retire_tokens, retiring);
+  pool->thread_count = new_thread_count;
+  task_queue_wake(&pool->queue, retiring);
+}
+
+/**
+ * @brief Smallest integer not below a positive value
+ */
+static int
+ceil_int(double value)
+{
+  int integer = (int)value;
+  return (integer < value ? integer + 1 : integer);
+}
+
+/**
+ * @brief One step of the autoscaling controller
+ * Run every THREAD_POOL_CONTROL_INTERVAL_MS by the controller thread, away
+ * from the submission path. Busy workers, queued tasks and the arrival
+ * rate are smoothed over the policy's time constant; Little's law turns
+ * the last two into the time a task waits in the queue. The pool is sized
+ * for the policy's utilization, and grown further while the wait exceeds
+ * max_wait_ms. It grows at once, up to doubling per step, but shrinks by
+ * at most a quarter per step and only after the target has stayed below
+ * the thread count (by the hysteresis) for shrink_delay_ms, so bursts do
+ * not make it flap
+ */
+static void
+thread_pool_auto_scale(thread_pool_t *pool)
+{
+  if (!pool)
+    return;
+
+  pthread_mutex_lock(&pool->scale_mutex);
+
+  // No new threads once destroy has started joining them
+  if (atomic_load(&pool->shutdown))
+  {
+    pthread_mutex_unlock(&pool->scale_mutex);
+    return;
+  }
+
+  // Free the slots of the workers that retired since the last check
+  reap_workers(pool);
+
+  const thread_pool_policy_t *policy = pool->policy;
+  long now = now_ms();
+  long elapsed = now - pool->sampled_ms;
+  if (elapsed <= 0)
+  {
+    pthread_mutex_unlock(&pool->scale_mutex);
+    return;
+  }
+
+  // Sample: tasks that arrived = tasks completed + growth of the queue
+  long completed = atomic_load(&pool->total_tasks_completed);
+  size_t queued = queued_tasks(pool);
+  int active_threads = atomic_load(&pool->active_threads);
+  double arrived = (double)(completed - pool->sampled_completed) +
+                   ((double)queued - (double)pool->sampled_queued);
+  double arrival_rate = arrived > 0 ? arrived * 1000.0 / elapsed : 0.0;
+  pool->sampled_ms = now;
+  pool->sampled_completed = completed;
+  pool->sampled_queued = queued;
+
+  // Exponential moving averages, weighted by the time since the last sample
+  double alpha = elapsed / (elapsed + policy->smoothing_ms);
+  pool->busy_ewma += alpha * (active_threads - pool->busy_ewma);
+  pool->queued_ewma += alpha * ((double)queued - pool->queued_ewma);
+  pool->arrival_ewma += alpha * (arrival_rate - pool->arrival_ewma);
+
+  // Little's law: wait = queue length / arrival rate. A queue that nothing
+  // drains or feeds any more counts as waiting too long
+  if (pool->arrival_ewma > 0.001)
+  {
+    pool->wait_ewma_ms = 1000.0 * pool->queued_ewma / pool->arrival_ewma;
+  }
+  else
+  {
+    pool->wait_ewma_ms = pool->queued_ewma >= 1.0 ? 2 * policy->max_wait_ms : 0.0;
+  }
+
+  int current_threads = pool->thread_count;
+  int target = ceil_int(pool->busy_ewma / policy->utilization);
+  if (pool->wait_ewma_ms > policy->max_wait_ms && queued > 0)
+  {
+    // Tasks wait too long: add workers in proportion to the excess
+    int wanted = ceil_int(current_threads * pool->wait_ewma_ms / policy->max_wait_ms);
+    if (wanted > target)
+    {
+      target = wanted;
+    }
+  }
+  if (target < pool->min_threads)
+  {
+    target = pool->min_threads;
+  }
+  if (target > pool->max_threads)
+  {
+    target = pool->max_threads;
+  }
+  pool->target_threads = target;
+
+#if SHOW_DEBUG
+  printf("[DEBUG] Auto-scale step: threads=%d, target=%d, busy=%.1f, queue=%.1f, "
+         "arrivals=%.1f/s, wait=%.1f ms\n",
+         current_threads, target, pool->busy_ewma, pool->queued_ewma,
+         pool->arrival_ewma, pool->wait_ewma_ms);
+#endif
+
+  // SCALE UP: at once, at most doubling per step
+  if (target > current_threads)
+  {
+    int new_thread_count = target < current_threads * 2 ? target : current_threads * 2;
+    pool->below_since_ms = 0;
+#if SHOW_INFO
+    printf("[INFO] SCALING UP: %d -> %d threads (busy=%.1f, wait=%.1f ms, policy=%s)\n",
+           current_threads, new_thread_count, pool->busy_ewma, pool->wait_ewma_ms, policy->name);
+#endif
+    grow_pool(pool, new_thread_count);
+  }
+
+  // SCALE DOWN: once the target stayed low long enough, at most a quarter per step
+  else if (target < current_threads * (1.0 - policy->hysteresis))
+  {
+    if (pool->below_since_ms == 0)
+    {
+      pool->below_since_ms = now;
+    }
+    else if (now - pool->below_since_ms >= policy->shrink_delay_ms)
+    {
+      int new_thread_count = ((current_threads * 3) + 1) / 4;
+      if (new_thread_count < target)
+      {
+        new_thread_count = target;
+      }
+#if SHOW_INFO
+      printf("[INFO] SCALING DOWN: %d -> %d threads (busy=%.1f, wait=%.1f ms, policy=%s)\n",
+             current_threads, new_thread_count, pool->busy_ewma, pool->wait_ewma_ms, policy->name);
+#endif
+      shrink_pool(pool, new_thread_count);
+      pool->below_since_ms = now;
+    }
+  }
+  else
+  {
+    pool->below_since_ms = 0;
+  }
+
+  pthread_mutex_unlock(&pool->scale_mutex);
+}
+
+/**
+ * @brief Controller thread: one autoscaling step per THREAD_POOL_CONTROL_INTERVAL_MS
+ */
+static void *
+thread_pool_controller(void *arg)
+{
+  thread_pool_t *pool = (thread_pool_t *)arg;
+  struct timespec deadline;
+
+  pthread_mutex_lock(&pool->controller_mutex);
+  while (!pool->controller_stop)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += THREAD_POOL_CONTROL_INTERVAL_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    // Sleep out the interval unless destroy signals earlier
+    int result = 0;
+    while (!pool->controller_stop && result != ETIMEDOUT)
+    {
+      result = pthread_cond_timedwait(&pool->controller_cond, &pool->controller_mutex, &deadline);
+    }
+    if (pool->controller_stop)
+    {
+      break;
+    }
+
+    pthread_mutex_unlock(&pool->controller_mutex);
+    thread_pool_auto_scale(pool);
+    pthread_mutex_lock(&pool->controller_mutex);
+  }
+  pthread_mutex_unlock(&pool->controller_mutex);
+  return (NULL);
+}
+
+/**
+ * @brief Select the scheduler of the pools created from now on
+ * @param name "fifo" (one shared queue) or "steal" (per-worker deques
+ *             with work stealing); NULL or empty for THREAD_POOL_SCHEDULER
+ * @return 0 on success, -1 if the name is unknown
+ */
+int thread_pool_set_scheduler(const char *name)
+{
+  if (!name || name[0] == '\0')
+  {
+    name = THREAD_POOL_SCHEDULER;
+  }
+  if (strcmp(name, "fifo") == 0)
+  {
+    g_scheduler = THREAD_POOL_FIFO;
+  }
+  else if (strcmp(name, "steal") == 0)
+  {
+    g_scheduler = THREAD_POOL_STEAL;
+  }
+  else
+  {
+    return (-1);
+  }
+  return (0);
+}
+
+/**
+ * @brief Select the autoscaling policy of the pools created from now on
+ * @param name "latency" (keep spare workers, short queue waits),
+ *             "balanced" or "throughput" (busy workers, longer waits);
+ *             NULL or empty for THREAD_POOL_POLICY
+ * @return 0 on success, -1 if the name is unknown
+ */
+int thread_pool_set_policy(const char *name)
+{
+  if (!name || name[0] == '\0')
+  {
+    name = THREAD_POOL_POLICY;
+  }
+  for (size_t i = 0; i < sizeof(POLICIES) / sizeof(POLICIES[0]); ++i)
+  {
+    if (strcmp(name, POLICIES[i].name) == 0)
+    {
+      g_policy = &POLICIES[i];
+      return (0);
+    }
+  }
+  return (-1);
+}
+
+/**
+ * @brief Stop and join every worker thread, running or retired
+ * After this the autoscaler starts none (slots need not be contiguous)
+ */
+static void
+stop_workers(thread_pool_t *pool)
+{
+  pthread_mutex_lock(&pool->scale_mutex);
+  atomic_store(&pool->shutdown, 1);
+  task_queue_close(&pool->queue);
+  pthread_mutex_unlock(&pool->scale_mutex);
+
+  for (int i = 0; i < pool->max_threads; ++i)
+  {
+    if (atomic_load(&pool->workers[i].state) != WORKER_FREE)
+    {
+      pthread_join(pool->threads[i], NULL);
+      atomic_store(&pool->workers[i].state, WORKER_FREE);
+#if SHOW_DEBUG
+      printf("[DEBUG] Worker thread %d joined\n", i);
+#endif
+    }
+  }
 }
 
 /**
@@ -134,7 +751,8 @@ thread_pool_t *thread_pool_create(int initial_thread_count)
 #if SHOW_INFO
   printf("[INFO] Creating enhanced thread pool with %d initial threads\n", initial_thread_count);
 #endif
-  thread_pool_t *pool = malloc(sizeof(thread_pool_t));
+  // Aligned: the queue counters sit on their own cache lines
+  thread_pool_t *pool = aligned_alloc(_Alignof(thread_pool_t), sizeof(thread_pool_t));
   if (!pool)
   {
 #if SHOW_ERROR
@@ -185,35 +803,66 @@ int thread_pool_create_with_limits(thread_pool_t *pool, int min_threads, int max
   pool->thread_count = initial_threads;
   pool->min_threads = min_threads;
   pool->max_threads = max_threads;
-  pool->queue_head = NULL;
-  pool->queue_tail = NULL;
-  pool->shutdown = 0;
-  pool->last_scale_time = time(NULL);
+  pool->scheduler = g_scheduler;
+  pool->policy = g_policy;
+  atomic_init(&pool->next_worker, 0);
+  atomic_init(&pool->tasks_stolen, 0);
+
+  if (init_workers(pool) != 0)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Failed to allocate worker queues\n");
+#endif
+    free(pool->threads);
+    return -1;
+  }
 
   // Initialize atomic counters
+  atomic_init(&pool->shutdown, 0);
+  atomic_init(&pool->retire_tokens, 0);
   atomic_init(&pool->active_threads, 0);
-  atomic_init(&pool->queue_size, 0);
   atomic_init(&pool->total_tasks_completed, 0);
   atomic_init(&pool->total_task_time_ms, 0);
   atomic_init(&pool->min_task_time_ms, 0);
   atomic_init(&pool->max_task_time_ms, 0);
 
-  // Initialize synchronization primitives
-  if (pthread_mutex_init(&pool->queue_mutex, NULL) != 0)
+  // Task nodes: all free, the stack top being node 0
+  pool->task_slab = aligned_alloc(_Alignof(task_t), sizeof(task_t) * THREAD_POOL_QUEUE_CAPACITY);
+  if (!pool->task_slab)
   {
 #if SHOW_ERROR
-    printf("[ERROR] Failed to initialize queue mutex\n");
+    printf("[ERROR] Failed to allocate task nodes\n");
 #endif
+    destroy_workers(pool, pool->max_threads);
     free(pool->threads);
     return -1;
   }
+  for (unsigned int i = 0; i < THREAD_POOL_QUEUE_CAPACITY; ++i)
+  {
+    atomic_init(&pool->task_slab[i].next_free, i + 1 < THREAD_POOL_QUEUE_CAPACITY ? i + 1 : TASK_NONE);
+  }
+  atomic_init(&pool->free_tasks, 0);
 
-  if (pthread_cond_init(&pool->queue_cond, NULL) != 0)
+  // Initialize the task queue and synchronization primitives
+  if (task_queue_init(&pool->queue, THREAD_POOL_QUEUE_CAPACITY) != 0)
   {
 #if SHOW_ERROR
-    printf("[ERROR] Failed to initialize queue condition variable\n");
+    printf("[ERROR] Failed to initialize task queue\n");
 #endif
-    pthread_mutex_destroy(&pool->queue_mutex);
+    free(pool->task_slab);
+    destroy_workers(pool, pool->max_threads);
+    free(pool->threads);
+    return -1;
+  }
+
+  if (pthread_mutex_init(&pool->scale_mutex, NULL) != 0)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Failed to initialize scale mutex\n");
+#endif
+    task_queue_destroy(&pool->queue);
+    free(pool->task_slab);
+    destroy_workers(pool, pool->max_threads);
     free(pool->threads);
     return -1;
   }
@@ -221,207 +870,185 @@ int thread_pool_create_with_limits(thread_pool_t *pool, int min_threads, int max
   // Create initial worker threads
   for (int i = 0; i < initial_threads; ++i)
   {
-    if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, pool) != 0)
+    if (start_worker(pool, i) != 0)
     {
 #if SHOW_ERROR
       printf("[ERROR] Failed to create worker thread %d\n", i);
 #endif
 
       // Clean up already created threads
-      pool->shutdown = 1;
-      pthread_cond_broadcast(&pool->queue_cond);
-      for (int j = 0; j < i; j++)
-      {
-        pthread_join(pool->threads[j], NULL);
-      }
-
-      pthread_mutex_destroy(&pool->queue_mutex);
-      pthread_cond_destroy(&pool->queue_cond);
+      stop_workers(pool);
+      pthread_mutex_destroy(&pool->scale_mutex);
+      task_queue_destroy(&pool->queue);
+      free(pool->task_slab);
+      destroy_workers(pool, pool->max_threads);
       free(pool->threads);
       return -1;
     }
   }
+
+  // Start the autoscaling controller
+  pool->controller_stop = 0;
+  pool->busy_ewma = 0.0;
+  pool->queued_ewma = 0.0;
+  pool->arrival_ewma = 0.0;
+  pool->wait_ewma_ms = 0.0;
+  pool->target_threads = initial_threads;
+  pool->below_since_ms = 0;
+  pool->sampled_ms = now_ms();
+  pool->sampled_completed = 0;
+  pool->sampled_queued = 0;
+
+  pthread_condattr_t attributes;
+  int controller_ready = pthread_condattr_init(&attributes) == 0;
+  if (controller_ready)
+  {
+    // Timed waits on the monotonic clock, immune to wall clock changes
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    controller_ready = pthread_cond_init(&pool->controller_cond, &attributes) == 0;
+    pthread_condattr_destroy(&attributes);
+  }
+  if (controller_ready && pthread_mutex_init(&pool->controller_mutex, NULL) != 0)
+  {
+    pthread_cond_destroy(&pool->controller_cond);
+    controller_ready = 0;
+  }
+  if (controller_ready &&
+      pthread_create(&pool->controller, NULL, thread_pool_controller, pool) != 0)
+  {
+    pthread_mutex_destroy(&pool->controller_mutex);
+    pthread_cond_destroy(&pool->controller_cond);
+    controller_ready = 0;
+  }
+  if (!controller_ready)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Failed to start the autoscaling controller\n");
+#endif
+    stop_workers(pool);
+    pthread_mutex_destroy(&pool->scale_mutex);
+    task_queue_destroy(&pool->queue);
+    free(pool->task_slab);
+    destroy_workers(pool, pool->max_threads);
+    free(pool->threads);
+    return -1;
+  }
+
 #if SHOW_INFO
-  printf("[INFO] Enhanced thread pool created: %d threads (min=%d, max=%d)\n",
-         initial_threads, min_threads, max_threads);
+  printf("[INFO] Enhanced thread pool created: %d threads (min=%d, max=%d, scheduler=%s, policy=%s)\n",
+         initial_threads, min_threads, max_threads, scheduler_name(pool->scheduler), pool->policy->name);
 #endif
   return 0;
 }
 
 /**
- * @brief Auto-scaling logic - THE CORE OF STRATEGY 1
+ * @brief Hand a filled task node to the scheduler and wake a worker
+ * Steal scheduler: a worker's own submissions go to its deque, to be run
+ * next while their data is still in its cache; others go round-robin to
+ * the inboxes of the running workers. Full deques and inboxes overflow
+ * into the pool queue
+ * @return 0 on success, -1 if every queue is full
  */
-void thread_pool_auto_scale(thread_pool_t *pool)
+static int
+enqueue_task(thread_pool_t *pool, task_t *task)
 {
-  if (!pool)
-    return;
-
-  time_t now = time(NULL);
-
-  // Check scaling interval
-  if (now - pool->last_scale_time < THREAD_POOL_SCALE_INTERVAL)
+  if (pool->scheduler == THREAD_POOL_FIFO)
   {
-    return;
+    return (task_queue_push(&pool->queue, task));
   }
 
-  pthread_mutex_lock(&pool->queue_mutex);
-
-  int current_threads = pool->thread_count;
-  int active_threads = atomic_load(&pool->active_threads);
-  int queue_size = atomic_load(&pool->queue_size);
-
-  // Calculate load ratio
-  float load_ratio = (float)active_threads / current_threads;
-
-#if SHOW_DEBUG
-  printf("[DEBUG] Auto-scale check: threads=%d, active=%d, queue=%d, load=%.1f%%\n",
-         current_threads, active_threads, queue_size, load_ratio * 100);
-#endif
-
-  // SCALE UP logic
-  if (load_ratio > THREAD_POOL_SCALE_UP_THRESHOLD &&
-      queue_size > THREAD_POOL_QUEUE_HIGH_WATER &&
-      current_threads < pool->max_threads)
+  int queued;
+  thread_pool_worker_t *self = tls_worker;
+  if (self && self->pool == pool)
   {
-
-    int new_thread_count = ((current_threads * 3) + 1) / 2; // Scale up by 50%
-    if (new_thread_count > pool->max_threads)
-    {
-      new_thread_count = pool->max_threads;
-    }
-
-#if SHOW_INFO
-    printf("[INFO] SCALING UP: %d -> %d threads (load=%.1f%%, queue=%d)\n",
-           current_threads, new_thread_count, load_ratio * 100, queue_size);
-#endif
-    //  Create additional threads
-    for (int i = current_threads; i < new_thread_count; i++)
-    {
-      if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, pool) == 0)
-      {
-        pool->thread_count++;
-#if SHOW_DEBUG
-        printf("[DEBUG] Created additional worker thread %d\n", i);
-        printf("[DEBUG] thread count = %d\n", pool->thread_count);
-#endif
-      }
-      else
-      {
-#if SHOW_ERROR
-        printf("[ERROR] Failed to create additional thread %d\n", i);
-#endif
-        break;
-      }
-    }
+    queued = task_deque_push(&self->deque, task) == 0;
   }
-
-  // SCALE DOWN logic
-  else if (load_ratio < THREAD_POOL_SCALE_DOWN_THRESHOLD &&
-           queue_size < THREAD_POOL_QUEUE_LOW_WATER &&
-           current_threads > pool->min_threads)
+  else
   {
-
-    int new_thread_count = ((current_threads * 3) + 1) / 4; // Scale down by 25%
-    if (new_thread_count < pool->min_threads)
-    {
-      new_thread_count = pool->min_threads;
-    }
-
-#if SHOW_INFO
-    printf("[INFO] SCALING DOWN: %d -> %d threads (load=%.1f%%, queue=%d)\n",
-           current_threads, new_thread_count, load_ratio * 100, queue_size);
-#endif
-    for (int i = (pool->thread_count - 1); i >= new_thread_count; --i)
+    // Next slot with a running worker (slots of retired workers may be anywhere)
+    unsigned int next = atomic_fetch_add_explicit(&pool->next_worker, 1, memory_order_relaxed);
+    thread_pool_worker_t *target = &pool->workers[next % (unsigned int)pool->max_threads];
+    for (int i = 1; i < pool->max_threads; ++i)
     {
-      if (pthread_cancel(pool->threads[i]))
+      if (atomic_load_explicit(&target->state, memory_order_relaxed) == WORKER_RUNNING)
       {
-#if SHOW_ERROR
-        printf("[ERROR] Failed to cancel thread %d\n", i);
-#endif
         break;
       }
-#if SHOW_INFO
-      printf("[INFO] Thread %d correctly canceled\n", i);
-#endif
+      target = &pool->workers[(next + i) % (unsigned int)pool->max_threads];
     }
-
-    pool->thread_count = new_thread_count;
+    queued = task_queue_offer(&target->inbox, task) == 0;
+  }
+  if (!queued && task_queue_offer(&pool->queue, task) != 0)
+  {
+    return (-1);
   }
 
-  pool->last_scale_time = now;
-  pthread_mutex_unlock(&pool->queue_mutex);
+  // Any parked worker will do: it looks at every queue when woken
+  task_queue_notify(&pool->queue);
+  return (0);
 }
 
 /**
- * @brief Enhanced task addition with queue size tracking
+ * @brief Queue a task on a node from the pool's slab (no allocation)
  */
-int thread_pool_add_task(thread_pool_t *pool, void (*function)(void *), void *argument)
+static int
+submit_task(thread_pool_t *pool, void (*function)(void *), void *argument)
 {
-  if (!pool || !function)
+  // Check if pool is shutting down
+  if (atomic_load_explicit(&pool->shutdown, memory_order_relaxed))
   {
-#if SHOW_ERROR
-    printf("[ERROR] Invalid parameters for thread pool task\n");
+#if SHOW_WARNING
+    printf("[WARNING] Cannot add task: thread pool shutting down\n");
 #endif
     return -1;
   }
 
-  // Create new task
-  task_t *task = malloc(sizeof(task_t));
+  // A node per queued task: no free node means the queue is full
+  task_t *task = acquire_task(pool);
   if (!task)
   {
-#if SHOW_ERROR
-    printf("[ERROR] Failed to allocate memory for task\n");
+#if SHOW_WARNING
+    printf("[WARNING] Cannot add task: queue full (%d tasks)\n", THREAD_POOL_QUEUE_CAPACITY);
 #endif
     return -1;
   }
 
   task->function = function;
   task->argument = argument;
-  task->next = NULL;
-
-  // Add task to queue
-  pthread_mutex_lock(&pool->queue_mutex);
 
-  // Check if pool is shutting down
-  if (pool->shutdown)
+  // Add to end of queue (wakes a parked worker if there is one)
+  if (enqueue_task(pool, task) != 0)
   {
-    pthread_mutex_unlock(&pool->queue_mutex);
-    free(task);
+    release_task(pool, task);
 #if SHOW_WARNING
-    printf("[WARNING] Cannot add task: thread pool shutting down\n");
+    printf("[WARNING] Cannot add task: queue full (%d tasks)\n", THREAD_POOL_QUEUE_CAPACITY);
 #endif
     return -1;
   }
 
-  // Add to end of queue
-  if (pool->queue_head == NULL)
-  {
-    pool->queue_head = task;
-    pool->queue_tail = task;
-  }
-  else
-  {
-    pool->queue_tail->next = task;
-    pool->queue_tail = task;
-  }
-
-  // Update queue size
-  atomic_fetch_add(&pool->queue_size, 1);
-
-  // Signal waiting workers
-  pthread_cond_signal(&pool->queue_cond);
-  pthread_mutex_unlock(&pool->queue_mutex);
-
 #if SHOW_DEBUG
-  printf("[DEBUG] Task added to thread pool queue (queue_size=%d)\n",
-         atomic_load(&pool->queue_size));
+  printf("[DEBUG] Task added to thread pool queue (queue_size=%zu)\n",
+         task_queue_size(&pool->queue));
 #endif
-  // Trigger auto-scaling check
-  thread_pool_auto_scale(pool);
-
   return 0;
 }
 
+/**
+ * @brief Enhanced task addition with queue size tracking
+ */
+int thread_pool_add_task(thread_pool_t *pool, void (*function)(void *), void *argument)
+{
+  if (!pool || !function)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Invalid parameters for thread pool task\n");
+#endif
+    return -1;
+  }
+
+  return submit_task(pool, function, argument);
+}
+
 /**
  * @brief Get current load percentage for monitoring
  */
@@ -455,9 +1082,19 @@ void thread_pool_print_stats(thread_pool_t *pool)
   printf("Thread count: %d (min=%d, max=%d)\n",
          pool->thread_count, pool->min_threads, pool->max_threads);
   printf("Active threads: %d\n", atomic_load(&pool->active_threads));
-  printf("Queue size: %d\n", atomic_load(&pool->queue_size));
+  printf("Scheduler: %s\n", scheduler_name(pool->scheduler));
+  pthread_mutex_lock(&pool->scale_mutex);
+  printf("Autoscaling policy: %s (target=%d threads, busy=%.1f, queued=%.1f, arrivals=%.1f/s, wait=%.1f ms)\n",
+         pool->policy->name, pool->target_threads, pool->busy_ewma, pool->queued_ewma,
+         pool->arrival_ewma, pool->wait_ewma_ms);
+  pthread_mutex_unlock(&pool->scale_mutex);
+  printf("Queue size: %zu\n", queued_tasks(pool));
   printf("Load percentage: %d%%\n", thread_pool_get_load_percentage(pool));
   printf("Total tasks completed: %ld\n", total_tasks);
+  if (pool->scheduler == THREAD_POOL_STEAL)
+  {
+    printf("Tasks stolen: %ld\n", atomic_load(&pool->tasks_stolen));
+  }
 
   if (total_tasks > 0)
   {
@@ -482,35 +1119,23 @@ void thread_pool_destroy(thread_pool_t *pool)
   // Print final statistics
   thread_pool_print_stats(pool);
 
-  // Signal shutdown to all threads
-  pthread_mutex_lock(&pool->queue_mutex);
-  pool->shutdown = 1;
-  pthread_cond_broadcast(&pool->queue_cond);
-  pthread_mutex_unlock(&pool->queue_mutex);
-
-  // Wait for all threads to finish (use max_threads, not thread_count)
-  for (int i = 0; i < pool->max_threads; ++i)
-  {
-    if (i < pool->thread_count)
-    {
-      pthread_join(pool->threads[i], NULL);
-#if SHOW_DEBUG
-      printf("[DEBUG] Worker thread %d joined\n", i);
-#endif
-    }
-  }
-
-  // Clean up remaining tasks in queue
-  while (pool->queue_head)
-  {
-    task_t *task = pool->queue_head;
-    pool->queue_head = task->next;
-    free(task);
-  }
-
-  // Clean up synchronization primitives
-  pthread_mutex_destroy(&pool->queue_mutex);
-  pthread_cond_destroy(&pool->queue_cond);
+  // Stop the autoscaling controller first, so that no step runs past this point
+  pthread_mutex_lock(&pool->controller_mutex);
+  pool->controller_stop = 1;
+  pthread_cond_signal(&pool->controller_cond);
+  pthread_mutex_unlock(&pool->controller_mutex);
+  pthread_join(pool->controller, NULL);
+  pthread_mutex_destroy(&pool->controller_mutex);
+  pthread_cond_destroy(&pool->controller_cond);
+
+  // Signal shutdown to all threads and wait for them to finish
+  stop_workers(pool);
+
+  // Tasks still queued are dropped with the slab holding them
+  pthread_mutex_destroy(&pool->scale_mutex);
+  task_queue_destroy(&pool->queue);
+  free(pool->task_slab);
+  destroy_workers(pool, pool->max_threads);
 
   // Free memory
   free(pool->threads);
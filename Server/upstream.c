@@ -0,0 +1,1294 @@
+/*********************************************************************************
+ * ===== FILE: upstream.h/upstream.c =====
+ * Asynchronous upstream HTTP engine built on the curl multi socket interface
+ * Workers prepare a call and hand it over; engine threads drive every
+ * transfer from one epoll loop each and run the completion callback, so the
+ * number of AI calls in flight is no longer bounded by the thread pool.
+ * Connections stay open in each engine's connection cache, DNS results and
+ * TLS sessions are shared between engines, and easy handles are pooled.
+ * In HTTP/2 mode concurrent calls are multiplexed as streams over a few
+ * connections instead of one connection each.
+ * Calls that fail transiently (429, 5xx, timeouts, dropped connections) are
+ * retried with capped exponential backoff and full jitter, honoring
+ * Retry-After, within a deadline and a global retry budget that keeps
+ * retries to a fraction of the traffic while the upstream is degraded.
+ * Optionally, a call still unanswered at a latency percentile of recent
+ * calls is hedged: a second identical request is sent, the first good
+ * answer wins and the other transfer is aborted.
+ * A write callback may pause its transfer while its consumer is behind:
+ * the engine polls the paused transfers and resumes them once they are ready
+ *********************************************************************************/
+
+#include "upstream.h"
+#include <sys/eventfd.h>
+
+/**
+ * @brief Upstream engine: one curl multi handle driven by one thread
+ */
+typedef struct
+{
+  int id;                      // Engine index
+  CURLM *multi;                // Multi handle owning the transfers
+  int epoll_fd;                // Sockets requested by curl + event_fd
+  int event_fd;                // Wakes the loop when calls are submitted
+  long timer_deadline_ms;      // Monotonic deadline requested by curl (-1 = none)
+  pthread_t thread;            // Thread running the loop
+  volatile int running;        // 0 once the engine is shutting down
+
+  pthread_mutex_t queue_lock;  // Protects the submission queue
+  upstream_call_t *queue_head; // Submitted, not yet added to multi
+  upstream_call_t *queue_tail;
+  upstream_call_t *active;     // Added to multi (engine thread only)
+  upstream_call_t *delayed;    // Waiting to (re)start, by due_ms (engine thread only)
+  upstream_call_t *paused;     // Transfers paused by their write callback (engine thread only)
+  unsigned int random_seed;    // Backoff jitter (engine thread only)
+
+  // Hedging (engine thread only, except hedge_delay_ms)
+  upstream_call_t *hedge_head; // Hedge timers, by hedge_at_ms
+  upstream_call_t *hedge_tail;
+  long latencies[UPSTREAM_HEDGE_WINDOW]; // Recent first-attempt latencies (ms)
+  int latency_count;
+  int latency_next;
+  atomic_long hedge_delay_ms;  // Current hedge delay (-1 = not enough samples)
+} upstream_engine_t;
+
+static upstream_engine_t g_engines[UPSTREAM_MAX_ENGINES];
+static int g_engine_count = 0;
+static int g_http2_streams = 0; // Streams per HTTP/2 connection (0 = HTTP/1.1)
+static int g_hedge_percentile = 0; // Latency percentile that triggers a hedge (0 = off)
+static atomic_uint g_next_engine;
+
+// Shared DNS cache and TLS sessions (connections stay per engine: libcurl
+// does not support sharing a connection cache between concurrent threads)
+static CURLSH *g_share = NULL;
+static pthread_mutex_t g_share_locks[CURL_LOCK_DATA_LAST];
+
+// Idle easy handles, reset and ready for the next call
+static pthread_mutex_t g_handle_lock = PTHREAD_MUTEX_INITIALIZER;
+static CURL *g_handle_pool[UPSTREAM_HANDLE_POOL_SIZE];
+static int g_handle_count = 0;
+
+// Statistics
+static atomic_long g_calls_submitted;
+static atomic_long g_calls_completed;
+static atomic_long g_calls_failed;
+static atomic_int g_calls_in_flight;
+static atomic_long g_handles_created;
+static atomic_long g_handles_reused;
+static atomic_long g_connections_opened;
+static atomic_long g_connections_reused;
+static atomic_long g_http2_transfers;
+static atomic_long g_retries;
+static atomic_long g_retries_denied;
+static atomic_long g_retries_recovered;
+static atomic_long g_hedges;
+static atomic_long g_hedges_won;
+static atomic_long g_hedges_denied;
+
+// Budgets in thousandths of a token: every call deposits a fraction,
+// every retry or hedge withdraws a whole token
+static atomic_long g_retry_budget;
+static atomic_long g_hedge_budget;
+
+/**
+ * @brief Current monotonic time in milliseconds
+ */
+static long
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000L + ts.tv_nsec / 1000000L);
+}
+
+/**
+ * @brief CURLSHOPT_LOCKFUNC: serialize access to one kind of shared data
+ */
+static void
+share_lock(CURL *easy, curl_lock_data data, curl_lock_access access, void *userp)
+{
+  (void)easy;
+  (void)access;
+  (void)userp;
+  pthread_mutex_lock(&g_share_locks[data]);
+}
+
+/**
+ * @brief CURLSHOPT_UNLOCKFUNC
+ */
+static void
+share_unlock(CURL *easy, curl_lock_data data, void *userp)
+{
+  (void)easy;
+  (void)userp;
+  pthread_mutex_unlock(&g_share_locks[data]);
+}
+
+/**
+ * @brief Take an easy handle from the pool, or create one
+ * @return The handle, or NULL on error
+ */
+static CURL *
+acquire_handle(void)
+{
+  CURL *easy = NULL;
+
+  pthread_mutex_lock(&g_handle_lock);
+  if (g_handle_count > 0)
+  {
+    easy = g_handle_pool[--g_handle_count];
+  }
+  pthread_mutex_unlock(&g_handle_lock);
+
+  if (easy)
+  {
+    atomic_fetch_add(&g_handles_reused, 1);
+    return (easy);
+  }
+
+  easy = curl_easy_init();
+  if (easy)
+  {
+    atomic_fetch_add(&g_handles_created, 1);
+  }
+  return (easy);
+}
+
+/**
+ * @brief Return an easy handle to the pool (or clean it up if it is full)
+ * The reset keeps the handle's buffers and caches but drops every option
+ */
+static void
+release_handle(CURL *easy)
+{
+  curl_easy_reset(easy);
+
+  pthread_mutex_lock(&g_handle_lock);
+  if (g_handle_count < UPSTREAM_HANDLE_POOL_SIZE)
+  {
+    g_handle_pool[g_handle_count++] = easy;
+    easy = NULL;
+  }
+  pthread_mutex_unlock(&g_handle_lock);
+
+  if (easy)
+  {
+    curl_easy_cleanup(easy);
+  }
+}
+
+/**
+ * @brief CURLMOPT_SOCKETFUNCTION: mirror curl's socket interest into epoll
+ */
+static int
+socket_callback(CURL *easy, curl_socket_t fd, int what, void *userp, void *socketp)
+{
+  upstream_engine_t *engine = (upstream_engine_t *)userp;
+  (void)easy;
+  (void)socketp;
+
+  if (what == CURL_POLL_REMOVE)
+  {
+    epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    return (0);
+  }
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.data.fd = fd;
+  if (what & CURL_POLL_IN)
+  {
+    event.events |= EPOLLIN;
+  }
+  if (what & CURL_POLL_OUT)
+  {
+    event.events |= EPOLLOUT;
+  }
+
+  if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1 && errno == ENOENT)
+  {
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+      perror("epoll_ctl: upstream socket");
+    }
+  }
+  return (0);
+}
+
+/**
+ * @brief CURLMOPT_TIMERFUNCTION: remember when curl wants to be called back
+ */
+static int
+timer_callback(CURLM *multi, long timeout_ms, void *userp)
+{
+  upstream_engine_t *engine = (upstream_engine_t *)userp;
+  (void)multi;
+
+  engine->timer_deadline_ms = (timeout_ms < 0) ? -1 : now_ms() + timeout_ms;
+  return (0);
+}
+
+/**
+ * @brief Unlink a call from the engine's active list
+ */
+static void
+unlink_active(upstream_engine_t *engine, upstream_call_t *call)
+{
+  if (call->prev)
+  {
+    call->prev->next = call->next;
+  }
+  else
+  {
+    engine->active = call->next;
+  }
+  if (call->next)
+  {
+    call->next->prev = call->prev;
+  }
+  call->prev = NULL;
+  call->next = NULL;
+}
+
+/**
+ * @brief Take a call off the engine's paused list
+ */
+static void
+unlink_paused(upstream_engine_t *engine, upstream_call_t *call)
+{
+  if (!call->paused)
+  {
+    return;
+  }
+  upstream_call_t **link = &engine->paused;
+  while (*link != call)
+  {
+    link = &(*link)->paused_next;
+  }
+  *link = call->paused_next;
+  call->paused_next = NULL;
+  call->paused = 0;
+}
+
+/**
+ * @brief Resume the paused transfers whose consumer caught up
+ * Resuming runs the write callback at once with the data curl held back,
+ * which may pause the transfer again
+ */
+static void
+resume_paused_calls(upstream_engine_t *engine)
+{
+  upstream_call_t *call = engine->paused;
+  engine->paused = NULL;
+
+  while (call)
+  {
+    upstream_call_t *next = call->paused_next;
+    call->paused_next = NULL;
+    if (call->on_ready(call))
+    {
+      call->paused = 0;
+      curl_easy_pause(call->easy, CURLPAUSE_CONT);
+    }
+    else
+    {
+      call->paused_next = engine->paused;
+      engine->paused = call;
+    }
+    call = next;
+  }
+}
+
+/**
+ * @brief Run a call's completion callback and release it
+ */
+static void
+complete_call(upstream_call_t *call, CURLcode result, long http_code)
+{
+  if (result != CURLE_OK)
+  {
+    atomic_fetch_add(&g_calls_failed, 1);
+  }
+  atomic_fetch_add(&g_calls_completed, 1);
+  atomic_fetch_sub(&g_calls_in_flight, 1);
+
+  call->on_complete(call, result, http_code);
+  upstream_call_destroy(call);
+}
+
+/**
+ * @brief Add a fraction of a token to a budget, up to its maximum
+ * @param budget Budget in thousandths of a token
+ * @param ratio Tokens deposited
+ * @param max Tokens the budget can hold
+ */
+static void
+budget_deposit(atomic_long *budget, double ratio, long max)
+{
+  long current = atomic_load(budget);
+  long deposit = (long)(ratio * 1000);
+  while (current < max * 1000 &&
+         !atomic_compare_exchange_weak(budget, &current,
+                                       (current + deposit > max * 1000) ? max * 1000 : current + deposit))
+  {
+  }
+}
+
+/**
+ * @brief Take one token from a budget
+ * @return 0 on success, -1 if the budget is exhausted
+ */
+static int
+budget_withdraw(atomic_long *budget)
+{
+  long current = atomic_load(budget);
+  while (current >= 1000)
+  {
+    if (atomic_compare_exchange_weak(budget, &current, current - 1000))
+    {
+      return (0);
+    }
+  }
+  return (-1);
+}
+
+/**
+ * @brief Arm a call's hedge timer with the engine's current hedge delay
+ * The list stays ordered by due time; delays change slowly, so new timers
+ * almost always go at the tail
+ */
+static void
+hedge_timer_link(upstream_engine_t *engine, upstream_call_t *call)
+{
+  long delay = atomic_load(&engine->hedge_delay_ms);
+  if (g_hedge_percentile == 0 || !call->on_hedge || delay < 0)
+  {
+    return;
+  }
+
+  call->hedge_at_ms = now_ms() + delay;
+  upstream_call_t *after = engine->hedge_tail;
+  while (after && after->hedge_at_ms > call->hedge_at_ms)
+  {
+    after = after->hedge_prev;
+  }
+  call->hedge_prev = after;
+  call->hedge_next = after ? after->hedge_next : engine->hedge_head;
+  if (call->hedge_next)
+  {
+    call->hedge_next->hedge_prev = call;
+  }
+  else
+  {
+    engine->hedge_tail = call;
+  }
+  if (after)
+  {
+    after->hedge_next = call;
+  }
+  else
+  {
+    engine->hedge_head = call;
+  }
+}
+
+/**
+ * @brief Disarm a call's hedge timer (no-op if it is not armed)
+ */
+static void
+hedge_timer_unlink(upstream_engine_t *engine, upstream_call_t *call)
+{
+  if (call->hedge_at_ms < 0)
+  {
+    return;
+  }
+  if (call->hedge_prev)
+  {
+    call->hedge_prev->hedge_next = call->hedge_next;
+  }
+  else
+  {
+    engine->hedge_head = call->hedge_next;
+  }
+  if (call->hedge_next)
+  {
+    call->hedge_next->hedge_prev = call->hedge_prev;
+  }
+  else
+  {
+    engine->hedge_tail = call->hedge_prev;
+  }
+  call->hedge_prev = NULL;
+  call->hedge_next = NULL;
+  call->hedge_at_ms = -1;
+}
+
+/**
+ * @brief Order latencies for qsort
+ */
+static int
+compare_latency(const void *a, const void *b)
+{
+  long x = *(const long *)a;
+  long y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Record the latency of a successful first attempt
+ * Every 16 samples the hedge delay is recomputed as the configured
+ * percentile of the window
+ */
+static void
+record_latency(upstream_engine_t *engine, long latency_ms)
+{
+  engine->latencies[engine->latency_next] = latency_ms;
+  engine->latency_next = (engine->latency_next + 1) % UPSTREAM_HEDGE_WINDOW;
+  if (engine->latency_count < UPSTREAM_HEDGE_WINDOW)
+  {
+    engine->latency_count++;
+  }
+  if (g_hedge_percentile == 0 || engine->latency_count < UPSTREAM_HEDGE_MIN_SAMPLES ||
+      engine->latency_next % 16 != 0)
+  {
+    return;
+  }
+
+  long sorted[UPSTREAM_HEDGE_WINDOW];
+  memcpy(sorted, engine->latencies, engine->latency_count * sizeof(long));
+  qsort(sorted, engine->latency_count, sizeof(long), compare_latency);
+
+  long delay = sorted[engine->latency_count * g_hedge_percentile / 100];
+  atomic_store(&engine->hedge_delay_ms, delay < UPSTREAM_HEDGE_MIN_DELAY_MS ? UPSTREAM_HEDGE_MIN_DELAY_MS : delay);
+}
+
+/**
+ * @brief Start the hedges whose timer expired
+ */
+static void
+start_due_hedges(upstream_engine_t *engine)
+{
+  long now = now_ms();
+
+  while (engine->hedge_head && engine->hedge_head->hedge_at_ms <= now)
+  {
+    upstream_call_t *call = engine->hedge_head;
+    hedge_timer_unlink(engine, call);
+
+    if (budget_withdraw(&g_hedge_budget) != 0)
+    {
+      atomic_fetch_add(&g_hedges_denied, 1);
+      continue;
+    }
+
+    // Same options, request and PRIVATE pointer: only the output differs
+    CURL *hedge = curl_easy_duphandle(call->easy);
+    if (!hedge)
+    {
+      continue;
+    }
+    if (call->on_hedge(call, hedge) != 0)
+    {
+      // Nothing to send it with (no API key quota): the hedge token is not spent
+      curl_easy_cleanup(hedge);
+      atomic_fetch_add(&g_hedge_budget, 1000);
+      atomic_fetch_add(&g_hedges_denied, 1);
+      continue;
+    }
+    if (curl_multi_add_handle(engine->multi, hedge) != CURLM_OK)
+    {
+      if (call->on_unsent)
+      {
+        call->on_unsent(call, 1);
+      }
+      curl_easy_cleanup(hedge);
+      continue;
+    }
+    call->hedge = hedge;
+    call->transfers++;
+    atomic_fetch_add(&g_hedges, 1);
+  }
+}
+
+/**
+ * @brief Settle a hedged call after one of its transfers finished
+ * The first successful transfer wins and the other one is aborted; a
+ * failed transfer leaves the call to the other one while it still runs
+ * @return 1 if the call is decided (winner set), 0 to keep waiting
+ */
+static int
+settle_hedge(upstream_engine_t *engine, upstream_call_t *call, CURL *easy, CURLcode result, long http_code)
+{
+  if (call->transfers > 0 && !(result == CURLE_OK && http_code == 200))
+  {
+    return (0);
+  }
+  if (call->transfers > 0)
+  {
+    curl_multi_remove_handle(engine->multi, easy == call->hedge ? call->easy : call->hedge);
+    call->transfers = 0;
+  }
+  call->winner = (easy == call->hedge);
+  if (call->winner)
+  {
+    atomic_fetch_add(&g_hedges_won, 1);
+  }
+  return (1);
+}
+
+/**
+ * @brief Add a call's transfer to the multi handle and track it as active
+ */
+static void
+start_transfer(upstream_engine_t *engine, upstream_call_t *call)
+{
+  if (call->attempts == 0)
+  {
+    call->started_ms = now_ms();
+  }
+  call->attempts++;
+  if (curl_multi_add_handle(engine->multi, call->easy) != CURLM_OK)
+  {
+    if (call->on_unsent)
+    {
+      call->on_unsent(call, 0);
+    }
+    complete_call(call, CURLE_FAILED_INIT, 0);
+    return;
+  }
+  call->transfers = 1;
+  if (call->attempts == 1)
+  {
+    hedge_timer_link(engine, call);
+  }
+  call->next = engine->active;
+  if (engine->active)
+  {
+    engine->active->prev = call;
+  }
+  engine->active = call;
+}
+
+/**
+ * @brief Park a call on the delayed list until it is due
+ * The list is kept in due order
+ */
+static void
+delay_call(upstream_engine_t *engine, upstream_call_t *call, long due_ms)
+{
+  call->due_ms = due_ms;
+  upstream_call_t **link = &engine->delayed;
+  while (*link && (*link)->due_ms <= due_ms)
+  {
+    link = &(*link)->next;
+  }
+  call->prev = NULL;
+  call->next = *link;
+  *link = call;
+}
+
+/**
+ * @brief Move submitted calls into the multi handle
+ * Calls submitted with a start delay wait on the delayed list first
+ */
+static void
+start_queued_calls(upstream_engine_t *engine)
+{
+  pthread_mutex_lock(&engine->queue_lock);
+  upstream_call_t *call = engine->queue_head;
+  engine->queue_head = NULL;
+  engine->queue_tail = NULL;
+  pthread_mutex_unlock(&engine->queue_lock);
+
+  while (call)
+  {
+    upstream_call_t *next = call->next;
+    call->prev = NULL;
+    call->next = NULL;
+
+    // Every call earns part of a retry and part of a hedge
+    budget_deposit(&g_retry_budget, UPSTREAM_RETRY_BUDGET_RATIO, UPSTREAM_RETRY_BUDGET_MAX);
+    if (g_hedge_percentile > 0)
+    {
+      budget_deposit(&g_hedge_budget, UPSTREAM_HEDGE_BUDGET_RATIO, UPSTREAM_HEDGE_BUDGET_MAX);
+    }
+
+    if (call->start_delay_ms > 0)
+    {
+      delay_call(engine, call, now_ms() + call->start_delay_ms);
+    }
+    else
+    {
+      start_transfer(engine, call);
+    }
+    call = next;
+  }
+}
+
+/**
+ * @brief Start the delayed calls that are due (retries and paced first attempts)
+ */
+static void
+start_delayed_calls(upstream_engine_t *engine)
+{
+  long now = now_ms();
+
+  while (engine->delayed && engine->delayed->due_ms <= now)
+  {
+    upstream_call_t *call = engine->delayed;
+    engine->delayed = call->next;
+    call->next = NULL;
+
+    if (call->attempts > 0)
+    {
+      atomic_fetch_add(&g_retries, 1);
+    }
+    start_transfer(engine, call);
+  }
+}
+
+/**
+ * @brief Check whether a failed transfer is worth another attempt
+ */
+static int
+is_retryable(CURLcode result, long http_code)
+{
+  switch (result)
+  {
+  case CURLE_OK:
+    return (http_code == 429 || http_code == 500 || http_code == 502 ||
+            http_code == 503 || http_code == 504);
+  case CURLE_OPERATION_TIMEDOUT:
+  case CURLE_COULDNT_RESOLVE_HOST:
+  case CURLE_COULDNT_CONNECT:
+  case CURLE_SEND_ERROR:
+  case CURLE_RECV_ERROR:
+  case CURLE_GOT_NOTHING:
+  case CURLE_PARTIAL_FILE:
+  case CURLE_HTTP2:
+  case CURLE_HTTP2_STREAM:
+    return (1);
+  default:
+    return (0);
+  }
+}
+
+
+/**
+ * @brief Put a failed call on the delayed list if it may be retried
+ * The call is already removed from the multi handle and the active list
+ * @return 1 if a retry is scheduled, 0 if the call must complete
+ */
+static int
+schedule_retry(upstream_engine_t *engine, upstream_call_t *call, CURLcode result, long http_code)
+{
+  if (!call->on_retry || !engine->running || call->attempts > UPSTREAM_MAX_RETRIES ||
+      !is_retryable(result, http_code))
+  {
+    return (0);
+  }
+
+  // Full jitter: uniform in [0, min(max delay, base * 2^(attempt - 1))]
+  long backoff = (long)UPSTREAM_RETRY_BASE_MS << (call->attempts - 1);
+  if (backoff > UPSTREAM_RETRY_MAX_DELAY_MS)
+  {
+    backoff = UPSTREAM_RETRY_MAX_DELAY_MS;
+  }
+  long delay = rand_r(&engine->random_seed) % (backoff + 1);
+
+  // The server knows better when it asks to wait, unless it asks too much
+  curl_off_t retry_after = 0;
+  if (curl_easy_getinfo(call->easy, CURLINFO_RETRY_AFTER, &retry_after) == CURLE_OK && retry_after > 0)
+  {
+    if (retry_after * 1000 > UPSTREAM_RETRY_MAX_DELAY_MS)
+    {
+      return (0);
+    }
+    if (retry_after * 1000 > delay)
+    {
+      delay = (long)retry_after * 1000;
+    }
+  }
+
+  long now = now_ms();
+  if (now + delay - call->started_ms > UPSTREAM_RETRY_DEADLINE_MS)
+  {
+    return (0);
+  }
+  if (budget_withdraw(&g_retry_budget) != 0)
+  {
+    atomic_fetch_add(&g_retries_denied, 1);
+    return (0);
+  }
+  long reserved_delay = 0;
+  if (call->on_retry(call, UPSTREAM_RETRY_DEADLINE_MS - (now - call->started_ms), &reserved_delay) != 0)
+  {
+    atomic_fetch_add(&g_retry_budget, 1000); // Unused: give it back
+    return (0);
+  }
+
+  if (reserved_delay > delay)
+  {
+    delay = reserved_delay;
+  }
+
+#if SHOW_DEBUG
+  printf("[DEBUG] Upstream call failed (curl %d, HTTP %ld), retry %d in %ld ms\n",
+         (int)result, http_code, call->attempts, delay);
+#endif
+
+  // The retry runs on the original handle alone
+  if (call->hedge)
+  {
+    curl_easy_cleanup(call->hedge);
+    call->hedge = NULL;
+    call->winner = 0;
+  }
+
+  delay_call(engine, call, now + delay);
+  return (1);
+}
+
+/**
+ * @brief Complete every transfer curl reports as done
+ */
+static void
+collect_completions(upstream_engine_t *engine)
+{
+  CURLMsg *message;
+  int pending;
+
+  while ((message = curl_multi_info_read(engine->multi, &pending)) != NULL)
+  {
+    if (message->msg != CURLMSG_DONE)
+    {
+      continue;
+    }
+
+    CURL *easy = message->easy_handle;
+    CURLcode result = message->data.result;
+    upstream_call_t *call = NULL;
+    long http_code = 0;
+    long connects = 0;
+
+    curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&call);
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &http_code);
+    if (curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects) == CURLE_OK && result == CURLE_OK)
+    {
+      // No new connection means the transfer ran on a cached one
+      atomic_fetch_add(connects == 0 ? &g_connections_reused : &g_connections_opened, 1);
+    }
+    long version = 0;
+    if (curl_easy_getinfo(easy, CURLINFO_HTTP_VERSION, &version) == CURLE_OK &&
+        version == CURL_HTTP_VERSION_2_0)
+    {
+      atomic_fetch_add(&g_http2_transfers, 1);
+    }
+    curl_multi_remove_handle(engine->multi, easy);
+    call->transfers--;
+    if (call->hedge && !settle_hedge(engine, call, easy, result, http_code))
+    {
+      continue;
+    }
+
+    hedge_timer_unlink(engine, call);
+    unlink_paused(engine, call);
+    unlink_active(engine, call);
+    if (result == CURLE_OK && http_code == 200 && call->attempts == 1)
+    {
+      record_latency(engine, now_ms() - call->started_ms);
+    }
+    if (schedule_retry(engine, call, result, http_code))
+    {
+      continue;
+    }
+    if (call->attempts > 1 && result == CURLE_OK && http_code == 200)
+    {
+      atomic_fetch_add(&g_retries_recovered, 1);
+    }
+    complete_call(call, result, http_code);
+  }
+}
+
+/**
+ * @brief Engine thread: epoll loop feeding curl_multi_socket_action
+ */
+static void *
+engine_thread(void *arg)
+{
+  upstream_engine_t *engine = (upstream_engine_t *)arg;
+  struct epoll_event events[MAX_EVENTS];
+  int still_running = 0;
+
+  while (engine->running)
+  {
+    // Sleep until a socket is ready, curl's timer expires, a retry or
+    // hedge is due or calls arrive
+    int timeout = 1000;
+    long deadline = engine->timer_deadline_ms;
+    if (engine->delayed && (deadline < 0 || engine->delayed->due_ms < deadline))
+    {
+      deadline = engine->delayed->due_ms;
+    }
+    if (engine->hedge_head && (deadline < 0 || engine->hedge_head->hedge_at_ms < deadline))
+    {
+      deadline = engine->hedge_head->hedge_at_ms;
+    }
+    if (deadline >= 0)
+    {
+      long remaining = deadline - now_ms();
+      timeout = (remaining <= 0) ? 0 : (remaining < 1000 ? (int)remaining : 1000);
+    }
+    if (engine->paused && timeout > UPSTREAM_PAUSE_POLL_MS)
+    {
+      timeout = UPSTREAM_PAUSE_POLL_MS;
+    }
+
+    int ready = epoll_wait(engine->epoll_fd, events, MAX_EVENTS, timeout);
+    if (ready == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("epoll_wait: upstream");
+      break;
+    }
+
+    for (int i = 0; i < ready; ++i)
+    {
+      int fd = events[i].data.fd;
+
+      if (fd == engine->event_fd)
+      {
+        uint64_t value;
+        while (read(engine->event_fd, &value, sizeof(value)) > 0)
+        {
+        }
+        start_queued_calls(engine);
+        continue;
+      }
+
+      int flags = 0;
+      if (events[i].events & EPOLLIN)
+      {
+        flags |= CURL_CSELECT_IN;
+      }
+      if (events[i].events & EPOLLOUT)
+      {
+        flags |= CURL_CSELECT_OUT;
+      }
+      if (events[i].events & (EPOLLERR | EPOLLHUP))
+      {
+        flags |= CURL_CSELECT_ERR;
+      }
+      curl_multi_socket_action(engine->multi, fd, flags, &still_running);
+    }
+
+    if (engine->timer_deadline_ms >= 0 && now_ms() >= engine->timer_deadline_ms)
+    {
+      engine->timer_deadline_ms = -1;
+      curl_multi_socket_action(engine->multi, CURL_SOCKET_TIMEOUT, 0, &still_running);
+    }
+    start_delayed_calls(engine);
+    start_due_hedges(engine);
+    resume_paused_calls(engine);
+
+    collect_completions(engine);
+  }
+
+  // Shutdown: fail whatever is still queued or in flight
+  start_queued_calls(engine);
+  while (engine->active)
+  {
+    upstream_call_t *call = engine->active;
+    curl_multi_remove_handle(engine->multi, call->easy);
+    if (call->hedge)
+    {
+      curl_multi_remove_handle(engine->multi, call->hedge);
+    }
+    hedge_timer_unlink(engine, call);
+    unlink_paused(engine, call);
+    unlink_active(engine, call);
+    complete_call(call, CURLE_ABORTED_BY_CALLBACK, 0);
+  }
+  while (engine->delayed)
+  {
+    upstream_call_t *call = engine->delayed;
+    engine->delayed = call->next;
+    if (call->on_unsent)
+    {
+      call->on_unsent(call, 0); // Paced first attempt or retry, never sent
+    }
+    complete_call(call, CURLE_ABORTED_BY_CALLBACK, 0);
+  }
+
+  return (NULL);
+}
+
+/**
+ * @brief Release the resources of one engine
+ */
+static void
+destroy_engine(upstream_engine_t *engine)
+{
+  if (engine->multi)
+  {
+    curl_multi_cleanup(engine->multi);
+    engine->multi = NULL;
+  }
+  if (engine->event_fd >= 0)
+  {
+    close(engine->event_fd);
+    engine->event_fd = -1;
+  }
+  if (engine->epoll_fd >= 0)
+  {
+    close(engine->epoll_fd);
+    engine->epoll_fd = -1;
+  }
+  pthread_mutex_destroy(&engine->queue_lock);
+}
+
+/**
+ * @brief Start the upstream engines
+ * curl_global_init() must have been called
+ * @param engine_count Number of engine threads (1..UPSTREAM_MAX_ENGINES)
+ * @param http2_streams Concurrent streams per HTTP/2 connection, 0 for HTTP/1.1
+ * @param hedge_percentile Hedge calls slower than this percentile of recent
+ *        latencies (1..99), 0 to never hedge
+ * @return 0 on success, -1 on error
+ */
+int upstream_init(int engine_count, int http2_streams, int hedge_percentile)
+{
+  if (engine_count < 1 || engine_count > UPSTREAM_MAX_ENGINES ||
+      http2_streams < 0 || http2_streams > UPSTREAM_MAX_HTTP2_STREAMS ||
+      hedge_percentile < 0 || hedge_percentile > 99)
+  {
+    return (-1);
+  }
+  if (http2_streams > 0 && !(curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2))
+  {
+#if SHOW_WARNING
+    printf("[WARNING] libcurl built without HTTP/2, upstream stays on HTTP/1.1\n");
+#endif
+    http2_streams = 0;
+  }
+  g_http2_streams = http2_streams;
+  g_hedge_percentile = hedge_percentile;
+  atomic_store(&g_retry_budget, UPSTREAM_RETRY_BUDGET_MAX * 1000L);
+  atomic_store(&g_hedge_budget, UPSTREAM_HEDGE_BUDGET_MAX * 1000L);
+
+  // Share DNS results and TLS sessions between all calls
+  for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i)
+  {
+    pthread_mutex_init(&g_share_locks[i], NULL);
+  }
+  g_share = curl_share_init();
+  if (!g_share)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Failed to create cURL share\n");
+#endif
+    return (-1);
+  }
+  curl_share_setopt(g_share, CURLSHOPT_LOCKFUNC, share_lock);
+  curl_share_setopt(g_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+  curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+  for (int i = 0; i < engine_count; ++i)
+  {
+    upstream_engine_t *engine = &g_engines[i];
+
+    memset(engine, 0, sizeof(upstream_engine_t));
+    engine->id = i;
+    engine->timer_deadline_ms = -1;
+    engine->running = 1;
+    engine->random_seed = (unsigned int)(time(NULL) ^ (i * 0x9e3779b9u));
+    atomic_store(&engine->hedge_delay_ms, -1);
+    pthread_mutex_init(&engine->queue_lock, NULL);
+
+    engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    engine->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    engine->multi = curl_multi_init();
+    if (engine->epoll_fd == -1 || engine->event_fd == -1 || !engine->multi)
+    {
+#if SHOW_ERROR
+      printf("[ERROR] Failed to create upstream engine %d\n", i);
+#endif
+      destroy_engine(engine);
+      g_engine_count = i;
+      upstream_shutdown();
+      return (-1);
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = engine->event_fd;
+    epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, engine->event_fd, &event);
+
+    curl_multi_setopt(engine->multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(engine->multi, CURLMOPT_SOCKETDATA, engine);
+    curl_multi_setopt(engine->multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+    curl_multi_setopt(engine->multi, CURLMOPT_TIMERDATA, engine);
+    curl_multi_setopt(engine->multi, CURLMOPT_MAXCONNECTS, (long)UPSTREAM_MAX_IDLE_CONNECTIONS);
+    if (http2_streams > 0)
+    {
+      // A connection takes new streams until it reaches the limit
+      curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+      curl_multi_setopt(engine->multi, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)http2_streams);
+    }
+
+    if (pthread_create(&engine->thread, NULL, engine_thread, engine) != 0)
+    {
+      perror("pthread_create: upstream engine");
+      destroy_engine(engine);
+      g_engine_count = i;
+      upstream_shutdown();
+      return (-1);
+    }
+  }
+
+  g_engine_count = engine_count;
+#if SHOW_INFO
+  printf("[INFO] Upstream engine started with %d threads (%s)\n", engine_count,
+         http2_streams > 0 ? "HTTP/2" : "HTTP/1.1");
+#endif
+  return (0);
+}
+
+/**
+ * @brief Stop the engines; calls still in flight complete with an error
+ */
+void upstream_shutdown(void)
+{
+  for (int i = 0; i < g_engine_count; ++i)
+  {
+    upstream_engine_t *engine = &g_engines[i];
+    uint64_t value = 1;
+
+    // Under the queue lock: no call can be queued after the final drain
+    pthread_mutex_lock(&engine->queue_lock);
+    engine->running = 0;
+    pthread_mutex_unlock(&engine->queue_lock);
+    if (write(engine->event_fd, &value, sizeof(value)) < 0)
+    {
+      perror("write: upstream wakeup");
+    }
+    pthread_join(engine->thread, NULL);
+    destroy_engine(engine);
+  }
+  g_engine_count = 0;
+
+  // No transfer is left: drop the pooled handles, then the share they used
+  pthread_mutex_lock(&g_handle_lock);
+  while (g_handle_count > 0)
+  {
+    curl_easy_cleanup(g_handle_pool[--g_handle_count]);
+  }
+  pthread_mutex_unlock(&g_handle_lock);
+
+  if (g_share)
+  {
+    curl_share_cleanup(g_share);
+    g_share = NULL;
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i)
+    {
+      pthread_mutex_destroy(&g_share_locks[i]);
+    }
+  }
+}
+
+/**
+ * @brief Prepare a POST request for the engine
+ * Ownership of body and headers moves to the call (also on failure)
+ * @param url Request URL
+ * @param body Null-terminated request body (malloc'd)
+ * @param headers Request headers (may be NULL)
+ * @param on_complete Completion callback, run on an engine thread
+ * @param context Caller data for on_complete
+ * @return The call, or NULL on error
+ */
+upstream_call_t *upstream_call_create(const char *url, char *body, struct curl_slist *headers,
+                                      upstream_complete_t on_complete, void *context)
+{
+  upstream_call_t *call = calloc(1, sizeof(upstream_call_t));
+  if (!call)
+  {
+    free(body);
+    curl_slist_free_all(headers);
+    return (NULL);
+  }
+
+  call->body = body;
+  call->headers = headers;
+  call->on_complete = on_complete;
+  call->context = context;
+  call->hedge_at_ms = -1;
+
+  call->easy = acquire_handle();
+  if (!call->easy)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Failed to initialize cURL\n");
+#endif
+    upstream_call_destroy(call);
+    return (NULL);
+  }
+
+  curl_easy_setopt(call->easy, CURLOPT_URL, url);
+  curl_easy_setopt(call->easy, CURLOPT_POSTFIELDS, body);
+  curl_easy_setopt(call->easy, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(call->easy, CURLOPT_TIMEOUT, AI_TIMEOUT_SECONDS);
+  curl_easy_setopt(call->easy, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(call->easy, CURLOPT_PRIVATE, call);
+  curl_easy_setopt(call->easy, CURLOPT_SHARE, g_share);
+  curl_easy_setopt(call->easy, CURLOPT_DNS_CACHE_TIMEOUT, (long)UPSTREAM_DNS_CACHE_TIMEOUT_SEC);
+  curl_easy_setopt(call->easy, CURLOPT_TCP_KEEPALIVE, 1L);
+  if (g_http2_streams > 0)
+  {
+    // ALPN over TLS; plain http (local stand-ins) speaks h2c directly.
+    // PIPEWAIT makes a new call wait for a connection that can multiplex
+    // instead of opening its own
+    curl_easy_setopt(call->easy, CURLOPT_HTTP_VERSION,
+                     strncmp(url, "http://", 7) == 0 ? (long)CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE
+                                                     : (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(call->easy, CURLOPT_PIPEWAIT, 1L);
+  }
+  return (call);
+}
+
+/**
+ * @brief Hand a prepared call to an engine (round robin)
+ * @return 0 if the call was queued (its callback will run exactly once),
+ *         -1 if the engine is not running (the caller still owns the call)
+ */
+int upstream_submit(upstream_call_t *call)
+{
+  if (g_engine_count == 0)
+  {
+    return (-1);
+  }
+
+  unsigned int index = atomic_fetch_add(&g_next_engine, 1) % (unsigned int)g_engine_count;
+  upstream_engine_t *engine = &g_engines[index];
+
+  pthread_mutex_lock(&engine->queue_lock);
+  if (!engine->running)
+  {
+    pthread_mutex_unlock(&engine->queue_lock);
+    return (-1);
+  }
+  call->engine = (int)index;
+  call->prev = NULL;
+  call->next = NULL;
+  if (engine->queue_tail)
+  {
+    engine->queue_tail->next = call;
+  }
+  else
+  {
+    engine->queue_head = call;
+  }
+  engine->queue_tail = call;
+  atomic_fetch_add(&g_calls_in_flight, 1);
+  atomic_fetch_add(&g_calls_submitted, 1);
+  pthread_mutex_unlock(&engine->queue_lock);
+
+  uint64_t value = 1;
+  if (write(engine->event_fd, &value, sizeof(value)) < 0)
+  {
+    perror("write: upstream wakeup");
+  }
+  return (0);
+}
+
+/**
+ * @brief Note that a call's write callback paused its transfer
+ * Must be called on the engine thread, from the write callback returning
+ * CURL_WRITEFUNC_PAUSE; call->on_ready then decides when it resumes
+ */
+void upstream_call_pause(upstream_call_t *call)
+{
+  upstream_engine_t *engine = &g_engines[call->engine];
+
+  if (call->paused)
+  {
+    return;
+  }
+  call->paused = 1;
+  call->paused_next = engine->paused;
+  engine->paused = call;
+}
+
+/**
+ * @brief Release a call that is not (or no longer) owned by an engine
+ */
+void upstream_call_destroy(upstream_call_t *call)
+{
+  if (!call)
+  {
+    return;
+  }
+  if (call->easy)
+  {
+    release_handle(call->easy);
+  }
+  if (call->hedge)
+  {
+    curl_easy_cleanup(call->hedge); // Duplicated handles are not pooled
+  }
+  curl_slist_free_all(call->headers);
+  free(call->body);
+  free(call);
+}
+
+/**
+ * @brief Print upstream engine statistics
+ */
+void upstream_print_stats(void)
+{
+  printf("\n=== UPSTREAM STATISTICS ===\n");
+  printf("Engine threads: %d\n", g_engine_count);
+  if (g_http2_streams > 0)
+  {
+    printf("HTTP/2: up to %d streams per connection, %ld transfers\n",
+           g_http2_streams, atomic_load(&g_http2_transfers));
+  }
+  printf("Calls in flight: %d\n", atomic_load(&g_calls_in_flight));
+  printf("Calls submitted: %ld\n", atomic_load(&g_calls_submitted));
+  printf("Calls completed: %ld (failed: %ld)\n",
+         atomic_load(&g_calls_completed), atomic_load(&g_calls_failed));
+
+  long created = atomic_load(&g_handles_created);
+  long reused = atomic_load(&g_handles_reused);
+  printf("Handles: %ld created, %ld reused (%.1f%% hit rate)\n", created, reused,
+         (created + reused) > 0 ? 100.0 * reused / (created + reused) : 0.0);
+
+  long opened = atomic_load(&g_connections_opened);
+  long kept = atomic_load(&g_connections_reused);
+  printf("Connections: %ld opened, %ld reused (%.1f%% hit rate)\n", opened, kept,
+         (opened + kept) > 0 ? 100.0 * kept / (opened + kept) : 0.0);
+  printf("Retries: %ld started, %ld recovered, %ld denied by budget (%.1f left)\n",
+         atomic_load(&g_retries), atomic_load(&g_retries_recovered),
+         atomic_load(&g_retries_denied), atomic_load(&g_retry_budget) / 1000.0);
+  if (g_hedge_percentile > 0)
+  {
+    long submitted = atomic_load(&g_calls_submitted);
+    long hedges = atomic_load(&g_hedges);
+    printf("Hedges at p%d: %ld started (%.1f%% of calls), %ld won, %ld denied by budget or quota\n",
+           g_hedge_percentile, hedges, submitted > 0 ? 100.0 * hedges / submitted : 0.0,
+           atomic_load(&g_hedges_won), atomic_load(&g_hedges_denied));
+    for (int i = 0; i < g_engine_count; ++i)
+    {
+      long delay = atomic_load(&g_engines[i].hedge_delay_ms);
+      if (delay >= 0)
+      {
+        printf("  Engine %d hedge delay: %ld ms\n", i, delay);
+      }
+    }
+  }
+  printf("===========================\n\n");
+}
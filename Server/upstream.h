@@ -0,0 +1,87 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include "server.h"
+
+typedef struct upstream_call upstream_call_t;
+
+/**
+ * @brief Called on the upstream thread once a call has finished
+ * The call is destroyed when the callback returns
+ */
+typedef void (*upstream_complete_t)(upstream_call_t * call, CURLcode result, long http_code);
+
+/**
+ * @brief Called on the upstream thread before a failed call is retried
+ * Reserves what the new attempt needs (it may change call->easy's URL)
+ * and resets whatever the write callback collected
+ * @param max_delay_ms Longest the retry may still wait before it starts
+ * @param delay_ms Set to how long the retry must wait at least (0 = no wait)
+ * @return 0 to retry, -1 to complete the call with its failure instead
+ */
+typedef int (*upstream_retry_t)(upstream_call_t * call, long max_delay_ms, long * delay_ms);
+
+/**
+ * @brief Called on the upstream thread before a call is hedged
+ * Reserves what the second transfer needs (it may change the hedge's URL)
+ * and points its write callback at separate storage
+ * @param hedge Duplicate of call->easy, about to be started
+ * @return 0 to start the hedge, -1 to skip it
+ */
+typedef int (*upstream_hedge_t)(upstream_call_t * call, CURL * hedge);
+
+/**
+ * @brief Called on the upstream thread when an attempt that was prepared
+ * (first attempt, retry or hedge) is dropped before it is sent
+ * Gives back what the attempt reserved
+ * @param hedge 1 for the hedged transfer, 0 for call->easy
+ */
+typedef void (*upstream_unsent_t)(upstream_call_t * call, int hedge);
+
+/**
+ * @brief Polled on the upstream thread while a call's transfer is paused
+ * @return 1 to resume the transfer, 0 to keep it paused
+ */
+typedef int (*upstream_ready_t)(upstream_call_t * call);
+
+/**
+ * @brief One HTTP request driven by the upstream engine
+ */
+struct upstream_call
+{
+  CURL *easy;                      // Transfer handle (set write callbacks on it)
+  char *body;                      // Request body, owned by the call
+  struct curl_slist *headers;      // Request headers, owned by the call
+  upstream_complete_t on_complete; // Completion callback
+  void *context;                   // Caller data for on_complete
+  upstream_retry_t on_retry;       // Set to make failures retryable (NULL = never retry)
+  int attempts;                    // Transfers started so far
+  long started_ms;                 // Monotonic time of the first attempt
+  long start_delay_ms;             // Wait before the first attempt (set before submitting)
+  long due_ms;                     // When a delayed call is due
+  upstream_hedge_t on_hedge;       // Set to allow a hedged second request (NULL = never hedge)
+  CURL *hedge;                     // Second transfer of a hedged call
+  int winner;                      // Transfer that completed the call (0 = easy, 1 = hedge)
+  int transfers;                   // Transfers currently in the multi handle
+  long hedge_at_ms;                // When the hedge is due (-1 = not scheduled)
+  upstream_ready_t on_ready;       // Set by callers that pause the transfer (see upstream_call_pause())
+  upstream_unsent_t on_unsent;     // Set by callers that reserve per attempt (NULL = nothing to give back)
+  int engine;                      // Engine driving the call
+  int paused;                      // 1 while on the engine's paused list
+  struct upstream_call *paused_next; // Link in the engine's paused list
+  struct upstream_call *hedge_prev; // Links in the engine's hedge timer list
+  struct upstream_call *hedge_next;
+  struct upstream_call *prev;      // Links in the engine's active/queued lists
+  struct upstream_call *next;
+};
+
+int upstream_init(int engine_count, int http2_streams, int hedge_percentile);
+void upstream_shutdown(void);
+upstream_call_t * upstream_call_create(const char * url, char * body, struct curl_slist * headers,
+                                       upstream_complete_t on_complete, void * context);
+int upstream_submit(upstream_call_t * call);
+void upstream_call_pause(upstream_call_t * call);
+void upstream_call_destroy(upstream_call_t * call);
+void upstream_print_stats(void);
+
+#endif /* UPSTREAM_H */
@@ -0,0 +1,698 @@
+/*********************************************************************************
+ * ===== FILE: uring_backend.h/uring_backend.c =====
+ * io_uring I/O backend, selected at build time with `make IO_BACKEND=uring`
+ * Replaces epoll_wait + accept + recv/send with completion-based submissions:
+ * multishot accept, receives into a provided buffer ring and hard-linked
+ * send -> shutdown -> close chains. Framing and request handling are shared
+ * with the epoll backend through network.c
+ *********************************************************************************/
+
+#include "uring_backend.h"
+
+#ifdef USE_IO_URING
+
+#include "network.h"
+#include "utils.h"
+#include <liburing.h>
+#include <sys/eventfd.h>
+
+// Operation kinds, stored in the top byte of the SQE user data
+#define URING_OP_ACCEPT 1ULL
+#define URING_OP_RECV 2ULL
+#define URING_OP_SEND 3ULL
+#define URING_OP_SHUTDOWN 4ULL
+#define URING_OP_CLOSE 5ULL
+#define URING_OP_WAKEUP 6ULL
+
+#define URING_BUFFER_GROUP 0
+#define URING_KIND(data) ((data) >> 56)
+#define URING_FD(data) ((int)((data) & 0xffffff))
+#define URING_GENERATION(data) ((unsigned int)(((data) >> 24) & 0xffffffff))
+
+/**
+ * @brief Request posted to a reactor by another thread
+ * Sends carry a copy of the payload; the same node is then queued per fd
+ */
+typedef struct uring_msg
+{
+  uint64_t kind;           // URING_OP_SEND, URING_OP_CLOSE or URING_OP_RECV (resume)
+  int fd;                  // Client socket
+  unsigned int generation; // Connection generation (resume only)
+  size_t length;           // Send: payload size, resume: free buffer space
+  size_t offset;           // Send: bytes already written
+  struct uring_msg *next;  // Next message in the mailbox or send queue
+  char data[];             // Send payload
+} uring_msg_t;
+
+/**
+ * @brief Per-fd submission state, only touched by the reactor thread
+ * Sends on one socket are serialized so replies are never interleaved
+ */
+typedef struct
+{
+  uring_msg_t *send_head; // Queued sends, head is the one in flight
+  uring_msg_t *send_tail; // Last queued send
+  int send_in_flight;     // 1 while a send SQE is submitted
+  int close_requested;    // 1 once the connection asked to be closed
+  int close_submitted;    // 1 once shutdown + close are submitted
+  size_t recv_room;       // Buffer space announced for the armed receive
+} uring_fd_state_t;
+
+/**
+ * @brief io_uring state of one reactor
+ */
+typedef struct
+{
+  struct io_uring ring;               // Submission/completion rings
+  struct io_uring_buf_ring *buf_ring; // Provided receive buffers
+  char *buffers;                      // URING_BUFFER_COUNT * URING_BUFFER_SIZE bytes
+  int listen_fd;                      // Listener of the owning reactor
+  reactor_t *reactor;                 // Owning reactor
+
+  // Cross-thread mailbox, drained when event_fd becomes readable
+  int event_fd;
+  uint64_t event_value;
+  pthread_mutex_t mailbox_lock;
+  uring_msg_t *mailbox_head;
+  uring_msg_t *mailbox_tail;
+
+  uring_fd_state_t fds[MAX_CLIENTS];
+} uring_state_t;
+
+// Reactor state of the calling thread (NULL on worker threads)
+static __thread uring_state_t *tls_current = NULL;
+
+/**
+ * @brief Get a submission entry, flushing the queue when fewer than count are free
+ * Linked chains must not be split across submissions, so callers reserve
+ * room for the whole chain up front
+ */
+static struct io_uring_sqe *
+get_sqe(uring_state_t *state, unsigned int count)
+{
+  if (io_uring_sq_space_left(&state->ring) < count)
+  {
+    io_uring_submit(&state->ring);
+  }
+  return io_uring_get_sqe(&state->ring);
+}
+
+static void
+arm_accept(uring_state_t *state)
+{
+  struct io_uring_sqe *sqe = get_sqe(state, 1);
+  io_uring_prep_multishot_accept(sqe, state->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  io_uring_sqe_set_data64(sqe, URING_OP_ACCEPT << 56);
+}
+
+static void
+arm_wakeup(uring_state_t *state)
+{
+  struct io_uring_sqe *sqe = get_sqe(state, 1);
+  io_uring_prep_read(sqe, state->event_fd, &state->event_value, sizeof(state->event_value), 0);
+  io_uring_sqe_set_data64(sqe, URING_OP_WAKEUP << 56);
+}
+
+/**
+ * @brief Arm a receive that picks its buffer from the provided buffer ring
+ * The length is capped by the free space in the connection read buffer
+ */
+static void
+arm_recv(uring_state_t *state, int fd, unsigned int generation, size_t room)
+{
+  size_t length = (room < URING_BUFFER_SIZE) ? room : URING_BUFFER_SIZE;
+
+  state->fds[fd].recv_room = room;
+
+  struct io_uring_sqe *sqe = get_sqe(state, 1);
+  io_uring_prep_recv(sqe, fd, NULL, length, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+  io_uring_sqe_set_data64(sqe, (URING_OP_RECV << 56) |
+                                   ((uint64_t)generation << 24) | (uint64_t)fd);
+}
+
+/**
+ * @brief Return a provided buffer to the ring once its bytes were copied
+ */
+static void
+recycle_buffer(uring_state_t *state, unsigned short bid)
+{
+  io_uring_buf_ring_add(state->buf_ring, state->buffers + (size_t)bid * URING_BUFFER_SIZE,
+                        URING_BUFFER_SIZE, bid,
+                        io_uring_buf_ring_mask(URING_BUFFER_COUNT), 0);
+  io_uring_buf_ring_advance(state->buf_ring, 1);
+}
+
+/**
+ * @brief Submit a shutdown + close chain for a socket
+ * The shutdown completes any receive still armed on the socket
+ */
+static void
+submit_close_chain(uring_state_t *state, int fd)
+{
+  struct io_uring_sqe *sqe = get_sqe(state, 2);
+  io_uring_prep_shutdown(sqe, fd, SHUT_RDWR);
+  sqe->flags |= IOSQE_IO_HARDLINK;
+  io_uring_sqe_set_data64(sqe, (URING_OP_SHUTDOWN << 56) | (uint64_t)fd);
+
+  sqe = io_uring_get_sqe(&state->ring);
+  io_uring_prep_close(sqe, fd);
+  io_uring_sqe_set_data64(sqe, (URING_OP_CLOSE << 56) | (uint64_t)fd);
+
+  state->fds[fd].close_submitted = 1;
+}
+
+/**
+ * @brief Start the next queued operation on a socket, if none is in flight
+ * The last send before a requested close is hard-linked to shutdown + close
+ */
+static void
+kick_fd(uring_state_t *state, int fd)
+{
+  uring_fd_state_t *fs = &state->fds[fd];
+
+  if (fs->send_in_flight || fs->close_submitted)
+  {
+    return;
+  }
+
+  uring_msg_t *msg = fs->send_head;
+  if (!msg)
+  {
+    if (fs->close_requested)
+    {
+      submit_close_chain(state, fd);
+    }
+    return;
+  }
+
+  int link_close = fs->close_requested && msg->next == NULL;
+
+  // Reserve the whole chain so it is not split across two submissions
+  struct io_uring_sqe *sqe = get_sqe(state, link_close ? 3 : 1);
+  io_uring_prep_send(sqe, fd, msg->data + msg->offset, msg->length - msg->offset,
+                     MSG_NOSIGNAL | MSG_WAITALL);
+  io_uring_sqe_set_data64(sqe, (URING_OP_SEND << 56) | (uint64_t)(uintptr_t)msg);
+  fs->send_in_flight = 1;
+
+  if (link_close)
+  {
+    sqe->flags |= IOSQE_IO_HARDLINK;
+    submit_close_chain(state, fd);
+  }
+}
+
+/**
+ * @brief Drop every queued send of a socket
+ */
+static void
+drop_sends(uring_fd_state_t *fs)
+{
+  while (fs->send_head)
+  {
+    uring_msg_t *msg = fs->send_head;
+    fs->send_head = msg->next;
+    free(msg);
+  }
+  fs->send_tail = NULL;
+}
+
+/**
+ * @brief Apply a message on the reactor thread
+ */
+static void
+apply_msg(uring_state_t *state, uring_msg_t *msg)
+{
+  uring_fd_state_t *fs = &state->fds[msg->fd];
+
+  switch (msg->kind)
+  {
+  case URING_OP_SEND:
+    msg->next = NULL;
+    if (fs->send_tail)
+    {
+      fs->send_tail->next = msg;
+    }
+    else
+    {
+      fs->send_head = msg;
+    }
+    fs->send_tail = msg;
+    break;
+
+  case URING_OP_CLOSE:
+    fs->close_requested = 1;
+    free(msg);
+    break;
+
+  case URING_OP_RECV:
+    if (!fs->close_requested)
+    {
+      arm_recv(state, msg->fd, msg->generation, msg->length);
+    }
+    free(msg);
+    break;
+
+  default:
+    free(msg);
+    break;
+  }
+}
+
+/**
+ * @brief Queue a message for the reactor owning the state
+ * Messages from the reactor thread itself are applied immediately
+ */
+static int
+post_msg(uring_state_t *state, uring_msg_t *msg)
+{
+  if (tls_current == state)
+  {
+    int fd = msg->fd;
+    apply_msg(state, msg);
+    kick_fd(state, fd);
+    return (0);
+  }
+
+  msg->next = NULL;
+
+  pthread_mutex_lock(&state->mailbox_lock);
+  if (state->mailbox_tail)
+  {
+    state->mailbox_tail->next = msg;
+  }
+  else
+  {
+    state->mailbox_head = msg;
+  }
+  state->mailbox_tail = msg;
+  pthread_mutex_unlock(&state->mailbox_lock);
+
+  uint64_t one = 1;
+  if (write(state->event_fd, &one, sizeof(one)) != sizeof(one))
+  {
+#if SHOW_WARNING
+    printf("[WARNING] Failed to wake io_uring reactor: %s\n", strerror(errno));
+#endif
+  }
+  return (0);
+}
+
+/**
+ * @brief Drain the cross-thread mailbox
+ */
+static void
+drain_mailbox(uring_state_t *state)
+{
+  pthread_mutex_lock(&state->mailbox_lock);
+  uring_msg_t *msg = state->mailbox_head;
+  state->mailbox_head = NULL;
+  state->mailbox_tail = NULL;
+  pthread_mutex_unlock(&state->mailbox_lock);
+
+  // Queue everything first so a send followed by a close gets linked
+  int touched[URING_QUEUE_DEPTH];
+  int touched_count = 0;
+
+  while (msg)
+  {
+    uring_msg_t *next = msg->next;
+    int fd = msg->fd;
+
+    apply_msg(state, msg);
+
+    if (touched_count < URING_QUEUE_DEPTH)
+    {
+      touched[touched_count++] = fd;
+    }
+    else
+    {
+      kick_fd(state, fd);
+    }
+    msg = next;
+  }
+
+  for (int i = 0; i < touched_count; ++i)
+  {
+    kick_fd(state, touched[i]);
+  }
+}
+
+/**
+ * @brief Handle one completion
+ */
+static void
+handle_cqe(uring_state_t *state, struct io_uring_cqe *cqe)
+{
+  uint64_t data = io_uring_cqe_get_data64(cqe);
+  int res = cqe->res;
+
+  switch (URING_KIND(data))
+  {
+  case URING_OP_ACCEPT:
+  {
+    if (res >= 0)
+    {
+#if SHOW_INFO
+      printf("[INFO] New connection on reactor %d: fd=%d (io_uring)\n", state->reactor->id, res);
+#endif
+      if (register_client(state->reactor, res) < 0)
+      {
+        close(res);
+      }
+    }
+    else if (res != -EAGAIN && res != -EINTR)
+    {
+#if SHOW_WARNING
+      printf("[WARNING] io_uring accept failed: %s\n", strerror(-res));
+#endif
+    }
+
+    // The kernel ends a multishot accept on errors; re-arm it
+    if (!(cqe->flags & IORING_CQE_F_MORE) && g_server.running)
+    {
+      arm_accept(state);
+    }
+    break;
+  }
+
+  case URING_OP_RECV:
+  {
+    int fd = URING_FD(data);
+    unsigned int generation = URING_GENERATION(data);
+
+    if (res == -ENOBUFS)
+    {
+      // Buffers are recycled as soon as they are copied; simply retry
+      if (!state->fds[fd].close_requested)
+      {
+        arm_recv(state, fd, generation, state->fds[fd].recv_room);
+      }
+      break;
+    }
+
+    size_t room;
+    if (res > 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+    {
+      unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+      room = connection_receive(fd, generation,
+                                state->buffers + (size_t)bid * URING_BUFFER_SIZE,
+                                (size_t)res);
+      recycle_buffer(state, bid);
+    }
+    else
+    {
+      if (cqe->flags & IORING_CQE_F_BUFFER)
+      {
+        recycle_buffer(state, (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+      }
+      room = connection_receive(fd, generation, NULL, 0); // End of stream or error
+    }
+
+    if (room > 0 && !state->fds[fd].close_requested)
+    {
+      arm_recv(state, fd, generation, room);
+    }
+    break;
+  }
+
+  case URING_OP_SEND:
+  {
+    uring_msg_t *msg = (uring_msg_t *)(uintptr_t)(data & ((1ULL << 56) - 1));
+    int fd = msg->fd;
+    uring_fd_state_t *fs = &state->fds[fd];
+
+    fs->send_in_flight = 0;
+
+    if (res < 0)
+    {
+#if SHOW_WARNING
+      printf("[WARNING] Failed to send message to client fd %d: %s\n", fd, strerror(-res));
+#endif
+      drop_sends(fs);
+      kick_fd(state, fd); // A close requested meanwhile still has to be submitted
+      break;
+    }
+
+    msg->offset += (size_t)res;
+    if (msg->offset < msg->length && !fs->close_submitted)
+    {
+      kick_fd(state, fd); // Short write: send the rest
+      break;
+    }
+
+    fs->send_head = msg->next;
+    if (!fs->send_head)
+    {
+      fs->send_tail = NULL;
+    }
+    free(msg);
+
+    kick_fd(state, fd);
+    break;
+  }
+
+  case URING_OP_CLOSE:
+  {
+    // The fd number may now be reused by a new connection
+    int fd = URING_FD(data);
+    drop_sends(&state->fds[fd]);
+    memset(&state->fds[fd], 0, sizeof(uring_fd_state_t));
+    break;
+  }
+
+  case URING_OP_WAKEUP:
+    drain_mailbox(state);
+    if (g_server.running)
+    {
+      arm_wakeup(state);
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+/**
+ * @brief Create the io_uring, buffer ring and wakeup eventfd of a reactor
+ * The reactor's listening socket must already be open
+ * @param reactor Reactor to initialize
+ * @return 0 on success, -1 on error
+ */
+int uring_reactor_init(reactor_t *reactor)
+{
+  uring_state_t *state = calloc(1, sizeof(uring_state_t));
+  if (!state)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Failed to allocate io_uring state\n");
+#endif
+    return (-1);
+  }
+
+  state->reactor = reactor;
+  state->listen_fd = reactor->listen_fd;
+
+  int ret = io_uring_queue_init(URING_QUEUE_DEPTH, &state->ring, 0);
+  if (ret < 0)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] io_uring_queue_init failed: %s\n", strerror(-ret));
+#endif
+    free(state);
+    return (-1);
+  }
+
+  // Provided buffer ring for receives
+  state->buffers = malloc((size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+  state->buf_ring = io_uring_setup_buf_ring(&state->ring, URING_BUFFER_COUNT,
+                                            URING_BUFFER_GROUP, 0, &ret);
+  if (!state->buffers || !state->buf_ring)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Failed to set up io_uring buffer ring\n");
+#endif
+    free(state->buffers);
+    io_uring_queue_exit(&state->ring);
+    free(state);
+    return (-1);
+  }
+
+  for (unsigned short bid = 0; bid < URING_BUFFER_COUNT; ++bid)
+  {
+    io_uring_buf_ring_add(state->buf_ring, state->buffers + (size_t)bid * URING_BUFFER_SIZE,
+                          URING_BUFFER_SIZE, bid,
+                          io_uring_buf_ring_mask(URING_BUFFER_COUNT), bid);
+  }
+  io_uring_buf_ring_advance(state->buf_ring, URING_BUFFER_COUNT);
+
+  // eventfd used by worker threads to hand sends and closes to the reactor
+  state->event_fd = eventfd(0, EFD_CLOEXEC);
+  if (state->event_fd == -1)
+  {
+    perror("eventfd");
+    io_uring_free_buf_ring(&state->ring, state->buf_ring, URING_BUFFER_COUNT, URING_BUFFER_GROUP);
+    free(state->buffers);
+    io_uring_queue_exit(&state->ring);
+    free(state);
+    return (-1);
+  }
+  pthread_mutex_init(&state->mailbox_lock, NULL);
+
+  arm_accept(state);
+  arm_wakeup(state);
+  io_uring_submit(&state->ring);
+
+  reactor->uring = state;
+  reactor->epoll_fd = -1;
+  return (0);
+}
+
+/**
+ * @brief Submit pending work, wait up to one second and handle completions
+ * @param reactor Reactor to run
+ * @return 0 on success, -1 on fatal error
+ */
+int uring_reactor_poll(reactor_t *reactor)
+{
+  uring_state_t *state = (uring_state_t *)reactor->uring;
+  struct io_uring_cqe *cqe;
+  struct __kernel_timespec timeout = {.tv_sec = 1, .tv_nsec = 0};
+
+  tls_current = state;
+
+  int ret = io_uring_submit_and_wait_timeout(&state->ring, &cqe, 1, &timeout, NULL);
+  if (ret < 0 && ret != -ETIME && ret != -EINTR)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] io_uring wait failed: %s\n", strerror(-ret));
+#endif
+    return (-1);
+  }
+
+  while (io_uring_peek_cqe(&state->ring, &cqe) == 0)
+  {
+    handle_cqe(state, cqe);
+    io_uring_cqe_seen(&state->ring, cqe);
+  }
+
+  return (0);
+}
+
+/**
+ * @brief Release the io_uring state of a reactor
+ * @param reactor Reactor to clean up
+ */
+void uring_reactor_destroy(reactor_t *reactor)
+{
+  uring_state_t *state = (uring_state_t *)reactor->uring;
+  if (!state)
+  {
+    return;
+  }
+
+  for (int fd = 0; fd < MAX_CLIENTS; ++fd)
+  {
+    drop_sends(&state->fds[fd]);
+  }
+
+  uring_msg_t *msg = state->mailbox_head;
+  while (msg)
+  {
+    uring_msg_t *next = msg->next;
+    free(msg);
+    msg = next;
+  }
+
+  io_uring_free_buf_ring(&state->ring, state->buf_ring, URING_BUFFER_COUNT, URING_BUFFER_GROUP);
+  io_uring_queue_exit(&state->ring);
+  close(state->event_fd);
+  pthread_mutex_destroy(&state->mailbox_lock);
+  free(state->buffers);
+  free(state);
+  reactor->uring = NULL;
+}
+
+/**
+ * @brief Ask the reactor to (re)arm a receive on a connection
+ * @param room Free space in the connection read buffer
+ * @return 0 on success, -1 on error
+ */
+int uring_resume_connection(reactor_t *reactor, int client_fd, unsigned int generation, size_t room)
+{
+  uring_msg_t *msg = malloc(sizeof(uring_msg_t));
+  if (!msg)
+  {
+    return (-1);
+  }
+
+  msg->kind = URING_OP_RECV;
+  msg->fd = client_fd;
+  msg->generation = generation;
+  msg->length = room;
+  msg->offset = 0;
+  return post_msg((uring_state_t *)reactor->uring, msg);
+}
+
+/**
+ * @brief Queue a send on the reactor owning a connection
+ * The payload is gathered into one copy, so the caller's buffers can be
+ * reused immediately
+ * @return 0 on success, -1 on error
+ */
+int uring_send(reactor_t *reactor, int client_fd, const struct iovec *iov, int iovcnt)
+{
+  size_t length = 0;
+  for (int i = 0; i < iovcnt; ++i)
+  {
+    length += iov[i].iov_len;
+  }
+
+  uring_msg_t *msg = malloc(sizeof(uring_msg_t) + length);
+  if (!msg)
+  {
+#if SHOW_ERROR
+    printf("[ERROR] Memory allocation failed for io_uring send\n");
+#endif
+    return (-1);
+  }
+
+  msg->kind = URING_OP_SEND;
+  msg->fd = client_fd;
+  msg->generation = 0;
+  msg->length = length;
+  msg->offset = 0;
+
+  size_t offset = 0;
+  for (int i = 0; i < iovcnt; ++i)
+  {
+    memcpy(msg->data + offset, iov[i].iov_base, iov[i].iov_len);
+    offset += iov[i].iov_len;
+  }
+  return post_msg((uring_state_t *)reactor->uring, msg);
+}
+
+/**
+ * @brief Ask the reactor to close a connection after its queued sends
+ */
+void uring_close_connection(reactor_t *reactor, int client_fd)
+{
+  uring_msg_t *msg = malloc(sizeof(uring_msg_t));
+  if (!msg)
+  {
+    // Out of memory: close synchronously, queued sends are lost
+    close(client_fd);
+    return;
+  }
+
+  msg->kind = URING_OP_CLOSE;
+  msg->fd = client_fd;
+  msg->generation = 0;
+  msg->length = 0;
+  msg->offset = 0;
+  post_msg((uring_state_t *)reactor->uring, msg);
+}
+
+#endif /* USE_IO_URING */
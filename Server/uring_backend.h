@@ -0,0 +1,16 @@
+#ifndef URING_BACKEND_H
+#define URING_BACKEND_H
+
+#include "server.h"
+#include <sys/uio.h>
+
+#ifdef USE_IO_URING
+int uring_reactor_init(reactor_t * reactor);
+int uring_reactor_poll(reactor_t * reactor);
+void uring_reactor_destroy(reactor_t * reactor);
+int uring_resume_connection(reactor_t * reactor, int client_fd, unsigned int generation, size_t room);
+int uring_send(reactor_t * reactor, int client_fd, const struct iovec * iov, int iovcnt);
+void uring_close_connection(reactor_t * reactor, int client_fd);
+#endif
+
+#endif /* URING_BACKEND_H */
@@ -228,7 +228,7 @@ test_response_pt() {
  * @return Pointer to string
  */
 char *
-test_response(char * language)
+test_response(const char * language)
 {
     char lang_copy[MAX_LANGUAGE_SIZE];
     
@@ -244,4 +244,142 @@ test_response(char * language)
     return (test_response_it());
 }
 
+/**
+ * @brief Return an apology to send while the AI is unavailable
+ * Used when the circuit breaker refuses AI calls. Unknown languages get
+ * the italian text, like test_response()
+ * @param language User's language preference
+ * @return Pointer to string
+ */
+const char *
+fallback_response(const char * language)
+{
+    static const char * fallback_it[3] = {
+        "Scusa, in questo momento non riesco a pensare bene. Riproviamo tra poco?",
+        "Mi serve un attimo per rimettere in ordine le idee. Puoi ripetere tra qualche secondo?",
+        "Ho la testa tra le nuvole proprio ora. Ne riparliamo tra un momento?"
+    };
+    static const char * fallback_en[3] = {
+        "Sorry, I can't think clearly right now. Shall we try again in a moment?",
+        "I need a moment to gather my thoughts. Could you say that again shortly?",
+        "My head is in the clouds right now. Can we pick this up in a minute?"
+    };
+    static const char * fallback_es[3] = {
+        "Lo siento, ahora mismo no consigo pensar con claridad. ¿Lo intentamos de nuevo en un momento?",
+        "Necesito un momento para ordenar mis ideas. ¿Puedes repetirlo dentro de poco?",
+        "Ahora mismo tengo la cabeza en las nubes. ¿Seguimos en un minuto?"
+    };
+    static const char * fallback_fr[3] = {
+        "Désolé, je n'arrive pas à réfléchir clairement pour le moment. On réessaie dans un instant?",
+        "J'ai besoin d'un moment pour rassembler mes idées. Tu peux répéter d'ici peu?",
+        "J'ai la tête dans les nuages en ce moment. On en reparle dans une minute?"
+    };
+    static const char * fallback_de[3] = {
+        "Entschuldigung, ich kann gerade nicht klar denken. Versuchen wir es gleich noch einmal?",
+        "Ich brauche einen Moment, um meine Gedanken zu sortieren. Kannst du das gleich wiederholen?",
+        "Ich bin gerade mit dem Kopf in den Wolken. Machen wir in einer Minute weiter?"
+    };
+    static const char * fallback_pt[3] = {
+        "Desculpa, agora não consigo pensar com clareza. Tentamos outra vez daqui a pouco?",
+        "Preciso de um momento para organizar as ideias. Podes repetir daqui a pouco?",
+        "Estou com a cabeça nas nuvens agora. Continuamos daqui a um minuto?"
+    };
+    static atomic_uint next = 0;
+
+    char lang_copy[MAX_LANGUAGE_SIZE];
+    const char ** table = fallback_it;
+
+    safe_strncpy(lang_copy, language, sizeof(lang_copy));
+    to_lowercase(lang_copy);
+
+    if (strcmp(lang_copy, "english") == 0 || strcmp(lang_copy, "en") == 0) table = fallback_en;
+    if (strcmp(lang_copy, "spanish") == 0 || strcmp(lang_copy, "es") == 0) table = fallback_es;
+    if (strcmp(lang_copy, "french") == 0 || strcmp(lang_copy, "fr") == 0) table = fallback_fr;
+    if (strcmp(lang_copy, "german") == 0 || strcmp(lang_copy, "de") == 0) table = fallback_de;
+    if (strcmp(lang_copy, "portuguese") == 0 || strcmp(lang_copy, "pt") == 0) table = fallback_pt;
+
+    return (table[atomic_fetch_add(&next, 1) % 3]);
+}
 
+/**
+ * @brief FNV-1a over a byte range, continuing from hash
+ */
+static uint64_t
+fnv1a(uint64_t hash, const void * data, size_t length)
+{
+    const unsigned char * bytes = data;
+
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return (hash);
+}
+
+/**
+ * @brief Trimmed view of a string (no copy)
+ */
+static void
+trim_view(const char * text, const char ** start, size_t * length)
+{
+    size_t begin = 0;
+    size_t end = strlen(text);
+
+    while (begin < end && isspace((unsigned char)text[begin])) begin++;
+    while (end > begin && isspace((unsigned char)text[end - 1])) end--;
+
+    *start = text + begin;
+    *length = end - begin;
+}
+
+/**
+ * @brief Build the normalized key of a dialog request
+ * @param key Output key (valid while the request payload is)
+ * @param request Parsed dialog request
+ */
+void
+request_key_init(request_key_t * key, const client_message_t * request)
+{
+    const char * language;
+    size_t language_length;
+
+    trim_view(request->personality, &key->field[0], &key->length[0]);
+    trim_view(request->language, &language, &language_length);
+    trim_view(request->conversation, &key->field[2], &key->length[2]);
+
+    if (language_length >= sizeof(key->language)) {
+        language_length = sizeof(key->language) - 1;
+    }
+    for (size_t i = 0; i < language_length; ++i) {
+        key->language[i] = (char)tolower((unsigned char)language[i]);
+    }
+    key->language[language_length] = '\0';
+    key->field[1] = key->language;
+    key->length[1] = language_length;
+
+    // Lengths are hashed too, so field boundaries matter
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 3; ++i) {
+        hash = fnv1a(hash, &key->length[i], sizeof(key->length[i]));
+        hash = fnv1a(hash, key->field[i], key->length[i]);
+    }
+    key->hash = hash;
+}
+
+/**
+ * @brief Compare two request keys
+ * @return 1 if both requests get the same answer, 0 otherwise
+ */
+int
+request_key_equal(const request_key_t * a, const request_key_t * b)
+{
+    if (a->hash != b->hash) return (0);
+
+    for (int i = 0; i < 3; ++i) {
+        if (a->length[i] != b->length[i] ||
+            memcmp(a->field[i], b->field[i], a->length[i]) != 0) {
+            return (0);
+        }
+    }
+    return (1);
+}
@@ -7,6 +7,9 @@
 int make_socket_non_blocking(int fd);
 void safe_strncpy(char * dest, const char * src, size_t size);
 char * trim_whitespace(char * str);
-char * test_response(char * language);
+char * test_response(const char * language);
+const char * fallback_response(const char * language);
+void request_key_init(request_key_t * key, const client_message_t * request);
+int request_key_equal(const request_key_t * a, const request_key_t * b);
 
 #endif /* UTILS_H */